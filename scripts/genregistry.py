@@ -9,6 +9,9 @@ import collections
 # to generate all the data files into a folder called 'generated'. Provide the
 # path to the file 'reports/registries.json' to this program to generate a file
 # with all the resource locations in a registry (in a custom format).
+#
+# Pass 'c' as the third argument to generate the AddRegistryEntry calls for
+# registry.c instead, in network order.
 
 if len(sys.argv) < 3:
     print("Please specify registries.json and registry")
@@ -18,6 +21,14 @@ f = open(sys.argv[1])
 registries = json.load(f, object_pairs_hook=collections.OrderedDict)
 registry = registries["minecraft:" + sys.argv[2]]
 
+if len(sys.argv) > 3 and sys.argv[3] == "c":
+    ordered = [None] * len(registry["entries"].keys())
+    for key in registry["entries"].keys():
+        ordered[registry["entries"][key]["protocol_id"]] = key
+    for key in ordered:
+        print("    AddRegistryEntry(registry, \"" + key + "\");")
+    sys.exit(0)
+
 for key in registry["entries"].keys():
     print("key " + key)
     print("")
@@ -1,246 +1,492 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <zlib.h>
-#include <sys/stat.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
 #include "shared.h"
 #include "buffer.h"
 #include "nbt.h"
 #include "chunk.h"
-
-static void FillBufferFromFile(int fd, Cursor * cursor) {
+#include "region.h"
+#include "uring.h"
+#include "decompress.h"
+#include "bitpack.h"
+
+// NOTE(traks): Reading many small pieces of a file is much slower than reading
+// one large piece, especially on HDDs. If the gap between the sectors of two
+// chunks is at most this many sectors, the chunks are read in one go and the
+// sectors in between are thrown away.
+#define MAX_CHUNK_READ_GAP_SECTORS (8)
+// NOTE(traks): don't merge reads beyond this many sectors. Single chunks can
+// still be larger than this
+#define MAX_MERGED_READ_SECTORS (256)
+
+static i32 ReadFromFile(int fd, i64 offset, u8 * data, i32 size) {
     BeginTimings(ReadFile);
 
-    int start_index = cursor->index;
+    i32 res = 1;
+    i32 index = 0;
 
-    while (cursor->index < cursor->size) {
-        int bytes_read = read(fd, cursor->data + cursor->index,
-                cursor->size - cursor->index);
+    while (index < size) {
+        ssize_t bytes_read = pread(fd, data + index, size - index, offset + index);
         if (bytes_read == -1) {
             LogErrno("Failed to read region file: %s");
-            cursor->error = 1;
+            res = 0;
             break;
         }
         if (bytes_read == 0) {
-            LogInfo("Wanted %d bytes from region file, but got %d",
-                    cursor->size - start_index,
-                    cursor->index - start_index);
-            cursor->error = 1;
+            LogInfo("Wanted %d bytes from region file, but got %d", size, index);
+            res = 0;
             break;
         }
 
-        cursor->index += bytes_read;
+        index += bytes_read;
     }
 
-    cursor->size = cursor->index;
-    cursor->index = start_index;
-
     EndTimings(ReadFile);
+    return res;
 }
 
-static void UnpackStoredLight(u8 * target, u8 * source) {
-    for (i32 i = 0; i < 2048; i++) {
-        SetSectionLight(target, 2 * i, source[i] & 0xf);
-        SetSectionLight(target, 2 * i + 1, source[i] >> 4);
-    }
-}
+typedef struct {
+    u32 startSector;
+    u32 endSector;
+    // NOTE(traks): range of the chunk reads that are part of this read
+    i32 firstRead;
+    i32 endRead;
+} MergedSectorRead;
+
+typedef struct AsyncChunkRead AsyncChunkRead;
+
+typedef struct {
+    AsyncChunkRead * context;
+    MergedSectorRead merged;
+} AsyncMergedRead;
+
+struct AsyncChunkRead {
+    RegionFile * region;
+    ChunkSectorRead * reads;
+    ChunkSectorsCallback callback;
+    void * data;
+    // NOTE(traks): the last completed read frees this
+    _Atomic i32 remainingReads;
+    AsyncMergedRead mergedReads[];
+};
+
+// NOTE(traks): Looks up where the chunks are stored and determines which reads
+// to do. Chunks that are stored somewhere are moved to the front and sorted by
+// sector offset. Returns the number of merged reads
+static i32 PlanChunkSectorReads(RegionFile * region, ChunkSectorRead * reads, i32 readCount, u32 maxMergedSectors, MergedSectorRead * mergedReads) {
+    i32 storedCount = 0;
+    for (i32 readIndex = 0; readIndex < readCount; readIndex++) {
+        ChunkSectorRead * read = reads + readIndex;
+        WorldChunkPos chunkPos = read->chunk->pos;
+        assert(chunkPos.worldId == region->worldId && (chunkPos.x >> 5) == region->regionX && (chunkPos.z >> 5) == region->regionZ);
+
+        read->data = NULL;
+        read->size = 0;
+        read->location = 0;
+
+        if (region->fd == -1) {
+            continue;
+        }
 
-void WorldLoadChunk(Chunk * chunk, MemoryArena * scratchArena) {
-    BeginTimings(ReadChunk);
+        // First read from the chunk location table at which sector (4096 byte
+        // block) the chunk data starts.
+        int index = ((chunkPos.z & 0x1f) << 5) | (chunkPos.x & 0x1f);
+        u32 loc = region->locations[index];
 
-    // @TODO(traks) error handling and/or error messages for all failure cases
-    // in this entire function?
+        if (loc == 0) {
+            // chunk not present in region file
+            continue;
+        }
 
-    int region_fd = -1;
-    WorldChunkPos chunkPos = chunk->pos;
+        u32 sector_offset = loc >> 8;
+        u32 sector_count = loc & 0xff;
 
-    int region_x = chunkPos.x >> 5;
-    int region_z = chunkPos.z >> 5;
+        if (sector_offset < 2) {
+            LogInfo("Chunk data in header");
+            continue;
+        }
+        if (sector_count == 0) {
+            LogInfo("Chunk data uses 0 sectors");
+            continue;
+        }
+        if (((i64) (sector_offset + sector_count) << 12) > region->fileSize) {
+            LogInfo("Chunk data out of bounds");
+            continue;
+        }
 
-    char * worldName = NULL;
-    if (chunkPos.worldId == 1) {
-        worldName = "world";
+        read->location = loc;
+        ChunkSectorRead stored = *read;
+        *read = reads[storedCount];
+        reads[storedCount] = stored;
+        storedCount++;
     }
 
-    if (worldName == NULL) {
-        LogInfo("Unknown world ID: %lld", (i64) chunkPos.worldId);
-        goto bail;
+    // NOTE(traks): sort stored chunks by sector offset, there aren't many
+    for (i32 readIndex = 1; readIndex < storedCount; readIndex++) {
+        ChunkSectorRead read = reads[readIndex];
+        i32 insertIndex = readIndex;
+        while (insertIndex > 0 && reads[insertIndex - 1].location > read.location) {
+            reads[insertIndex] = reads[insertIndex - 1];
+            insertIndex--;
+        }
+        reads[insertIndex] = read;
     }
 
-    unsigned char file_name[64];
-    int file_name_size = snprintf((void *) file_name, sizeof file_name, "%s/region/r.%d.%d.mca", worldName, region_x, region_z);
+    i32 mergedCount = 0;
+    i32 startIndex = 0;
+    while (startIndex < storedCount) {
+        u32 startSector = reads[startIndex].location >> 8;
+        u32 endSector = startSector + (reads[startIndex].location & 0xff);
+        i32 endIndex = startIndex + 1;
+        while (endIndex < storedCount) {
+            u32 nextStart = reads[endIndex].location >> 8;
+            u32 nextEnd = MAX(endSector, nextStart + (reads[endIndex].location & 0xff));
+            if (nextStart > endSector + MAX_CHUNK_READ_GAP_SECTORS || nextEnd - startSector > maxMergedSectors) {
+                break;
+            }
+            endSector = nextEnd;
+            endIndex++;
+        }
 
-    region_fd = open((void *) file_name, O_RDONLY);
-    if (region_fd == -1) {
-        LogErrno("Failed to open region file: %s");
-        goto bail;
+        mergedReads[mergedCount] = (MergedSectorRead) {
+            .startSector = startSector,
+            .endSector = endSector,
+            .firstRead = startIndex,
+            .endRead = endIndex,
+        };
+        mergedCount++;
+        startIndex = endIndex;
     }
+    return mergedCount;
+}
 
-    struct stat region_stat;
-    if (fstat(region_fd, &region_stat)) {
-        LogErrno("Failed to get region file stat: %s");
-        goto bail;
+static void AssignMergedRead(ChunkSectorRead * reads, MergedSectorRead * merged, u8 * buffer) {
+    for (i32 readIndex = merged->firstRead; readIndex < merged->endRead; readIndex++) {
+        ChunkSectorRead * read = reads + readIndex;
+        u32 loc = read->location;
+        read->data = buffer + (((loc >> 8) - merged->startSector) << 12);
+        read->size = (loc & 0xff) << 12;
     }
+}
 
-    Cursor header_cursor = {
-        .data = MallocInArena(scratchArena, 4096),
-        .size = 4096
-    };
-    FillBufferFromFile(region_fd, &header_cursor);
-    if (header_cursor.error) {
-        goto bail;
+i32 WorldReadChunkSectors(ChunkSectorRead * reads, i32 readCount, u8 * * readBuffers) {
+    BeginTimings(ReadChunkSectors);
+
+    i32 readBufferCount = 0;
+    WorldChunkPos firstPos = reads[0].chunk->pos;
+    RegionFile * region = AcquireRegionFile(firstPos.worldId, firstPos.x >> 5, firstPos.z >> 5);
+    MergedSectorRead * mergedReads = malloc(readCount * sizeof *mergedReads);
+    if (mergedReads == NULL) {
+        LogInfo("Failed to allocate merged reads");
+        exit(1);
+    }
+    i32 mergedCount = PlanChunkSectorReads(region, reads, readCount, MAX_MERGED_READ_SECTORS, mergedReads);
+
+    for (i32 mergedIndex = 0; mergedIndex < mergedCount; mergedIndex++) {
+        MergedSectorRead * merged = mergedReads + mergedIndex;
+        i32 bufferSize = (merged->endSector - merged->startSector) << 12;
+        u8 * buffer = malloc(bufferSize);
+        if (buffer != NULL && ReadFromFile(region->fd, (i64) merged->startSector << 12, buffer, bufferSize)) {
+            readBuffers[readBufferCount] = buffer;
+            readBufferCount++;
+            AssignMergedRead(reads, merged, buffer);
+        } else {
+            free(buffer);
+        }
     }
 
-    // First read from the chunk location table at which sector (4096 byte
-    // block) the chunk data starts.
-    int index = ((chunkPos.z & 0x1f) << 5) | (chunkPos.x & 0x1f);
-    header_cursor.index = index << 2;
-    u32 loc = ReadU32(&header_cursor);
+    free(mergedReads);
+    ReleaseRegionFile(region);
 
-    if (loc == 0) {
-        // chunk not present in region file
-        goto bail;
+    EndTimings(ReadChunkSectors);
+    return readBufferCount;
+}
+
+struct RegionFile * WorldMapChunkSectors(ChunkSectorRead * reads, i32 readCount) {
+    BeginTimings(MapChunkSectors);
+
+    WorldChunkPos firstPos = reads[0].chunk->pos;
+    RegionFile * region = AcquireRegionFile(firstPos.worldId, firstPos.x >> 5, firstPos.z >> 5);
+    if (region->fd != -1 && region->mapping == NULL) {
+        ReleaseRegionFile(region);
+        EndTimings(MapChunkSectors);
+        return NULL;
+    }
+
+    MergedSectorRead * mergedReads = malloc(readCount * sizeof *mergedReads);
+    if (mergedReads == NULL) {
+        LogInfo("Failed to allocate merged reads");
+        exit(1);
+    }
+    i32 mergedCount = PlanChunkSectorReads(region, reads, readCount, MAX_MERGED_READ_SECTORS, mergedReads);
+
+    // NOTE(traks): the mapping is accessed randomly, so tell the kernel which
+    // parts we're about to use. It can then read them in the background, with
+    // large reads for nearby chunks
+    uintptr_t pageMask = getpagesize() - 1;
+    for (i32 mergedIndex = 0; mergedIndex < mergedCount; mergedIndex++) {
+        MergedSectorRead * merged = mergedReads + mergedIndex;
+        u8 * start = region->mapping + ((i64) merged->startSector << 12);
+        u8 * end = region->mapping + ((i64) merged->endSector << 12);
+        u8 * pageStart = (u8 *) ((uintptr_t) start & ~pageMask);
+        madvise(pageStart, end - pageStart, MADV_WILLNEED);
+        AssignMergedRead(reads, merged, start);
     }
 
-    u32 sector_offset = loc >> 8;
-    u32 sector_count = loc & 0xff;
+    free(mergedReads);
 
-    if (sector_offset < 2) {
-        LogInfo("Chunk data in header");
-        goto bail;
+    EndTimings(MapChunkSectors);
+    return region;
+}
+
+static void FinishAsyncMergedRead(u8 * buffer, void * data) {
+    AsyncMergedRead * mergedRead = data;
+    AsyncChunkRead * context = mergedRead->context;
+    MergedSectorRead * merged = &mergedRead->merged;
+
+    if (buffer != NULL) {
+        AssignMergedRead(context->reads, merged, buffer);
     }
-    if (sector_count == 0) {
-        LogInfo("Chunk data uses 0 sectors");
-        goto bail;
+    context->callback(context->reads + merged->firstRead, merged->endRead - merged->firstRead, buffer, context->data);
+
+    if (atomic_fetch_sub_explicit(&context->remainingReads, 1, memory_order_acq_rel) == 1) {
+        ReleaseRegionFile(context->region);
+        free(context);
     }
-    if (((sector_offset + sector_count) << 12) > region_stat.st_size) {
-        LogInfo("Chunk data out of bounds");
-        goto bail;
+}
+
+void WorldReadChunkSectorsAsync(ChunkSectorRead * reads, i32 readCount, ChunkSectorsCallback callback, void * data) {
+    BeginTimings(ReadChunkSectorsAsync);
+
+    AsyncChunkRead * context = malloc(sizeof *context + readCount * sizeof *context->mergedReads);
+    if (context == NULL) {
+        LogInfo("Failed to allocate async chunk read");
+        exit(1);
     }
 
-    if (lseek(region_fd, sector_offset << 12, SEEK_SET) == -1) {
-        LogErrno("Failed to seek to chunk data: %s");
-        goto bail;
+    WorldChunkPos firstPos = reads[0].chunk->pos;
+    RegionFile * region = AcquireRegionFile(firstPos.worldId, firstPos.x >> 5, firstPos.z >> 5);
+    MergedSectorRead * mergedReads = malloc(readCount * sizeof *mergedReads);
+    if (mergedReads == NULL) {
+        LogInfo("Failed to allocate merged reads");
+        exit(1);
     }
+    // NOTE(traks): merged reads must fit in a pooled buffer
+    i32 mergedCount = PlanChunkSectorReads(region, reads, readCount, ASYNC_READ_BUFFER_SIZE >> 12, mergedReads);
+    i32 storedCount = (mergedCount > 0 ? mergedReads[mergedCount - 1].endRead : 0);
+    for (i32 mergedIndex = 0; mergedIndex < mergedCount; mergedIndex++) {
+        context->mergedReads[mergedIndex] = (AsyncMergedRead) {.context = context, .merged = mergedReads[mergedIndex]};
+    }
+    free(mergedReads);
 
-    Cursor cursor = {
-        .data = MallocInArena(scratchArena, sector_count << 12),
-        .size = sector_count << 12
+    if (storedCount < readCount) {
+        callback(reads + storedCount, readCount - storedCount, NULL, data);
+    }
+
+    if (mergedCount == 0) {
+        ReleaseRegionFile(region);
+        free(context);
+    } else {
+        context->region = region;
+        context->reads = reads;
+        context->callback = callback;
+        context->data = data;
+        atomic_store_explicit(&context->remainingReads, mergedCount, memory_order_relaxed);
+
+        // NOTE(traks): careful, the context may be freed once the last read
+        // has been submitted
+        int fd = region->fd;
+        for (i32 mergedIndex = 0; mergedIndex < mergedCount; mergedIndex++) {
+            MergedSectorRead * merged = &context->mergedReads[mergedIndex].merged;
+            SubmitAsyncRead(fd, (i64) merged->startSector << 12, (merged->endSector - merged->startSector) << 12,
+                    FinishAsyncMergedRead, context->mergedReads + mergedIndex);
+        }
+    }
+
+    EndTimings(ReadChunkSectorsAsync);
+}
+
+static Cursor CopyUncompressedChunk(u8 * data, i32 size, i32 maxSize, MemoryArena * arena) {
+    // NOTE(traks): no need to copy, the sectors stay around until the chunk
+    // has been decoded. The arena is only there to match the other
+    // decompressors
+    (void) arena;
+    Cursor res = {
+        .data = data,
+        .size = size,
+        .error = size > maxSize,
     };
-    FillBufferFromFile(region_fd, &cursor);
+    return res;
+}
 
-    u32 size_in_bytes = ReadU32(&cursor);
+typedef Cursor (* ChunkDecompressor)(u8 * data, i32 size, i32 maxSize, MemoryArena * arena);
+
+// NOTE(traks): indexed by the storage type in the chunk header, see
+// CHUNK_STORAGE_*. Add new compression methods here
+static ChunkDecompressor chunkDecompressors[] = {
+    [CHUNK_STORAGE_GZIP] = InflateGzip,
+    [CHUNK_STORAGE_ZLIB] = InflateZlib,
+    [CHUNK_STORAGE_UNCOMPRESSED] = CopyUncompressedChunk,
+    [CHUNK_STORAGE_LZ4] = DecompressLz4Blocks,
+};
+
+// NOTE(traks): runs on loader threads, so only use the decoded section light
+// functions here
+static void UnpackStoredLight(u8 * * target, u8 * source) {
+    // NOTE(traks): stored light uses the same nibble layout as we do
+    u8 * light = UnshareDecodedSectionLight(target);
+    memcpy(light, source, SECTION_LIGHT_SIZE);
+    CompactDecodedSectionLight(target);
+}
 
-    if ((i32) size_in_bytes > cursor.size - cursor.index) {
-        LogInfo("Chunk data outside of its sectors");
-        goto bail;
+// NOTE(traks): Either light array may be NULL if the section doesn't have it.
+// Returns 0 if the light is unusable
+static i32 LoadSectionLight(Chunk * chunk, i32 sectionY, u8 * skyLight, i32 skyLightSize, u8 * blockLight, i32 blockLightSize, u32 * sectionsWithSkyLight) {
+    if (sectionY < MIN_SECTION - 1 || sectionY > MAX_SECTION + 1) {
+        LogInfo("Section Y %d with light", sectionY);
+        return 0;
+    }
+    if ((skyLight != NULL && skyLightSize != SECTION_LIGHT_SIZE)
+            || (blockLight != NULL && blockLightSize != SECTION_LIGHT_SIZE)) {
+        LogInfo("Invalid light in section Y %d", sectionY);
+        return 0;
     }
 
-    cursor.size = cursor.index + size_in_bytes;
-    u8 storage_type = ReadU8(&cursor);
+    i32 lightSectionIndex = sectionY - MIN_SECTION + 1;
+    LightSection * lightSection = chunk->lightSections + lightSectionIndex;
+    if (skyLight != NULL) {
+        UnpackStoredLight(&lightSection->skyLight, skyLight);
+        *sectionsWithSkyLight |= (u32) 1 << lightSectionIndex;
+    }
+    if (blockLight != NULL) {
+        UnpackStoredLight(&lightSection->blockLight, blockLight);
+    }
+    return 1;
+}
 
-    if (cursor.error) {
-        LogInfo("Chunk header reading error");
-        goto bail;
+// NOTE(traks): Call once all sections have been loaded. Vanilla doesn't store
+// light of sections it doesn't care about. Missing block light is 0, which it
+// already is. Missing sky light is the bottom layer of the nearest section
+// above with sky light, or 15 if there is no such section.
+//
+// If the stored light is unusable, drops the light we did load, so the chunk
+// can be lit from scratch.
+static void FinishStoredLight(Chunk * chunk, i32 lightIsStored, i32 lightIsValid, u32 sectionsWithSkyLight) {
+    if (!lightIsStored || !lightIsValid) {
+        for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
+            LightSection * section = chunk->lightSections + sectionIndex;
+            FreeDecodedSectionLight(section->skyLight);
+            FreeDecodedSectionLight(section->blockLight);
+            section->skyLight = GetUniformSectionLight(0);
+            section->blockLight = GetUniformSectionLight(0);
+        }
+        return;
     }
 
-    if (storage_type & 0x80) {
-        // @TODO(traks) separate file is used to store the chunk
-        LogInfo("External chunk storage");
-        goto bail;
+    u8 * lightAbove = NULL;
+    for (i32 sectionIndex = LIGHT_SECTIONS_PER_CHUNK - 1; sectionIndex >= 0; sectionIndex--) {
+        LightSection * section = chunk->lightSections + sectionIndex;
+        if (sectionsWithSkyLight & ((u32) 1 << sectionIndex)) {
+            lightAbove = section->skyLight;
+        } else if (lightAbove == NULL) {
+            FreeDecodedSectionLight(section->skyLight);
+            section->skyLight = GetUniformSectionLight(15);
+        } else {
+            u8 * light = UnshareDecodedSectionLight(&section->skyLight);
+            for (i32 y = 0; y < 16; y++) {
+                memcpy(light + y * SECTION_LIGHT_SIZE / 16, lightAbove, SECTION_LIGHT_SIZE / 16);
+            }
+            CompactDecodedSectionLight(&section->skyLight);
+            lightAbove = section->skyLight;
+        }
     }
 
-    int windowBits;
+    atomic_fetch_or_explicit(&chunk->atomicFlags, CHUNK_ATOMIC_GOT_LIGHT, memory_order_relaxed);
+}
+
+// NOTE(traks): decode chunks by building a tree out of the chunk's NBT data and
+// looking values up in there, instead of streaming through the NBT data.
+// Slower and uses more memory, but handy for debugging (e.g. to print chunks
+// with NbtPrint)
+// #define DECODE_CHUNK_NBT_TREE
 
-    if (storage_type == 1) {
-        // gzip compressed
-        // 16 means: gzip stream and determine window size from header
-        windowBits = 16;
-    } else if (storage_type == 2) {
-        // zlib compressed
-        // 0 means: zlib stream and determine window size from header
-        windowBits = 0;
-    } else {
-        LogInfo("Unknown chunk compression method");
-        goto bail;
+#define MAX_PALETTE_ENTRIES (4096)
+
+// NOTE(traks): blockData points to big endian longs, as stored. Returns 0 if
+// the section is invalid
+static i32 DecodeSectionBlocks(Chunk * chunk, i32 sectionY, u16 * paletteMap, u32 paletteSize, u8 * blockData, i32 blockDataLongs, u8 * sectionsWithBlocks, u16 * blockStates) {
+    if (sectionY < MIN_SECTION || sectionY > MAX_SECTION) {
+        LogInfo("Invalid section Y %d with palette", (i32) sectionY);
+        return 0;
     }
 
-    BeginTimings(Inflate);
-    // @TODO(traks) perhaps use https://github.com/ebiggers/libdeflate instead
-    // of zlib. Using zlib now just because I had the code for it laying around.
-    // If we don't end up doing this, make sure the code below is actually
-    // correct (when do we need to clean stuff up?)!
-    z_stream zstream;
-    zstream.zalloc = Z_NULL;
-    zstream.zfree = Z_NULL;
-    zstream.opaque = Z_NULL;
+    i32 sectionIndex = sectionY - MIN_SECTION;
+    ChunkSection * section = chunk->sections + sectionIndex;
+    SectionBlocks * blocks = &section->blocks;
 
-    if (inflateInit2(&zstream, windowBits) != Z_OK) {
-        LogInfo("inflateInit failed");
-        EndTimings(Inflate);
-        goto bail;
+    if (sectionsWithBlocks[sectionIndex]) {
+        LogInfo("Duplicate block section for Y %d", (i32) sectionY);
+        return 0;
     }
+    sectionsWithBlocks[sectionIndex] = 1;
 
-    zstream.next_in = cursor.data + cursor.index;
-    zstream.avail_in = cursor.size - cursor.index;
-
-    // @TODO(traks) can be many many times larger in case of e.g. NBT data with
-    // tons and tons of empty lists.
-    size_t max_uncompressed_size = 2 * (1 << 20);
-    unsigned char * uncompressed = MallocInArena(scratchArena,
-            max_uncompressed_size);
-
-    zstream.next_out = uncompressed;
-    zstream.avail_out = max_uncompressed_size;
-
-    int inflate_status = inflate(&zstream, Z_FINISH);
-    switch (inflate_status) {
-    case Z_STREAM_END:
-        // all good
-        break;
-    case Z_NEED_DICT:
-    case Z_STREAM_ERROR:
-        LogInfo("Chunk inflate stream error");
-        break;
-    case Z_DATA_ERROR:
-        LogInfo("Failed to finish inflating chunk: %s", zstream.msg);
-        break;
-    case Z_MEM_ERROR:
-        LogInfo("Chunk inflate not enough memory");
-        break;
-    case Z_BUF_ERROR:
-    case Z_OK:
-        LogInfo("Uncompressed chunk size too large");
-        break;
-    }
-
-    if (inflateEnd(&zstream) != Z_OK) {
-        LogInfo("inflateEnd failed");
-        EndTimings(Inflate);
-        goto bail;
+    if (paletteSize == 1) {
+        // NOTE(traks): Block data may be missing! The code below won't
+        // work in that case, so we need some special handling.
+        u32 blockState = paletteMap[0];
+        SectionFillBlockState(blocks, blockState);
+
+        // TODO(traks): handle cave air and void air
+        if (blockState != 0) {
+            section->nonAirCount = 4096;
+        }
+        return 1;
     }
 
-    // bail in case of any errors above
-    if (zstream.avail_in != 0) {
-        EndTimings(Inflate);
-        goto bail;
+    i32 bitsPerBlock = CeilLog2U32(paletteSize);
+    // NOTE(traks): Vanilla tweaks bits-per-block in this way. Note
+    // that in chunk storage, 9+ bits per block doesn't get rounded
+    // up to the maximum number of bits per block!
+    if (bitsPerBlock < 4) {
+        bitsPerBlock = 4;
     }
-    EndTimings(Inflate);
+    i32 expectedNumberOfLongs = PackedSectionLongs(bitsPerBlock);
 
-    cursor = (Cursor) {
-        .data = uncompressed,
-        .size = zstream.total_out
-    };
+    if (blockDataLongs != expectedNumberOfLongs) {
+        LogInfo("Expected %d longs, but got %d", expectedNumberOfLongs, blockDataLongs);
+        return 0;
+    }
 
-    NbtCompound chunkNbt = NbtRead(&cursor, 1, scratchArena);
+    i32 nonAirCount = UnpackBlockStates(blockData, bitsPerBlock, paletteMap, paletteSize, blockStates);
+    if (nonAirCount < 0) {
+        LogInfo("Out of bounds palette index in section Y %d, palette size %d", (i32) sectionY, (i32) paletteSize);
+        return 0;
+    }
+    section->nonAirCount = nonAirCount;
 
-    if (cursor.error) {
+    // TODO(traks): Now that unpacking is fast, this is where most of the time
+    // goes. For palettes of up to 256 entries, we could build the section's
+    // palette straight from the stored one instead.
+    SectionSetAllBlockStates(blocks, blockStates);
+    return 1;
+}
+
+#ifdef DECODE_CHUNK_NBT_TREE
+static i32 DecodeChunkNbtTree(Chunk * chunk, Cursor * cursor, i32 loadLight, MemoryArena * scratchArena) {
+    NbtCompound chunkNbt = NbtRead(cursor, 1, scratchArena);
+
+    if (cursor->error) {
         LogInfo("Failed to load NBT data");
-        goto bail;
+        return 0;
     }
 
     // NbtPrint(&chunkNbt);
@@ -248,7 +494,7 @@ void WorldLoadChunk(Chunk * chunk, MemoryArena * scratchArena) {
     i32 dataVersion = NbtGetU32(&chunkNbt, STR("DataVersion"));
     if (dataVersion != SERVER_WORLD_VERSION) {
         LogInfo("Data version %jd != %jd", (intmax_t) dataVersion, (intmax_t) SERVER_WORLD_VERSION);
-        goto bail;
+        return 0;
     }
 
     String status = NbtGetString(&chunkNbt, STR("Status"));
@@ -256,25 +502,25 @@ void WorldLoadChunk(Chunk * chunk, MemoryArena * scratchArena) {
         // @TODO(traks) this message gets spammed on the edges of pregenerated
         // terrain. Maybe turn it into a debug message.
         LogInfo("Chunk not fully generated, status: %.*s", status.size, status.data);
-        goto bail;
+        return 0;
     }
 
-    i32 lightIsStored = NbtGetU8(&chunkNbt, STR("isLightOn"));
-    // @TODO(traks) remove; just used for testing lighting engine
-    // TODO(traks): figure out how we want to handle stored light and how we
-    // want to propagate it to other chunks, etc.
-    lightIsStored = 0;
+    i32 lightIsStored = loadLight && NbtGetU8(&chunkNbt, STR("isLightOn"));
+    i32 lightIsValid = 1;
+    u32 sectionsWithSkyLight = 0;
 
     NbtList sectionList = NbtGetList(&chunkNbt, STR("sections"), NBT_COMPOUND);
     i32 numSections = sectionList.size;
 
-    u32 maxPaletteEntries = 4096;
-    u16 * paletteMap = MallocInArena(scratchArena, maxPaletteEntries * sizeof (u16));
+    u32 maxPaletteEntries = MAX_PALETTE_ENTRIES;
+    // NOTE(traks): unpacking may read 1 entry past the end of the palette
+    u16 * paletteMap = MallocInArena(scratchArena, (maxPaletteEntries + 1) * sizeof (u16));
+    u16 * blockStates = MallocInArena(scratchArena, 4096 * sizeof (u16));
     u8 sectionsWithBlocks[MAX_SECTION - MIN_SECTION + 1] = {0};
 
     if (numSections > LIGHT_SECTIONS_PER_CHUNK) {
         LogInfo("Too many chunk sections: %ju", (uintmax_t) numSections);
-        goto bail;
+        return 0;
     }
 
     for (i32 sectionNbtIndex = 0; sectionNbtIndex < numSections; sectionNbtIndex++) {
@@ -288,26 +534,11 @@ void WorldLoadChunk(Chunk * chunk, MemoryArena * scratchArena) {
         NbtList blockData = NbtGetArrayU64(&blockStatesNbt, STR("data"));
 
         if (palette.size > 0) {
-            if (sectionY < MIN_SECTION || sectionY > MAX_SECTION) {
-                LogInfo("Invalid section Y %d with palette", (i32) sectionY);
-                goto bail;
-            }
-
-            i32 sectionIndex = sectionY - MIN_SECTION;
-            ChunkSection * section = chunk->sections + sectionIndex;
-            SectionBlocks * blocks = &section->blocks;
-
-            if (sectionsWithBlocks[sectionIndex]) {
-                LogInfo("Duplicate block section for Y %d", (i32) sectionY);
-                goto bail;
-            }
-            sectionsWithBlocks[sectionIndex] = 1;
-
             u32 paletteSize = palette.size;
 
             if (paletteSize <= 0 || paletteSize > maxPaletteEntries) {
                 LogInfo("Invalid palette size %ju", (uintmax_t) paletteSize);
-                goto bail;
+                return 0;
             }
 
             for (u32 paletteIndex = 0; paletteIndex < paletteSize; paletteIndex++) {
@@ -317,7 +548,7 @@ void WorldLoadChunk(Chunk * chunk, MemoryArena * scratchArena) {
 
                 if (typeId < 0 || typeId >= ACTUAL_BLOCK_TYPE_COUNT) {
                     LogInfo("Encountered invalid block type");
-                    goto bail;
+                    return 0;
                 }
 
                 u32 stride = 0;
@@ -347,111 +578,1054 @@ void WorldLoadChunk(Chunk * chunk, MemoryArena * scratchArena) {
                 paletteMap[paletteIndex] = blockState;
             }
 
-            if (paletteSize == 1) {
-                // NOTE(traks): Block data may be missing! The code below won't
-                // work in that case, so we need some special handling.
-                u32 blockState = paletteMap[0];
-                for (i32 posIndex = 0; posIndex < 4096; posIndex++) {
-                    SectionSetBlockState(blocks, posIndex, blockState);
-                }
+            if (!DecodeSectionBlocks(chunk, sectionY, paletteMap, paletteSize, blockData.listData, blockData.size, sectionsWithBlocks, blockStates)) {
+                return 0;
+            }
+        }
 
-                // TODO(traks): handle cave air and void air
-                if (blockState != 0) {
-                    section->nonAirCount = 4096;
-                }
-            } else {
-                i32 bitsPerBlock = CeilLog2U32(paletteSize);
-                // NOTE(traks): Vanilla tweaks bits-per-block in this way. Note
-                // that in chunk storage, 9+ bits per block doesn't get rounded
-                // up to the maximum number of bits per block!
-                if (bitsPerBlock < 4) {
-                    bitsPerBlock = 4;
-                }
-                u32 blocksPerLong = 64 / bitsPerBlock;
-                u32 expectedNumberOfLongs = (4096 + blocksPerLong - 1) / blocksPerLong;
-                u32 mask = ((u32) 1 << bitsPerBlock) - 1;
-                i32 bitOffset = 0;
+        if (lightIsStored && lightIsValid) {
+            NbtList skyLight = NbtGetArrayU8(&sectionNbt, STR("SkyLight"));
+            NbtList blockLight = NbtGetArrayU8(&sectionNbt, STR("BlockLight"));
+            if (skyLight.listData != NULL || blockLight.listData != NULL) {
+                lightIsValid = LoadSectionLight(chunk, sectionY, skyLight.listData, skyLight.size, blockLight.listData, blockLight.size, &sectionsWithSkyLight);
+            }
+        }
+    }
 
-                if (blockData.size != expectedNumberOfLongs) {
-                    LogInfo("Expected %d longs, but got %d", (i32) expectedNumberOfLongs, (i32) blockData.size);
-                    goto bail;
+    if (cursor->error) {
+        LogInfo("Failed to decipher NBT data");
+        // NbtPrint(&chunkNbt);
+        return 0;
+    }
+
+    if (loadLight) {
+        FinishStoredLight(chunk, lightIsStored, lightIsValid, sectionsWithSkyLight);
+    }
+    return 1;
+}
+#else
+// NOTE(traks): Returns the block state, or -1 if the palette entry is invalid.
+// The name and properties may be stored in any order, so we remember where the
+// properties are and look at them once we know the block type.
+static i32 DecodePaletteEntryNbt(Cursor * cursor) {
+    String resourceLoc = {0};
+    Cursor propsCursor = {0};
+
+    for (;;) {
+        u8 tag = ReadU8(cursor);
+        if (tag == NBT_TAG_END || cursor->error) {
+            break;
+        }
+        String key = NbtReadString(cursor);
+        if (tag == NBT_TAG_STRING && net_string_equal(key, STR("Name"))) {
+            resourceLoc = NbtReadString(cursor);
+        } else if (tag == NBT_TAG_COMPOUND && net_string_equal(key, STR("Properties"))) {
+            propsCursor = *cursor;
+            NbtSkip(cursor, tag);
+        } else {
+            NbtSkip(cursor, tag);
+        }
+    }
+    if (cursor->error) {
+        return -1;
+    }
+
+    i32 typeId = ResolveRegistryEntryId(&serv->blockRegistry, resourceLoc);
+    if (typeId < 0 || typeId >= ACTUAL_BLOCK_TYPE_COUNT) {
+        LogInfo("Encountered invalid block type");
+        return -1;
+    }
+
+    block_properties * props = serv->block_properties_table + typeId;
+    i32 valueIndices[MAX_PROPERTIES_PER_BLOCK];
+    for (u32 propIndex = 0; propIndex < props->property_count; propIndex++) {
+        valueIndices[propIndex] = props->default_value_indices[propIndex];
+    }
+
+    while (propsCursor.data != NULL) {
+        u8 tag = ReadU8(&propsCursor);
+        if (tag == NBT_TAG_END || propsCursor.error) {
+            break;
+        }
+        String propName = NbtReadString(&propsCursor);
+        if (tag != NBT_TAG_STRING) {
+            NbtSkip(&propsCursor, tag);
+            continue;
+        }
+        String propVal = NbtReadString(&propsCursor);
+
+        for (u32 propIndex = 0; propIndex < props->property_count; propIndex++) {
+            block_property_spec * propSpec = serv->block_property_specs + props->property_specs[propIndex];
+            String specName = {
+                .size = propSpec->tape[0],
+                .data = propSpec->tape + 1
+            };
+            if (net_string_equal(propName, specName)) {
+                i32 valueIndex = find_property_value_index(propSpec, propVal);
+                if (valueIndex >= 0) {
+                    valueIndices[propIndex] = valueIndex;
                 }
+                break;
+            }
+        }
+    }
 
-                u64 entry = NbtNextU64(&blockData);
+    u32 stride = 0;
+    for (u32 propIndex = 0; propIndex < props->property_count; propIndex++) {
+        block_property_spec * propSpec = serv->block_property_specs + props->property_specs[propIndex];
+        stride = stride * propSpec->value_count + valueIndices[propIndex];
+    }
 
-                for (i32 posIndex = 0; posIndex < 4096; posIndex++) {
-                    if (bitOffset > 64 - bitsPerBlock) {
-                        entry = NbtNextU64(&blockData);
-                        bitOffset = 0;
-                    }
+    i32 blockState = props->base_state + stride;
+    assert(blockState < serv->vanilla_block_state_count);
+    return blockState;
+}
 
-                    u32 paletteIndex = (entry >> bitOffset) & mask;
-                    bitOffset += bitsPerBlock;
+// NOTE(traks): Block states of palette entries by the raw NBT of the entry.
+// The same few hundred palette entries show up in nearly every chunk, and
+// they're stored the same way every time, so this saves us from resolving
+// block names and property values over and over again. Shared by all threads
+// decoding chunks. Entries are never removed or modified once inserted, so
+// lookups don't need locks. Once full, entries just aren't cached anymore.
+#define PALETTE_CACHE_SLOTS (8192)
+#define PALETTE_CACHE_MAX_ENTRIES (PALETTE_CACHE_SLOTS / 2)
+#define PALETTE_CACHE_MAX_KEY_SIZE (512)
+
+typedef struct {
+    u64 hash;
+    i32 blockState;
+    i32 keySize;
+    u8 key[];
+} PaletteCacheEntry;
+
+static _Atomic(PaletteCacheEntry *) paletteCache[PALETTE_CACHE_SLOTS];
+static _Atomic i32 paletteCacheCount;
+
+static inline u64 ReadPaletteKeyWord(u8 * key, i32 index) {
+    u64 res;
+    memcpy(&res, key + index, 8);
+    return res;
+}
 
-                    if (paletteIndex >= paletteSize) {
-                        LogInfo("Out of bounds palette index %d >= %d in section Y %d", paletteIndex, paletteSize, (i32) sectionY);
-                        goto bail;
-                    }
+// NOTE(traks): Entries mostly differ in the block name and the property values
+// at the end, so only hash some words from the middle and the end instead of
+// every byte. Collisions are fine, lookups compare the entire key anyway
+static u64 HashPaletteEntryKey(u8 * key, i32 keySize) {
+    u64 a;
+    u64 b;
+    u64 c;
+    if (keySize >= 16) {
+        a = ReadPaletteKeyWord(key, keySize / 2 - 4);
+        b = ReadPaletteKeyWord(key, keySize - 16);
+        c = ReadPaletteKeyWord(key, keySize - 8);
+    } else {
+        a = b = c = 0;
+        memcpy(&a, key, MIN(keySize, 8));
+        memcpy(&b, key + MIN(keySize, 8), keySize - MIN(keySize, 8));
+    }
+    u64 res = (a ^ keySize) * 0x9e3779b97f4a7c15;
+    res ^= (b + 0x632be59bd9b4e019) * 0xc2b2ae3d27d4eb4f;
+    res ^= (c ^ (c >> 31)) * 0x165667b19e3779f9;
+    res ^= res >> 32;
+    return res;
+}
+
+static inline i32 PaletteKeysEqual(u8 * a, u8 * b, i32 keySize) {
+    if (keySize < 8) {
+        return memcmp(a, b, keySize) == 0;
+    }
+    // NOTE(traks): compare 8 bytes at a time, the last word may overlap with
+    // the previous one
+    u64 diff = 0;
+    i32 index = 0;
+    for (; index < keySize - 8; index += 8) {
+        diff |= ReadPaletteKeyWord(a, index) ^ ReadPaletteKeyWord(b, index);
+    }
+    diff |= ReadPaletteKeyWord(a, keySize - 8) ^ ReadPaletteKeyWord(b, keySize - 8);
+    return diff == 0;
+}
+
+static inline i32 PaletteCacheEntryMatches(PaletteCacheEntry * entry, u8 * key, i32 keySize, u64 hash) {
+    return entry->hash == hash && entry->keySize == keySize && PaletteKeysEqual(entry->key, key, keySize);
+}
+
+// NOTE(traks): returns -1 if the palette entry isn't cached
+static i32 LookUpPaletteCache(u8 * key, i32 keySize, u64 hash) {
+    u32 mask = PALETTE_CACHE_SLOTS - 1;
+    for (u32 index = hash & mask; ; index = (index + 1) & mask) {
+        PaletteCacheEntry * entry = atomic_load_explicit(paletteCache + index, memory_order_acquire);
+        if (entry == NULL) {
+            return -1;
+        }
+        if (PaletteCacheEntryMatches(entry, key, keySize, hash)) {
+            return entry->blockState;
+        }
+    }
+}
+
+static void InsertPaletteCache(u8 * key, i32 keySize, u64 hash, i32 blockState) {
+    if (keySize > PALETTE_CACHE_MAX_KEY_SIZE
+            || atomic_load_explicit(&paletteCacheCount, memory_order_relaxed) >= PALETTE_CACHE_MAX_ENTRIES
+            || atomic_fetch_add_explicit(&paletteCacheCount, 1, memory_order_relaxed) >= PALETTE_CACHE_MAX_ENTRIES) {
+        return;
+    }
+
+    PaletteCacheEntry * newEntry = malloc(sizeof *newEntry + keySize);
+    if (newEntry == NULL) {
+        return;
+    }
+    newEntry->hash = hash;
+    newEntry->blockState = blockState;
+    newEntry->keySize = keySize;
+    memcpy(newEntry->key, key, keySize);
+
+    // NOTE(traks): the table is at most half full, so there's always an empty
+    // slot somewhere
+    u32 mask = PALETTE_CACHE_SLOTS - 1;
+    for (u32 index = hash & mask; ; index = (index + 1) & mask) {
+        PaletteCacheEntry * entry = NULL;
+        if (atomic_compare_exchange_strong_explicit(paletteCache + index, &entry, newEntry, memory_order_release, memory_order_acquire)) {
+            return;
+        }
+        if (PaletteCacheEntryMatches(entry, key, keySize, hash)) {
+            // NOTE(traks): another thread beat us to it
+            free(newEntry);
+            return;
+        }
+    }
+}
+
+// NOTE(traks): Palette entries resolved earlier in the same chunk. Most
+// sections of a chunk use the same handful of entries, and unlike the entries
+// of the shared cache, their bytes are usually still in the CPU cache. So
+// checking these first is a lot cheaper than going to the shared cache
+#define CHUNK_PALETTE_MEMO_SLOTS (64)
+
+typedef struct {
+    u8 * key;
+    i32 keySize;
+    i32 blockState;
+} ChunkPaletteMemoEntry;
+
+typedef struct {
+    Chunk * chunk;
+    u16 * paletteMap;
+    u16 * blockStates;
+    u8 sectionsWithBlocks[MAX_SECTION - MIN_SECTION + 1];
+    ChunkPaletteMemoEntry paletteMemo[CHUNK_PALETTE_MEMO_SLOTS];
+    i32 loadLight;
+    i32 lightIsValid;
+    u32 sectionsWithSkyLight;
+} ChunkNbtDecoder;
+
+// NOTE(traks): returns the block state, or -1 if the palette entry is invalid
+static i32 ResolvePaletteEntryNbt(ChunkNbtDecoder * decoder, Cursor * cursor) {
+    Cursor entryCursor = *cursor;
+    u8 * key = cursor->data + cursor->index;
+    NbtSkip(cursor, NBT_TAG_COMPOUND);
+    if (cursor->error) {
+        return -1;
+    }
+    i32 keySize = (cursor->data + cursor->index) - key;
+    u64 hash = HashPaletteEntryKey(key, keySize);
 
-                    u32 blockState = paletteMap[paletteIndex];
-                    SectionSetBlockState(blocks, posIndex, blockState);
+    ChunkPaletteMemoEntry * memo = decoder->paletteMemo + ((hash >> 32) & (CHUNK_PALETTE_MEMO_SLOTS - 1));
+    if (memo->keySize == keySize && memo->key != NULL && PaletteKeysEqual(memo->key, key, keySize)) {
+        return memo->blockState;
+    }
+
+    i32 blockState = LookUpPaletteCache(key, keySize, hash);
+    if (blockState < 0) {
+        blockState = DecodePaletteEntryNbt(&entryCursor);
+        if (blockState < 0) {
+            return -1;
+        }
+        InsertPaletteCache(key, keySize, hash, blockState);
+    }
+    *memo = (ChunkPaletteMemoEntry) {.key = key, .keySize = keySize, .blockState = blockState};
+    return blockState;
+}
 
-                    // TODO(traks): handle cave air and void air
-                    if (blockState != 0) {
-                        section->nonAirCount++;
+static i32 DecodeSectionNbt(ChunkNbtDecoder * decoder, Cursor * cursor) {
+    i32 sectionY = 0;
+    u32 paletteSize = 0;
+    u8 * blockData = NULL;
+    i32 blockDataLongs = 0;
+    u8 * skyLight = NULL;
+    i32 skyLightSize = 0;
+    u8 * blockLight = NULL;
+    i32 blockLightSize = 0;
+
+    for (;;) {
+        u8 tag = ReadU8(cursor);
+        if (tag == NBT_TAG_END || cursor->error) {
+            break;
+        }
+        String key = NbtReadString(cursor);
+        if (net_string_equal(key, STR("Y"))) {
+            // NOTE(traks): Should be u8, but sometimes this is an u32 in the
+            // wild. Allow any int type, because we might as well
+            sectionY = (i8) NbtReadUAny(cursor, tag);
+        } else if (tag == NBT_TAG_COMPOUND && net_string_equal(key, STR("block_states"))) {
+            for (;;) {
+                u8 statesTag = ReadU8(cursor);
+                if (statesTag == NBT_TAG_END || cursor->error) {
+                    break;
+                }
+                String statesKey = NbtReadString(cursor);
+                if (statesTag == NBT_TAG_LIST && net_string_equal(statesKey, STR("palette"))) {
+                    Cursor listStart = *cursor;
+                    u8 elemTag = ReadU8(cursor);
+                    i32 elemCount = ReadU32(cursor);
+                    if (elemTag != NBT_TAG_COMPOUND) {
+                        *cursor = listStart;
+                        NbtSkip(cursor, statesTag);
+                        continue;
+                    }
+                    if (elemCount > MAX_PALETTE_ENTRIES) {
+                        LogInfo("Invalid palette size %ju", (uintmax_t) elemCount);
+                        return 0;
                     }
+                    for (i32 paletteIndex = 0; paletteIndex < elemCount; paletteIndex++) {
+                        i32 blockState = ResolvePaletteEntryNbt(decoder, cursor);
+                        if (blockState < 0) {
+                            return 0;
+                        }
+                        decoder->paletteMap[paletteIndex] = blockState;
+                    }
+                    paletteSize = MAX(elemCount, 0);
+                } else if (statesTag == NBT_TAG_LONG_ARRAY && net_string_equal(statesKey, STR("data"))) {
+                    blockData = NbtReadArray(cursor, 8, &blockDataLongs);
+                } else {
+                    NbtSkip(cursor, statesTag);
                 }
             }
+        } else if (decoder->loadLight && tag == NBT_TAG_BYTE_ARRAY && net_string_equal(key, STR("SkyLight"))) {
+            skyLight = NbtReadArray(cursor, 1, &skyLightSize);
+        } else if (decoder->loadLight && tag == NBT_TAG_BYTE_ARRAY && net_string_equal(key, STR("BlockLight"))) {
+            blockLight = NbtReadArray(cursor, 1, &blockLightSize);
+        } else {
+            // NOTE(traks): biomes, which we don't use at the moment
+            NbtSkip(cursor, tag);
         }
+    }
+
+    if (cursor->error) {
+        LogInfo("Failed to decipher NBT data");
+        return 0;
+    }
+    if ((skyLight != NULL || blockLight != NULL) && decoder->lightIsValid) {
+        decoder->lightIsValid = LoadSectionLight(decoder->chunk, sectionY, skyLight, skyLightSize, blockLight, blockLightSize, &decoder->sectionsWithSkyLight);
+    }
+    if (paletteSize > 0) {
+        return DecodeSectionBlocks(decoder->chunk, sectionY, decoder->paletteMap, paletteSize, blockData, blockDataLongs, decoder->sectionsWithBlocks, decoder->blockStates);
+    }
+    return 1;
+}
+
+// NOTE(traks): Walks over the chunk's NBT data once, skipping everything we
+// don't need, and decodes sections as we encounter them. Sections may come
+// before the data version and status, in which case we decode them for
+// nothing if the chunk turns out to be unusable. That's rare enough.
+static i32 DecodeChunkNbt(Chunk * chunk, Cursor * cursor, i32 loadLight, MemoryArena * scratchArena) {
+    BeginTimings(DecodeChunkNbt);
+
+    ChunkNbtDecoder decoder = {
+        .chunk = chunk,
+        .loadLight = loadLight,
+        .lightIsValid = 1,
+        // NOTE(traks): unpacking may read 1 entry past the end of the palette
+        .paletteMap = MallocInArena(scratchArena, (MAX_PALETTE_ENTRIES + 1) * sizeof (u16)),
+        .blockStates = MallocInArena(scratchArena, 4096 * sizeof (u16)),
+    };
+    i32 dataVersion = 0;
+    String status = {0};
+    i32 lightIsStored = 0;
+    i32 res = 0;
+
+    u8 rootTag = ReadU8(cursor);
+    NbtReadString(cursor);
+    if (rootTag != NBT_TAG_COMPOUND || cursor->error) {
+        LogInfo("Failed to load NBT data");
+        goto bail;
+    }
 
-        // TODO(traks): for now we don't load stored light, because we need to
-        // invalidate it if any of the surrounding chunks got light updates
-        // while this chunk was unloaded. Not sure if stuff like that is even
-        // fixable? How would we detect if this chunk got unloaded before the
-        // most recent light updates to neighbour chunk got saved to disk.
-        if (lightIsStored && 0) {
-            if (sectionY < MIN_SECTION - 1 || sectionY > MAX_SECTION + 1) {
-                LogInfo("Section Y %d with light", (int) sectionY);
+    for (;;) {
+        u8 tag = ReadU8(cursor);
+        if (tag == NBT_TAG_END || cursor->error) {
+            break;
+        }
+        String key = NbtReadString(cursor);
+        if (tag == NBT_TAG_INT && net_string_equal(key, STR("DataVersion"))) {
+            dataVersion = ReadU32(cursor);
+        } else if (tag == NBT_TAG_STRING && net_string_equal(key, STR("Status"))) {
+            status = NbtReadString(cursor);
+        } else if (tag == NBT_TAG_BYTE && net_string_equal(key, STR("isLightOn"))) {
+            lightIsStored = ReadU8(cursor);
+        } else if (tag == NBT_TAG_LIST && net_string_equal(key, STR("sections"))) {
+            Cursor listStart = *cursor;
+            u8 elemTag = ReadU8(cursor);
+            i32 sectionCount = ReadU32(cursor);
+            if (elemTag != NBT_TAG_COMPOUND) {
+                *cursor = listStart;
+                NbtSkip(cursor, tag);
+                continue;
+            }
+            if (sectionCount > LIGHT_SECTIONS_PER_CHUNK) {
+                LogInfo("Too many chunk sections: %ju", (uintmax_t) sectionCount);
                 goto bail;
             }
+            for (i32 sectionNbtIndex = 0; sectionNbtIndex < sectionCount; sectionNbtIndex++) {
+                if (!DecodeSectionNbt(&decoder, cursor)) {
+                    goto bail;
+                }
+            }
+        } else {
+            NbtSkip(cursor, tag);
+        }
+    }
 
-            i32 lightSectionIndex = sectionY - MIN_SECTION + 1;
-            LightSection * lightSection = chunk->lightSections + lightSectionIndex;
+    if (cursor->error) {
+        LogInfo("Failed to decipher NBT data");
+        goto bail;
+    }
 
-            NbtList skyLight = NbtGetArrayU8(&sectionNbt, STR("SkyLight"));
-            NbtList blockLight = NbtGetArrayU8(&sectionNbt, STR("BlockLight"));
+    if (dataVersion != SERVER_WORLD_VERSION) {
+        LogInfo("Data version %jd != %jd", (intmax_t) dataVersion, (intmax_t) SERVER_WORLD_VERSION);
+        goto bail;
+    }
+
+    if (!net_string_equal(status, STR("minecraft:full"))) {
+        // @TODO(traks) this message gets spammed on the edges of pregenerated
+        // terrain. Maybe turn it into a debug message.
+        LogInfo("Chunk not fully generated, status: %.*s", status.size, status.data);
+        goto bail;
+    }
+
+    if (loadLight) {
+        FinishStoredLight(chunk, lightIsStored, decoder.lightIsValid, decoder.sectionsWithSkyLight);
+    }
+
+    res = 1;
+bail:
+    EndTimings(DecodeChunkNbt);
+    return res;
+}
+#endif
+
+#define MAX_UNCOMPRESSED_CHUNK_SIZE ((i32) 32 << 20)
+
+void WorldDecodeChunk(Chunk * chunk, u8 * sectors, i32 size, i32 loadLight, MemoryArena * scratchArena) {
+    BeginTimings(DecodeChunk);
+
+    // @TODO(traks) error handling and/or error messages for all failure cases
+    // in this entire function?
+
+    if (sectors == NULL) {
+        goto bail;
+    }
+
+    Cursor cursor = {
+        .data = sectors,
+        .size = size
+    };
+
+    u32 size_in_bytes = ReadU32(&cursor);
+
+    if ((i32) size_in_bytes > cursor.size - cursor.index) {
+        LogInfo("Chunk data outside of its sectors");
+        goto bail;
+    }
+
+    cursor.size = cursor.index + size_in_bytes;
+    u8 storage_type = ReadU8(&cursor);
+
+    if (cursor.error) {
+        LogInfo("Chunk header reading error");
+        goto bail;
+    }
+
+    if (storage_type & 0x80) {
+        // @TODO(traks) separate file is used to store the chunk
+        LogInfo("External chunk storage");
+        goto bail;
+    }
+
+    ChunkDecompressor decompress = NULL;
+    if (storage_type < ARRAY_SIZE(chunkDecompressors)) {
+        decompress = chunkDecompressors[storage_type];
+    }
+    if (decompress == NULL) {
+        LogInfo("Unknown chunk compression method");
+        goto bail;
+    }
+
+    // NOTE(traks): NBT data can be many many times larger than the compressed
+    // data, e.g. with tons and tons of empty lists. So allow a lot, the
+    // decompressor gives back what it doesn't need. Still cap it, so a
+    // decompression bomb can't make every worker take up a ton of memory
+    i32 align = alignof (max_align_t);
+    i32 maxUncompressedSize = MIN(MAX_UNCOMPRESSED_CHUNK_SIZE, (scratchArena->size - scratchArena->index) / align * align);
+    cursor = decompress(cursor.data + cursor.index, cursor.size - cursor.index, maxUncompressedSize, scratchArena);
+    if (cursor.error) {
+        goto bail;
+    }
+
+#ifdef DECODE_CHUNK_NBT_TREE
+    i32 decoded = DecodeChunkNbtTree(chunk, &cursor, loadLight, scratchArena);
+#else
+    i32 decoded = DecodeChunkNbt(chunk, &cursor, loadLight, scratchArena);
+#endif
+    if (!decoded) {
+        goto bail;
+    }
+
+    ChunkRecalculateMotionBlockingHeightMap(chunk);
+
+    atomic_fetch_or_explicit(&chunk->atomicFlags, CHUNK_ATOMIC_LOAD_SUCCESS, memory_order_relaxed);
+
+bail:
+    EndTimings(DecodeChunk);
+}
+
+// NOTE(traks): Snapshot files are mapped next to each other into one range of
+// address space at startup, so we can tell snapshot memory apart from other
+// section memory with a single comparison. They stay mapped until the server
+// shuts down.
+u8 * snapshotMemory;
+i64 snapshotMemorySize;
+
+#define SNAPSHOT_PAGE_SIZE (4096)
+// NOTE(traks): section memory in the snapshot is aligned to cache lines
+#define SNAPSHOT_DATA_ALIGNMENT (64)
+#define SNAPSHOT_VERSION (1)
+
+static u8 snapshotMagic[8] = {'B', 'L', 'A', 'Z', 'E', 'S', 'N', 'P'};
+
+// NOTE(traks): The format is native: integers are in the byte order of the
+// machine that wrote the snapshot, and block states are IDs of the block state
+// registry of the server that wrote it. The header says which, and snapshots
+// that don't match are ignored. Chunk records start on a page boundary and
+// hold the exact section memory we use at runtime, so sections can point
+// straight into the mapping.
+typedef struct {
+    u8 magic[8];
+    u32 byteOrderMark;
+    u32 version;
+    u32 dataVersion;
+    u32 blockStateCount;
+    i32 minSection;
+    i32 sectionsPerChunk;
+    // NOTE(traks): page of the chunk record, or 0 if the chunk isn't in the
+    // snapshot. Indexed as zx
+    u32 chunkPages[REGION_CHUNKS];
+    // NOTE(traks): so we can read chunks ahead without touching them
+    u32 chunkPageCounts[REGION_CHUNKS];
+} SnapshotHeader;
+
+typedef struct {
+    // NOTE(traks): offset of the section memory from the start of the chunk
+    // record, 0 if the section is null
+    u32 dataOffset;
+    u16 singleState;
+    u16 paletteSize;
+    u16 paletteUsed;
+    u16 nonAirCount;
+    u8 bitsPerEntry;
+    u8 padding[3];
+} SnapshotBlockSection;
+
+typedef struct {
+    // NOTE(traks): light value if less than 16, otherwise the offset of the
+    // light array from the start of the chunk record
+    u32 skyLight;
+    u32 blockLight;
+} SnapshotLightSection;
+
+typedef struct {
+    // NOTE(traks): including section memory
+    u32 size;
+    u32 padding;
+    i16 motionBlockingHeightMap[256];
+    SnapshotBlockSection blockSections[SECTIONS_PER_CHUNK];
+    SnapshotLightSection lightSections[LIGHT_SECTIONS_PER_CHUNK];
+} SnapshotChunk;
+
+typedef struct {
+    // NOTE(traks): NULL if the entry is empty
+    u8 * mapping;
+    i64 size;
+    i32 regionX;
+    i32 regionZ;
+} SnapshotRegion;
+
+typedef struct {
+    SnapshotRegion * entries;
+    // NOTE(traks): must be power of 2
+    i32 arraySize;
+    u32 sizeMask;
+    i32 useCount;
+} SnapshotRegionMap;
+
+// NOTE(traks): only written to during startup, so background threads can look
+// things up without locking
+static SnapshotRegionMap snapshotRegions;
+
+static SnapshotRegion * FindSnapshotRegionOrEmpty(i32 regionX, i32 regionZ) {
+    u32 startIndex = ((u32) regionX * 0x9e3779b1) ^ ((u32) regionZ * 0x85ebca6b);
+    for (i32 offset = 0; ; offset++) {
+        SnapshotRegion * entry = snapshotRegions.entries + ((startIndex + offset) & snapshotRegions.sizeMask);
+        if (entry->mapping == NULL || (entry->regionX == regionX && entry->regionZ == regionZ)) {
+            return entry;
+        }
+    }
+}
+
+static SnapshotRegion * FindSnapshotRegion(WorldChunkPos pos) {
+    // NOTE(traks): like region files, only the main world is supported
+    if (snapshotRegions.useCount == 0 || pos.worldId != 1) {
+        return NULL;
+    }
+    SnapshotRegion * res = FindSnapshotRegionOrEmpty(pos.x >> 5, pos.z >> 5);
+    return (res->mapping != NULL ? res : NULL);
+}
+
+i32 WorldHasSnapshot(WorldChunkPos pos) {
+    return FindSnapshotRegion(pos) != NULL;
+}
+
+static i32 SnapshotChunkIndex(WorldChunkPos pos) {
+    return ((pos.z & 0x1f) << 5) | (pos.x & 0x1f);
+}
+
+void WorldPrefetchSnapshotChunk(WorldChunkPos pos) {
+    SnapshotRegion * region = FindSnapshotRegion(pos);
+    if (region == NULL) {
+        return;
+    }
+    SnapshotHeader * header = (SnapshotHeader *) region->mapping;
+    i32 chunkIndex = SnapshotChunkIndex(pos);
+    i64 offset = (i64) header->chunkPages[chunkIndex] * SNAPSHOT_PAGE_SIZE;
+    i64 size = (i64) header->chunkPageCounts[chunkIndex] * SNAPSHOT_PAGE_SIZE;
+    if (offset == 0 || offset + size > region->size) {
+        return;
+    }
+    // NOTE(traks): only starts reading, doesn't wait for the disk
+    madvise(region->mapping + offset, size, MADV_WILLNEED);
+}
+
+static i32 SnapshotHeaderMatches(SnapshotHeader * header) {
+    return memcmp(header->magic, snapshotMagic, sizeof snapshotMagic) == 0
+            && header->byteOrderMark == 0x01020304
+            && header->version == SNAPSHOT_VERSION
+            && header->dataVersion == SERVER_WORLD_VERSION
+            && header->blockStateCount == (u32) serv->vanilla_block_state_count
+            && header->minSection == MIN_SECTION
+            && header->sectionsPerChunk == SECTIONS_PER_CHUNK;
+}
+
+typedef struct {
+    char fileName[64];
+    i32 regionX;
+    i32 regionZ;
+    i64 size;
+} SnapshotFileInfo;
+
+void InitWorldSnapshots(void) {
+    DIR * dir = opendir("world/snapshot");
+    if (dir == NULL) {
+        return;
+    }
 
-            if (skyLight.size == 2048) {
-                UnpackStoredLight(lightSection->skyLight, skyLight.listData);
+    SnapshotFileInfo * files = NULL;
+    i32 fileCount = 0;
+    i32 fileArraySize = 0;
+    i64 totalSize = 0;
+
+    struct dirent * dirEntry;
+    while ((dirEntry = readdir(dir)) != NULL) {
+        i32 regionX;
+        i32 regionZ;
+        char suffix;
+        if (sscanf(dirEntry->d_name, "r.%d.%d.bws%c", &regionX, &regionZ, &suffix) != 2) {
+            continue;
+        }
+        if (fileCount == fileArraySize) {
+            fileArraySize = MAX(2 * fileArraySize, 64);
+            files = realloc(files, fileArraySize * sizeof *files);
+        }
+        SnapshotFileInfo * file = files + fileCount;
+        snprintf(file->fileName, sizeof file->fileName, "world/snapshot/r.%d.%d.bws", regionX, regionZ);
+        struct stat fileStat;
+        if (stat(file->fileName, &fileStat) || fileStat.st_size < (i64) sizeof (SnapshotHeader)) {
+            continue;
+        }
+        file->regionX = regionX;
+        file->regionZ = regionZ;
+        file->size = fileStat.st_size;
+        totalSize += (file->size + SNAPSHOT_PAGE_SIZE - 1) & ~(i64) (SNAPSHOT_PAGE_SIZE - 1);
+        fileCount++;
+    }
+    closedir(dir);
+
+    if (fileCount == 0) {
+        free(files);
+        return;
+    }
+
+    // NOTE(traks): reserve the address space, then map the files over it
+    void * reserved = mmap(NULL, totalSize, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) {
+        LogErrno("Failed to reserve memory for world snapshots: %s");
+        free(files);
+        return;
+    }
+
+    snapshotRegions.arraySize = 64;
+    while (snapshotRegions.arraySize < 2 * fileCount) {
+        snapshotRegions.arraySize *= 2;
+    }
+    snapshotRegions.sizeMask = snapshotRegions.arraySize - 1;
+    snapshotRegions.entries = calloc(snapshotRegions.arraySize, sizeof *snapshotRegions.entries);
+
+    i64 mappedSize = 0;
+    for (i32 fileIndex = 0; fileIndex < fileCount; fileIndex++) {
+        SnapshotFileInfo * file = files + fileIndex;
+        u8 * target = (u8 *) reserved + mappedSize;
+        mappedSize += (file->size + SNAPSHOT_PAGE_SIZE - 1) & ~(i64) (SNAPSHOT_PAGE_SIZE - 1);
+
+        int fd = open(file->fileName, O_RDONLY);
+        if (fd == -1) {
+            LogErrno("Failed to open world snapshot: %s");
+            continue;
+        }
+        // NOTE(traks): the mapping keeps the file around
+        void * mapping = mmap(target, file->size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            LogErrno("Failed to map world snapshot: %s");
+            continue;
+        }
+
+        if (!SnapshotHeaderMatches(mapping)) {
+            LogInfo("World snapshot %s is outdated or from another machine, ignoring it", file->fileName);
+            mmap(target, file->size, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE | MAP_FIXED, -1, 0);
+            continue;
+        }
+
+        SnapshotRegion * entry = FindSnapshotRegionOrEmpty(file->regionX, file->regionZ);
+        *entry = (SnapshotRegion) {
+            .mapping = mapping,
+            .size = file->size,
+            .regionX = file->regionX,
+            .regionZ = file->regionZ,
+        };
+        snapshotRegions.useCount++;
+    }
+    free(files);
+
+    snapshotMemory = reserved;
+    snapshotMemorySize = totalSize;
+    LogInfo("Using world snapshots for %d regions (%.0fMB)", snapshotRegions.useCount, totalSize / 1000000.0);
+}
+
+static i32 SnapshotSectionFits(SnapshotChunk * record, u32 offset, i32 size) {
+    return offset >= sizeof *record && (offset & (SNAPSHOT_DATA_ALIGNMENT - 1)) == 0
+            && (i64) offset + size <= record->size;
+}
+
+static i32 SnapshotLightFits(SnapshotChunk * record, u32 light) {
+    return light < 16 || SnapshotSectionFits(record, light, SECTION_LIGHT_SIZE);
+}
+
+// NOTE(traks): checks the block states of a section whose data fits in the
+// record, so a damaged snapshot can't send us past the end of the block state
+// tables. Plain max loops, so the compiler can vectorise them
+static i32 SnapshotSectionStatesValid(SnapshotChunk * record, SnapshotBlockSection * stored) {
+    i32 blockStateCount = serv->vanilla_block_state_count;
+    u8 * data = (u8 *) record + stored->dataOffset;
+    switch (stored->bitsPerEntry) {
+    case 0:
+        return stored->singleState < blockStateCount;
+    case 4:
+    case 8: {
+        u16 * palette = (u16 *) (data + 4096 * stored->bitsPerEntry / 8);
+        for (i32 paletteIndex = 0; paletteIndex < stored->paletteSize; paletteIndex++) {
+            if (palette[paletteIndex] >= blockStateCount) {
+                return 0;
+            }
+        }
+        u8 maxIndex = 0;
+        if (stored->bitsPerEntry == 4) {
+            for (i32 i = 0; i < 2048; i++) {
+                maxIndex = MAX(maxIndex, MAX(data[i] & 0xf, data[i] >> 4));
             }
-            if (blockLight.size == 2048) {
-                UnpackStoredLight(lightSection->blockLight, blockLight.listData);
+        } else {
+            for (i32 i = 0; i < 4096; i++) {
+                maxIndex = MAX(maxIndex, data[i]);
             }
         }
+        return maxIndex < stored->paletteSize;
+    }
+    default: {
+        u16 * blockStates = (u16 *) data;
+        u16 maxState = 0;
+        for (i32 i = 0; i < 4096; i++) {
+            maxState = MAX(maxState, blockStates[i]);
+        }
+        return maxState < blockStateCount;
+    }
     }
+}
 
-    ChunkRecalculateMotionBlockingHeightMap(chunk);
+static u8 * GetSnapshotLight(SnapshotChunk * record, u32 light) {
+    if (light < 16) {
+        return GetUniformSectionLight(light);
+    }
+    return (u8 *) record + light;
+}
 
-    if (cursor.error) {
-        LogInfo("Failed to decipher NBT data");
-        // NbtPrint(&chunkNbt);
+// NOTE(traks): returns NULL if the snapshot doesn't have the chunk or the
+// chunk record doesn't fit in the snapshot
+static SnapshotChunk * FindSnapshotChunkRecord(WorldChunkPos pos) {
+    SnapshotRegion * region = FindSnapshotRegion(pos);
+    if (region == NULL) {
+        return NULL;
+    }
+
+    SnapshotHeader * header = (SnapshotHeader *) region->mapping;
+    u32 page = header->chunkPages[SnapshotChunkIndex(pos)];
+    if (page == 0) {
+        return NULL;
+    }
+
+    i64 offset = (i64) page * SNAPSHOT_PAGE_SIZE;
+    SnapshotChunk * record = (SnapshotChunk *) (region->mapping + offset);
+    if (offset + (i64) sizeof *record > region->size || offset + record->size > region->size) {
+        LogInfo("Chunk record outside of world snapshot");
+        return NULL;
+    }
+    return record;
+}
+
+i32 WorldCheckSnapshotChunk(WorldChunkPos pos) {
+    BeginTimings(CheckSnapshotChunk);
+
+    i32 res = 0;
+    SnapshotChunk * record = FindSnapshotChunkRecord(pos);
+    if (record == NULL) {
         goto bail;
     }
 
-    // TODO(traks): not used at the moment
-    if (lightIsStored && 0) {
-        // NOTE(traks): can't set flags async at the moment, not thread safe!
-        // chunk->statusFlags |= CHUNK_GOT_LIGHT;
+    for (i32 sectionIndex = 0; sectionIndex < SECTIONS_PER_CHUNK; sectionIndex++) {
+        SnapshotBlockSection * stored = record->blockSections + sectionIndex;
+        i32 bitsPerEntry = stored->bitsPerEntry;
+        i32 valid;
+        if (bitsPerEntry == 0) {
+            valid = 1;
+        } else if (bitsPerEntry == 4 || bitsPerEntry == 8 || bitsPerEntry == 16) {
+            i32 capacity = SectionPaletteCapacity(bitsPerEntry);
+            valid = SnapshotSectionFits(record, stored->dataOffset, SectionBlocksAllocSize(bitsPerEntry))
+                    && stored->paletteSize <= capacity && stored->paletteUsed <= stored->paletteSize;
+        } else {
+            valid = 0;
+        }
+        if (!valid || stored->nonAirCount > 4096 || !SnapshotSectionStatesValid(record, stored)) {
+            LogInfo("Invalid section in world snapshot");
+            goto bail;
+        }
+    }
+    for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
+        SnapshotLightSection * stored = record->lightSections + sectionIndex;
+        if (!SnapshotLightFits(record, stored->skyLight) || !SnapshotLightFits(record, stored->blockLight)) {
+            LogInfo("Invalid light in world snapshot");
+            goto bail;
+        }
     }
 
-    atomic_fetch_or_explicit(&chunk->atomicFlags, CHUNK_ATOMIC_LOAD_SUCCESS, memory_order_relaxed);
+    res = 1;
 
 bail:
-    EndTimings(ReadChunk);
+    EndTimings(CheckSnapshotChunk);
+    return res;
+}
+
+void WorldLoadSnapshotChunk(Chunk * chunk) {
+    BeginTimings(LoadSnapshotChunk);
+
+    SnapshotChunk * record = FindSnapshotChunkRecord(chunk->pos);
+    assert(record != NULL);
+
+    for (i32 sectionIndex = 0; sectionIndex < SECTIONS_PER_CHUNK; sectionIndex++) {
+        SnapshotBlockSection * stored = record->blockSections + sectionIndex;
+        ChunkSection * section = chunk->sections + sectionIndex;
+        SectionBlocks * blocks = &section->blocks;
+        *blocks = (SectionBlocks) {
+            .singleState = stored->singleState,
+            .paletteSize = stored->paletteSize,
+            .paletteUsed = stored->paletteUsed,
+            .bitsPerEntry = stored->bitsPerEntry,
+        };
+        if (stored->bitsPerEntry != 0) {
+            blocks->data = (u8 *) record + stored->dataOffset;
+            i32 capacity = SectionPaletteCapacity(stored->bitsPerEntry);
+            if (capacity > 0) {
+                blocks->palette = (u16 *) (blocks->data + 4096 * stored->bitsPerEntry / 8);
+                blocks->paletteCounts = blocks->palette + capacity;
+            }
+            // NOTE(traks): copied once someone changes a block
+            chunk->sharedBlockSections |= (u32) 1 << sectionIndex;
+        }
+        section->nonAirCount = stored->nonAirCount;
+    }
+    for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
+        SnapshotLightSection * stored = record->lightSections + sectionIndex;
+        LightSection * section = chunk->lightSections + sectionIndex;
+        section->skyLight = GetSnapshotLight(record, stored->skyLight);
+        section->blockLight = GetSnapshotLight(record, stored->blockLight);
+        if (stored->skyLight >= 16 || stored->blockLight >= 16) {
+            chunk->sharedLightSections |= (u32) 1 << sectionIndex;
+        }
+    }
+    memcpy(chunk->motion_blocking_height_map, record->motionBlockingHeightMap, sizeof chunk->motion_blocking_height_map);
+
+    EndTimings(LoadSnapshotChunk);
+}
+
+static i64 AppendSnapshotData(u8 * record, i64 size, void * data, i32 dataSize) {
+    size = (size + SNAPSHOT_DATA_ALIGNMENT - 1) & ~(i64) (SNAPSHOT_DATA_ALIGNMENT - 1);
+    memcpy(record + size, data, dataSize);
+    return size;
+}
+
+static i32 WriteToFile(FILE * file, void * data, i64 size) {
+    if (fwrite(data, 1, size, file) != (size_t) size) {
+        LogErrno("Failed to write world snapshot: %s");
+        return 0;
+    }
+    return 1;
+}
+
+i32 WorldWriteSnapshotRegion(i32 regionX, i32 regionZ, Chunk * * chunks) {
+    BeginTimings(WriteSnapshotRegion);
+
+    char fileName[64];
+    char tempFileName[64];
+    snprintf(fileName, sizeof fileName, "world/snapshot/r.%d.%d.bws", regionX, regionZ);
+    snprintf(tempFileName, sizeof tempFileName, "world/snapshot/r.%d.%d.bws.tmp", regionX, regionZ);
+
+    i32 res = 0;
+    SnapshotHeader * header = calloc(1, sizeof *header);
+    // NOTE(traks): enough for the largest possible chunk
+    i64 maxRecordSize = sizeof (SnapshotChunk)
+            + SECTIONS_PER_CHUNK * (SectionBlocksAllocSize(16) + SNAPSHOT_DATA_ALIGNMENT)
+            + 2 * LIGHT_SECTIONS_PER_CHUNK * (SECTION_LIGHT_SIZE + SNAPSHOT_DATA_ALIGNMENT)
+            + SNAPSHOT_PAGE_SIZE;
+    u8 * record = malloc(maxRecordSize);
+    FILE * file = fopen(tempFileName, "wb");
+    if (file == NULL) {
+        LogErrno("Failed to create world snapshot: %s");
+        goto bail;
+    }
+
+    // NOTE(traks): the header is written once we know where the chunks are
+    i64 headerPages = (sizeof *header + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+    i64 filePages = headerPages;
+    if (fseek(file, headerPages * SNAPSHOT_PAGE_SIZE, SEEK_SET)) {
+        LogErrno("Failed to seek in world snapshot: %s");
+        goto bail;
+    }
+
+    for (i32 chunkIndex = 0; chunkIndex < REGION_CHUNKS; chunkIndex++) {
+        Chunk * chunk = chunks[chunkIndex];
+        if (chunk == NULL) {
+            continue;
+        }
 
-    if (region_fd != -1) {
-        BeginTimings(CloseFile);
-        close(region_fd);
-        EndTimings(CloseFile);
+        memset(record, 0, maxRecordSize);
+        SnapshotChunk * stored = (SnapshotChunk *) record;
+        i64 size = sizeof *stored;
+        memcpy(stored->motionBlockingHeightMap, chunk->motion_blocking_height_map, sizeof stored->motionBlockingHeightMap);
+
+        for (i32 sectionIndex = 0; sectionIndex < SECTIONS_PER_CHUNK; sectionIndex++) {
+            ChunkSection * section = chunk->sections + sectionIndex;
+            SectionBlocks * blocks = &section->blocks;
+            SnapshotBlockSection * storedSection = stored->blockSections + sectionIndex;
+            *storedSection = (SnapshotBlockSection) {
+                .singleState = blocks->singleState,
+                .paletteSize = blocks->paletteSize,
+                .paletteUsed = blocks->paletteUsed,
+                .nonAirCount = section->nonAirCount,
+                .bitsPerEntry = blocks->bitsPerEntry,
+            };
+            if (!SectionIsNull(blocks)) {
+                i32 dataSize = SectionBlocksAllocSize(blocks->bitsPerEntry);
+                storedSection->dataOffset = AppendSnapshotData(record, size, blocks->data, dataSize);
+                size = storedSection->dataOffset + dataSize;
+            }
+        }
+
+        for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
+            LightSection * section = chunk->lightSections + sectionIndex;
+            SnapshotLightSection * storedSection = stored->lightSections + sectionIndex;
+            u8 * lights[] = {section->skyLight, section->blockLight};
+            u32 * storedLights[] = {&storedSection->skyLight, &storedSection->blockLight};
+            for (i32 lightType = 0; lightType < 2; lightType++) {
+                u8 * light = lights[lightType];
+                if (IsSharedSectionLight(light)) {
+                    *storedLights[lightType] = GetSectionLight(light, 0);
+                } else {
+                    *storedLights[lightType] = AppendSnapshotData(record, size, light, SECTION_LIGHT_SIZE);
+                    size = *storedLights[lightType] + SECTION_LIGHT_SIZE;
+                }
+            }
+        }
+
+        stored->size = size;
+        i64 recordPages = (size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+        header->chunkPages[chunkIndex] = filePages;
+        header->chunkPageCounts[chunkIndex] = recordPages;
+        if (!WriteToFile(file, record, recordPages * SNAPSHOT_PAGE_SIZE)) {
+            goto bail;
+        }
+        filePages += recordPages;
+    }
+
+    memcpy(header->magic, snapshotMagic, sizeof snapshotMagic);
+    header->byteOrderMark = 0x01020304;
+    header->version = SNAPSHOT_VERSION;
+    header->dataVersion = SERVER_WORLD_VERSION;
+    header->blockStateCount = serv->vanilla_block_state_count;
+    header->minSection = MIN_SECTION;
+    header->sectionsPerChunk = SECTIONS_PER_CHUNK;
+    if (fseek(file, 0, SEEK_SET)) {
+        LogErrno("Failed to seek in world snapshot: %s");
+        goto bail;
+    }
+    if (!WriteToFile(file, header, sizeof *header)) {
+        goto bail;
+    }
+    if (fclose(file)) {
+        file = NULL;
+        LogErrno("Failed to write world snapshot: %s");
+        goto bail;
+    }
+    file = NULL;
+    if (rename(tempFileName, fileName)) {
+        LogErrno("Failed to move world snapshot into place: %s");
+        goto bail;
+    }
+    res = 1;
+
+bail:
+    if (file != NULL) {
+        fclose(file);
+    }
+    if (!res) {
+        unlink(tempFileName);
     }
+    free(record);
+    free(header);
+    EndTimings(WriteSnapshotRegion);
+    return res;
 }
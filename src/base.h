@@ -104,6 +104,19 @@ typedef struct {
     };
 } WorldChunkPos;
 
+// NOTE(traks): rectangle of chunks, min and max inclusive
+typedef struct {
+    i32 worldId;
+    i32 minX;
+    i32 minZ;
+    i32 maxX;
+    i32 maxZ;
+} ChunkRegion;
+
+// NOTE(traks): handle to a region of interest in the chunk system. 0 means no
+// region was registered
+typedef u32 ChunkInterestId;
+
 typedef struct {
     u8 * data;
     i32 size;
@@ -128,6 +141,10 @@ typedef struct {
     u8 * data;
     i32 size;
     i32 index;
+    // NOTE(traks): highest index seen when memory was given back with a
+    // temporary arena or ShrinkArenaAllocation. The highest index the arena
+    // ever had is the max of this and the current index
+    i32 peakIndex;
 } MemoryArena;
 
 typedef struct {
@@ -179,6 +196,17 @@ static void * CallocInArena(MemoryArena * arena, i32 size) {
     return res;
 }
 
+// NOTE(traks): Gives back everything past the first size bytes of the given
+// allocation. Only use this for the most recent allocation! Useful if you don't
+// know how much memory you need in advance
+static void ShrinkArenaAllocation(MemoryArena * arena, void * data, i32 size) {
+    i32 align = alignof (max_align_t);
+    i32 actual_size = (size + align - 1) / align * align;
+    arena->index = ((u8 *) data - arena->data) + actual_size;
+    // NOTE(traks): the memory past the new end wasn't necessarily used
+    arena->peakIndex = MAX(arena->peakIndex, arena->index);
+}
+
 static MemoryArena SubArena(MemoryArena * arena, i32 size) {
     MemoryArena res = {0};
     res.data = MallocInArena(arena, size);
@@ -194,6 +222,7 @@ static TempMemoryArena BeginTempArena(MemoryArena * arena) {
 }
 
 static void EndTempArena(TempMemoryArena * temp) {
+    temp->arena->peakIndex = MAX(temp->arena->peakIndex, temp->arena->index);
     temp->arena->index = temp->startIndex;
 }
 
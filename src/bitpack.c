@@ -0,0 +1,267 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include <assert.h>
+#include "bitpack.h"
+#include "buffer.h"
+
+// NOTE(traks): Scalar fallbacks. Called with a constant number of bits where
+// it matters, so the compiler can unroll the loop over the values of a long
+// and turn the shifts into constants. Start at the given long, so the vector
+// versions can use these to finish up.
+
+static inline i32 UnpackLongs(u8 * packed, i32 bits, u16 * palette, u32 paletteSize, u16 * blockStates, i32 longIndex) {
+    i32 valuesPerLong = 64 / bits;
+    i32 fullLongs = 4096 / valuesPerLong;
+    u32 mask = ((u32) 1 << bits) - 1;
+    u32 outOfBounds = 0;
+
+    for (; longIndex < fullLongs; longIndex++) {
+        u64 entry = ReadDirectU64(packed + 8 * longIndex);
+        u16 * out = blockStates + longIndex * valuesPerLong;
+        for (i32 valueIndex = 0; valueIndex < valuesPerLong; valueIndex++) {
+            u32 paletteIndex = (entry >> (valueIndex * bits)) & mask;
+            outOfBounds |= (paletteIndex >= paletteSize);
+            out[valueIndex] = palette[paletteIndex < paletteSize ? paletteIndex : 0];
+        }
+    }
+
+    // NOTE(traks): last long may be partially filled
+    i32 posIndex = fullLongs * valuesPerLong;
+    if (longIndex == fullLongs && posIndex < 4096) {
+        u64 entry = ReadDirectU64(packed + 8 * longIndex);
+        for (; posIndex < 4096; posIndex++) {
+            u32 paletteIndex = entry & mask;
+            entry >>= bits;
+            outOfBounds |= (paletteIndex >= paletteSize);
+            blockStates[posIndex] = palette[paletteIndex < paletteSize ? paletteIndex : 0];
+        }
+    }
+    return !outOfBounds;
+}
+
+static inline void PackLongs(u16 * blockStates, i32 bits, u8 * packed, i32 longIndex) {
+    i32 valuesPerLong = 64 / bits;
+    i32 longs = PackedSectionLongs(bits);
+
+    for (; longIndex < longs; longIndex++) {
+        i32 posIndex = longIndex * valuesPerLong;
+        i32 valueCount = MIN(valuesPerLong, 4096 - posIndex);
+        u64 entry = 0;
+        if (valueCount == valuesPerLong) {
+            for (i32 valueIndex = 0; valueIndex < valuesPerLong; valueIndex++) {
+                entry |= (u64) blockStates[posIndex + valueIndex] << (valueIndex * bits);
+            }
+        } else {
+            for (i32 valueIndex = 0; valueIndex < valueCount; valueIndex++) {
+                entry |= (u64) blockStates[posIndex + valueIndex] << (valueIndex * bits);
+            }
+        }
+        WriteDirectU64(packed + 8 * longIndex, entry);
+    }
+}
+
+#ifdef __SSSE3__
+// NOTE(traks): 4 bits per block is by far the most common case. Palettes are
+// at most 16 entries then, so we can look up block states with byte shuffles
+// on the low and high bytes of the palette. Does 2 longs at a time
+static i32 UnpackNibblesSsse3(u8 * packed, u16 * palette, u32 paletteSize, u16 * blockStates) {
+    u8 paletteLow[16] = {0};
+    u8 paletteHigh[16] = {0};
+    u32 usedSize = MIN(paletteSize, 16);
+    for (u32 paletteIndex = 0; paletteIndex < usedSize; paletteIndex++) {
+        paletteLow[paletteIndex] = palette[paletteIndex];
+        paletteHigh[paletteIndex] = palette[paletteIndex] >> 8;
+    }
+    __m128i lowTable = _mm_loadu_si128((__m128i *) paletteLow);
+    __m128i highTable = _mm_loadu_si128((__m128i *) paletteHigh);
+    __m128i byteSwap = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    __m128i nibbleMask = _mm_set1_epi8(0xf);
+    __m128i maxIndex = _mm_setzero_si128();
+
+    for (i32 longIndex = 0; longIndex < 256; longIndex += 2) {
+        // NOTE(traks): byte i now holds values 2i and 2i + 1 in its low and
+        // high nibble
+        __m128i bytes = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *) (packed + 8 * longIndex)), byteSwap);
+        __m128i low = _mm_and_si128(bytes, nibbleMask);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibbleMask);
+        __m128i indices[2] = {
+            _mm_unpacklo_epi8(low, high),
+            _mm_unpackhi_epi8(low, high),
+        };
+        u16 * out = blockStates + 16 * longIndex;
+
+        for (i32 i = 0; i < 2; i++) {
+            maxIndex = _mm_max_epu8(maxIndex, indices[i]);
+            __m128i statesLow = _mm_shuffle_epi8(lowTable, indices[i]);
+            __m128i statesHigh = _mm_shuffle_epi8(highTable, indices[i]);
+            _mm_storeu_si128((__m128i *) (out + 16 * i), _mm_unpacklo_epi8(statesLow, statesHigh));
+            _mm_storeu_si128((__m128i *) (out + 16 * i + 8), _mm_unpackhi_epi8(statesLow, statesHigh));
+        }
+    }
+
+    __m128i limit = _mm_set1_epi8(usedSize - 1);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(maxIndex, limit), limit)) == 0xffff;
+}
+#endif
+
+#ifdef __AVX2__
+// NOTE(traks): Does 2 longs at a time, one in each 128-bit lane, and 4 values
+// of each long per step. A byte shuffle moves the bytes holding a value into
+// its own 32-bit element, which is then shifted and masked. Block states are
+// gathered from the palette.
+static i32 UnpackLongsAvx2(u8 * packed, i32 bits, u16 * palette, u32 paletteSize, u16 * blockStates) {
+    i32 valuesPerLong = 64 / bits;
+    i32 steps = (valuesPerLong + 3) / 4;
+    __m256i shuffles[4];
+    __m256i shifts[4];
+
+    for (i32 step = 0; step < steps; step++) {
+        u8 shuffle[32];
+        u32 shift[8];
+        for (i32 element = 0; element < 8; element++) {
+            i32 valueIndex = 4 * step + (element & 0x3);
+            i32 bitIndex = valueIndex * bits;
+            // NOTE(traks): the second lane works on the second long
+            i32 longStart = (element < 4 ? 0 : 8);
+            shift[element] = bitIndex & 0x7;
+            for (i32 i = 0; i < 4; i++) {
+                i32 byteIndex = bitIndex / 8 + i;
+                // NOTE(traks): Set the high bit to zero the byte. Zero the
+                // entire element for values past the end of the long, so they
+                // never cause out of bounds errors.
+                if (valueIndex >= valuesPerLong || byteIndex >= 8) {
+                    shuffle[4 * element + i] = 0x80;
+                } else {
+                    // NOTE(traks): longs are big-endian
+                    shuffle[4 * element + i] = longStart + 7 - byteIndex;
+                }
+            }
+        }
+        shuffles[step] = _mm256_loadu_si256((__m256i *) shuffle);
+        shifts[step] = _mm256_loadu_si256((__m256i *) shift);
+    }
+
+    __m256i mask = _mm256_set1_epi32(((u32) 1 << bits) - 1);
+    __m256i stateMask = _mm256_set1_epi32(0xffff);
+    __m256i maxIndex = _mm256_set1_epi32(paletteSize - 1);
+    __m256i outOfBounds = _mm256_setzero_si256();
+    i32 longIndex = 0;
+
+    // NOTE(traks): The last step for a long may write a couple of values past
+    // the long's values, into the values of the next long. Go through the
+    // steps in reverse order, so those get overwritten afterwards. Leave the
+    // last few longs to the scalar version, so we don't write past the end of
+    // the output.
+    for (; (longIndex + 1) * valuesPerLong + 4 * steps <= 4096; longIndex += 2) {
+        __m256i longs = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *) (packed + 8 * longIndex)));
+        u16 * out = blockStates + longIndex * valuesPerLong;
+
+        for (i32 step = steps - 1; step >= 0; step--) {
+            __m256i indices = _mm256_shuffle_epi8(longs, shuffles[step]);
+            indices = _mm256_and_si256(_mm256_srlv_epi32(indices, shifts[step]), mask);
+            outOfBounds = _mm256_or_si256(outOfBounds, _mm256_cmpgt_epi32(indices, maxIndex));
+            // NOTE(traks): never read past the end of the palette
+            indices = _mm256_min_epu32(indices, maxIndex);
+
+            // NOTE(traks): reads 2 bytes past the block state we want
+            __m256i states = _mm256_i32gather_epi32((int *) palette, indices, 2);
+            states = _mm256_and_si256(states, stateMask);
+            states = _mm256_packus_epi32(states, states);
+            _mm_storel_epi64((__m128i *) (out + 4 * step), _mm256_castsi256_si128(states));
+            _mm_storel_epi64((__m128i *) (out + valuesPerLong + 4 * step), _mm256_extracti128_si256(states, 1));
+        }
+    }
+
+    if (!_mm256_testz_si256(outOfBounds, outOfBounds)) {
+        return 0;
+    }
+    return UnpackLongs(packed, bits, palette, paletteSize, blockStates, longIndex);
+}
+
+// NOTE(traks): For 13 to 16 bits, 4 values fit in a long, the same as in a
+// 64-bit lane of 16-bit values. Just need to shift the values together
+static void PackFourPerLongAvx2(u16 * blockStates, i32 bits, u8 * packed) {
+    __m256i byteSwap = _mm256_setr_epi8(
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+            7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    __m128i gap = _mm_cvtsi32_si128(16 - bits);
+    __m128i gap2 = _mm_cvtsi32_si128(2 * (16 - bits));
+    __m128i gap3 = _mm_cvtsi32_si128(3 * (16 - bits));
+    __m256i mask0 = _mm256_set1_epi64x(0xffff);
+    __m256i mask1 = _mm256_set1_epi64x(0xffff0000);
+    __m256i mask2 = _mm256_set1_epi64x(0xffff00000000);
+    __m256i mask3 = _mm256_set1_epi64x(0xffff000000000000);
+
+    for (i32 posIndex = 0; posIndex < 4096; posIndex += 16) {
+        __m256i values = _mm256_loadu_si256((__m256i *) (blockStates + posIndex));
+        __m256i longs = _mm256_and_si256(values, mask0);
+        longs = _mm256_or_si256(longs, _mm256_srl_epi64(_mm256_and_si256(values, mask1), gap));
+        longs = _mm256_or_si256(longs, _mm256_srl_epi64(_mm256_and_si256(values, mask2), gap2));
+        longs = _mm256_or_si256(longs, _mm256_srl_epi64(_mm256_and_si256(values, mask3), gap3));
+        _mm256_storeu_si256((__m256i *) (packed + 2 * posIndex), _mm256_shuffle_epi8(longs, byteSwap));
+    }
+}
+#endif
+
+i32 CountNonAirBlockStates(u16 * blockStates) {
+    // TODO(traks): handle cave air and void air
+    i32 res = 0;
+    for (i32 posIndex = 0; posIndex < 4096; posIndex++) {
+        res += (blockStates[posIndex] != 0);
+    }
+    return res;
+}
+
+i32 UnpackBlockStates(u8 * packed, i32 bits, u16 * palette, u32 paletteSize, u16 * blockStates) {
+    assert(4 <= bits && bits <= 16);
+    if (paletteSize == 0) {
+        return -1;
+    }
+
+    i32 success;
+#ifdef __SSSE3__
+    if (bits == 4) {
+        success = UnpackNibblesSsse3(packed, palette, paletteSize, blockStates);
+    } else
+#endif
+    {
+#ifdef __AVX2__
+        success = UnpackLongsAvx2(packed, bits, palette, paletteSize, blockStates);
+#else
+        switch (bits) {
+        case 4: success = UnpackLongs(packed, 4, palette, paletteSize, blockStates, 0); break;
+        case 5: success = UnpackLongs(packed, 5, palette, paletteSize, blockStates, 0); break;
+        case 6: success = UnpackLongs(packed, 6, palette, paletteSize, blockStates, 0); break;
+        case 7: success = UnpackLongs(packed, 7, palette, paletteSize, blockStates, 0); break;
+        case 8: success = UnpackLongs(packed, 8, palette, paletteSize, blockStates, 0); break;
+        case 9: success = UnpackLongs(packed, 9, palette, paletteSize, blockStates, 0); break;
+        case 10: success = UnpackLongs(packed, 10, palette, paletteSize, blockStates, 0); break;
+        case 11: success = UnpackLongs(packed, 11, palette, paletteSize, blockStates, 0); break;
+        case 12: success = UnpackLongs(packed, 12, palette, paletteSize, blockStates, 0); break;
+        default: success = UnpackLongs(packed, bits, palette, paletteSize, blockStates, 0); break;
+        }
+#endif
+    }
+
+    if (!success) {
+        return -1;
+    }
+    return CountNonAirBlockStates(blockStates);
+}
+
+void PackBlockStates(u16 * blockStates, i32 bits, u8 * packed) {
+    assert(4 <= bits && bits <= 16);
+#ifdef __AVX2__
+    if (bits >= 13) {
+        PackFourPerLongAvx2(blockStates, bits, packed);
+        return;
+    }
+#endif
+    switch (bits) {
+    case 4: PackLongs(blockStates, 4, packed, 0); break;
+    case 8: PackLongs(blockStates, 8, packed, 0); break;
+    case 15: PackLongs(blockStates, 15, packed, 0); break;
+    default: PackLongs(blockStates, bits, packed, 0); break;
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef BITPACK_H
+#define BITPACK_H
+
+#include "base.h"
+
+// NOTE(traks): Packed value arrays as used by chunk storage and the protocol:
+// big-endian longs that each hold 64 / bits values, starting from the least
+// significant bits. Values never straddle two longs. These all work on the
+// 4096 values of a chunk section.
+
+static inline i32 PackedSectionLongs(i32 bits) {
+    i32 valuesPerLong = 64 / bits;
+    return (4096 + valuesPerLong - 1) / valuesPerLong;
+}
+
+// NOTE(traks): Unpacks palette indices of 4 to 16 bits each and maps them
+// through the palette. Returns the number of non-air block states, or -1 if
+// some palette index is out of bounds. The palette may be read up to 1 entry
+// past its end.
+i32 UnpackBlockStates(u8 * packed, i32 bits, u16 * palette, u32 paletteSize, u16 * blockStates);
+
+// NOTE(traks): The reverse of the above without a palette. Values must fit in
+// the number of bits
+void PackBlockStates(u16 * blockStates, i32 bits, u8 * packed);
+
+i32 CountNonAirBlockStates(u16 * blockStates);
+
+#endif
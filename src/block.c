@@ -67,25 +67,6 @@ push_direct_neighbour_block_updates(WorldBlockPos pos,
     }
 }
 
-static void
-schedule_block_update(WorldBlockPos pos, int from_direction, int delay) {
-    assert(delay > 0);
-    int count = serv->scheduled_block_update_count;
-    if (count == ARRAY_SIZE(serv->scheduled_block_updates)) {
-        // @TODO(traks) do something better once we revamp the scheduled block
-        // update data structure
-        assert(0);
-    }
-
-    scheduled_block_update new = {
-        .pos = pos,
-        .from_direction = from_direction,
-        .for_tick = serv->current_tick + delay
-    };
-    serv->scheduled_block_updates[count] = new;
-    serv->scheduled_block_update_count++;
-}
-
 block_state_info DescribeStateIndex(block_properties * props, i32 stateIndex) {
     block_state_info res = {0};
     memset(res.values, (u8) -1, BLOCK_PROPERTY_COUNT);
@@ -2057,7 +2038,7 @@ static i32 DoUpdateBehaviour(WorldBlockPos pos, int from_direction, int is_delay
             push_direct_neighbour_block_updates(pos, buc);
             return 1;
         } else {
-            schedule_block_update(pos, from_direction, 1);
+            ScheduleBlockUpdate(pos, from_direction, 1);
             return 0;
         }
     }
@@ -2260,7 +2241,7 @@ static i32 DoUpdateBehaviour(WorldBlockPos pos, int from_direction, int is_delay
                     push_direct_neighbour_block_updates(pos, buc);
                     return 1;
                 } else {
-                    schedule_block_update(pos, from_direction, 1);
+                    ScheduleBlockUpdate(pos, from_direction, 1);
                 }
             }
         } else if (from_direction == DIRECTION_POS_Y) {
@@ -2363,7 +2344,7 @@ static i32 DoUpdateBehaviour(WorldBlockPos pos, int from_direction, int is_delay
                     push_direct_neighbour_block_updates(pos, buc);
                     return 1;
                 } else {
-                    schedule_block_update(pos, from_direction, 1);
+                    ScheduleBlockUpdate(pos, from_direction, 1);
                     return 0;
                 }
             }
@@ -2442,25 +2423,12 @@ propagate_delayed_block_updates(MemoryArena * scratch_arena) {
         .max_updates = max_updates
     };
 
-    int sbu_count = serv->scheduled_block_update_count;
-    for (int i = 0; i < sbu_count; i++) {
-        scheduled_block_update sbu = serv->scheduled_block_updates[i];
-        if (sbu.for_tick != serv->current_tick) {
-            continue;
-        }
-
-        // move last to current position
-        sbu_count--;
-        serv->scheduled_block_updates[i] = serv->scheduled_block_updates[sbu_count];
-        i--;
-
+    ScheduledBlockUpdate sbu;
+    while (PopDueBlockUpdate(&sbu)) {
         // @TODO(traks) also count these for number of updates
-        WorldBlockPos pos = sbu.pos;
-        update_block(pos, sbu.from_direction, 1, &buc);
+        update_block(sbu.pos, sbu.fromDirection, 1, &buc);
     }
 
-    serv->scheduled_block_update_count = sbu_count;
-
     for (int i = 0; i < buc.update_count; i++) {
         WorldBlockPos pos = buc.blocks_to_update[i].pos;
         int from_direction = buc.blocks_to_update[i].from_direction;
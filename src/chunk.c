@@ -4,55 +4,561 @@
 #include "shared.h"
 #include "nbt.h"
 #include "chunk.h"
+#include "slab.h"
+
+// NOTE(traks): Chunks with block changes this tick, grouped into buckets of
+// 8x8 chunks, so players only need to look at the changed chunks near them.
+// Buckets are stamped with a generation, so clearing everything is just a
+// matter of bumping the generation.
+#define CHANGED_CHUNK_BUCKET_SHIFT (3)
+#define MAX_CHANGED_CHUNKS (1 << 16)
+// NOTE(traks): must be power of 2
+#define CHANGED_CHUNK_BUCKET_COUNT (2 * MAX_CHANGED_CHUNKS)
+
+typedef struct {
+    PackedWorldChunkPos packedPos;
+    // NOTE(traks): next changed chunk in the same bucket, or -1
+    i32 next;
+} ChangedChunkEntry;
 
-// TODO(traks): may need to add some sort of spacial indexing to this, so we
-// don't need to look through all changed chunks to find those in a small region
 typedef struct {
-    PackedWorldChunkPos * entries;
+    PackedWorldChunkPos bucketPos;
+    u32 generation;
+    i32 firstEntry;
+} ChangedChunkBucket;
+
+typedef struct {
+    ChangedChunkEntry * entries;
     u32 arraySize;
+    ChangedChunkBucket * buckets;
+    u32 generation;
 } ChangedChunkList;
 
 static ChangedChunkList changedChunks;
 
+static inline PackedWorldChunkPos GetChangedChunkBucketPos(WorldChunkPos pos) {
+    WorldChunkPos bucketPos = {
+        .worldId = pos.worldId,
+        .x = pos.x >> CHANGED_CHUNK_BUCKET_SHIFT,
+        .z = pos.z >> CHANGED_CHUNK_BUCKET_SHIFT,
+    };
+    return PackWorldChunkPos(bucketPos);
+}
+
+// NOTE(traks): returns the bucket or the empty slot where it should go
+static ChangedChunkBucket * FindChangedChunkBucket(PackedWorldChunkPos bucketPos) {
+    u32 mask = CHANGED_CHUNK_BUCKET_COUNT - 1;
+    u32 index = (bucketPos.packed * 0x9e3779b97f4a7c15ULL) >> 32;
+    for (;;) {
+        ChangedChunkBucket * bucket = changedChunks.buckets + (index & mask);
+        if (bucket->generation != changedChunks.generation || bucket->bucketPos.packed == bucketPos.packed) {
+            return bucket;
+        }
+        index++;
+    }
+}
+
 static inline void ChunkMarkChanged(Chunk * chunk) {
     if (chunk->lastBlockChangeTick != serv->current_tick) {
         chunk->lastBlockChangeTick = serv->current_tick;
         chunk->changedBlockSections = 0;
+        chunk->changedFully = 0;
+
+        if (changedChunks.arraySize >= MAX_CHANGED_CHUNKS) {
+            // TODO(traks): players won't get these block changes. Should we
+            // resend the chunks to players instead?
+            assert(0);
+            return;
+        }
+
+        PackedWorldChunkPos bucketPos = GetChangedChunkBucketPos(chunk->pos);
+        ChangedChunkBucket * bucket = FindChangedChunkBucket(bucketPos);
+        if (bucket->generation != changedChunks.generation) {
+            *bucket = (ChangedChunkBucket) {
+                .bucketPos = bucketPos,
+                .generation = changedChunks.generation,
+                .firstEntry = -1,
+            };
+        }
 
-        changedChunks.entries[changedChunks.arraySize] = PackWorldChunkPos(chunk->pos);
+        changedChunks.entries[changedChunks.arraySize] = (ChangedChunkEntry) {
+            .packedPos = PackWorldChunkPos(chunk->pos),
+            .next = bucket->firstEntry,
+        };
+        bucket->firstEntry = changedChunks.arraySize;
         changedChunks.arraySize++;
     }
 }
 
+void ChunkMarkChangedFully(Chunk * chunk) {
+    ChunkMarkChanged(chunk);
+    chunk->changedFully = 1;
+}
+
 static void ClearChangedChunks() {
     changedChunks.arraySize = 0;
+    changedChunks.generation++;
 }
 
 i32 CollectChangedChunks(WorldChunkPos from, WorldChunkPos to, Chunk * * chunkArray) {
-    i32 jumpZ = to.x - from.x + 1;
     i32 count = 0;
-    for (u32 i = 0; i < changedChunks.arraySize; i++) {
-        PackedWorldChunkPos packedPos = changedChunks.entries[i];
-        WorldChunkPos pos = UnpackWorldChunkPos(packedPos);
-
-        if (pos.worldId == from.worldId && from.x <= pos.x && pos.x <= to.x && from.z <= pos.z && pos.z <= to.z) {
-            Chunk * chunk = GetChunkIfLoaded(pos);
-            if (chunk != NULL) {
-                chunkArray[count] = chunk;
-                count++;
+    if (changedChunks.arraySize == 0) {
+        return count;
+    }
+
+    for (i32 bucketZ = from.z >> CHANGED_CHUNK_BUCKET_SHIFT; bucketZ <= to.z >> CHANGED_CHUNK_BUCKET_SHIFT; bucketZ++) {
+        for (i32 bucketX = from.x >> CHANGED_CHUNK_BUCKET_SHIFT; bucketX <= to.x >> CHANGED_CHUNK_BUCKET_SHIFT; bucketX++) {
+            WorldChunkPos bucketPos = {.worldId = from.worldId, .x = bucketX, .z = bucketZ};
+            ChangedChunkBucket * bucket = FindChangedChunkBucket(PackWorldChunkPos(bucketPos));
+            if (bucket->generation != changedChunks.generation) {
+                continue;
+            }
+
+            for (i32 entryIndex = bucket->firstEntry; entryIndex != -1; entryIndex = changedChunks.entries[entryIndex].next) {
+                WorldChunkPos pos = UnpackWorldChunkPos(changedChunks.entries[entryIndex].packedPos);
+                if (from.x <= pos.x && pos.x <= to.x && from.z <= pos.z && pos.z <= to.z) {
+                    Chunk * chunk = GetChunkIfLoaded(pos);
+                    if (chunk != NULL) {
+                        chunkArray[count] = chunk;
+                        count++;
+                    }
+                }
             }
         }
     }
     return count;
 }
 
+// NOTE(traks): Scheduled block updates are kept in a hierarchical timing wheel.
+// Level 0 has a slot per tick, level 1 a slot per 64 ticks, etc. When the
+// wheel reaches the start of a slot of a higher level, the updates in that slot
+// are moved down to lower levels. That way each tick only needs to look at the
+// updates that are due, no matter how many updates are pending.
+//
+// Updates also belong to the chunk they're in, so they can be dropped when the
+// chunk gets unloaded. Updates that become due while their chunk isn't ready
+// are parked in the chunk until it's ready again. Warm chunks stay ready, so
+// their updates keep running. A warm chunk that gets wanted again isn't ready
+// until its neighbours have been checked again.
+//
+// TODO(traks): save scheduled updates along with the chunk. Also remove
+// scheduled updates when the block changes? Not sure if it really matters if a
+// block gets updated 'unexpectedly'.
+#define WHEEL_LEVELS (4)
+#define WHEEL_SLOT_SHIFT (6)
+#define WHEEL_SLOTS_PER_LEVEL (1 << WHEEL_SLOT_SHIFT)
+#define WHEEL_SLOT_MASK (WHEEL_SLOTS_PER_LEVEL - 1)
+// NOTE(traks): list of updates due this tick
+#define WHEEL_DUE_SLOT (WHEEL_LEVELS * WHEEL_SLOTS_PER_LEVEL)
+#define WHEEL_PARKED_SLOT (-1)
+
+typedef struct {
+    WorldBlockPos pos;
+    i64 forTick;
+    Chunk * chunk;
+    // NOTE(traks): doubly linked list of the wheel slot, and doubly linked
+    // list of the chunk. Index 0 means none. The next index is also used for
+    // the list of free entries
+    i32 prev;
+    i32 next;
+    i32 chunkPrev;
+    i32 chunkNext;
+    i16 slot;
+    u8 fromDirection;
+} ScheduledUpdateEntry;
+
+typedef struct {
+    // NOTE(traks): entry 0 is never used
+    ScheduledUpdateEntry * entries;
+    i32 arraySize;
+    i32 useCount;
+    i32 freeEntry;
+    i32 slots[WHEEL_DUE_SLOT + 1];
+    // NOTE(traks): the tick the wheel will process next
+    i64 nextTick;
+} ScheduledUpdateWheel;
+
+static ScheduledUpdateWheel updateWheel;
+
+static void UnlinkFromWheelSlot(i32 entryIndex) {
+    ScheduledUpdateEntry * entry = updateWheel.entries + entryIndex;
+    if (entry->slot == WHEEL_PARKED_SLOT) {
+        return;
+    }
+    if (entry->prev != 0) {
+        updateWheel.entries[entry->prev].next = entry->next;
+    } else {
+        updateWheel.slots[entry->slot] = entry->next;
+    }
+    if (entry->next != 0) {
+        updateWheel.entries[entry->next].prev = entry->prev;
+    }
+    entry->slot = WHEEL_PARKED_SLOT;
+}
+
+static void LinkToWheelSlot(i32 entryIndex, i32 slot) {
+    ScheduledUpdateEntry * entry = updateWheel.entries + entryIndex;
+    entry->slot = slot;
+    entry->prev = 0;
+    entry->next = updateWheel.slots[slot];
+    if (entry->next != 0) {
+        updateWheel.entries[entry->next].prev = entryIndex;
+    }
+    updateWheel.slots[slot] = entryIndex;
+}
+
+static void InsertIntoWheel(i32 entryIndex) {
+    ScheduledUpdateEntry * entry = updateWheel.entries + entryIndex;
+    i64 forTick = MAX(entry->forTick, updateWheel.nextTick);
+    i64 delta = forTick - updateWheel.nextTick;
+    i32 level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= ((i64) 1 << (WHEEL_SLOT_SHIFT * (level + 1)))) {
+        level++;
+    }
+    if (delta >= ((i64) 1 << (WHEEL_SLOT_SHIFT * WHEEL_LEVELS))) {
+        // NOTE(traks): too far in the future, put it in the last slot for now
+        // and insert it again once we get there
+        forTick = updateWheel.nextTick + ((i64) 1 << (WHEEL_SLOT_SHIFT * WHEEL_LEVELS)) - 1;
+    }
+    i32 slot = level * WHEEL_SLOTS_PER_LEVEL + ((forTick >> (WHEEL_SLOT_SHIFT * level)) & WHEEL_SLOT_MASK);
+    LinkToWheelSlot(entryIndex, slot);
+}
+
+static void FreeScheduledUpdate(i32 entryIndex) {
+    ScheduledUpdateEntry * entry = updateWheel.entries + entryIndex;
+    UnlinkFromWheelSlot(entryIndex);
+
+    Chunk * chunk = entry->chunk;
+    if (entry->chunkPrev != 0) {
+        updateWheel.entries[entry->chunkPrev].chunkNext = entry->chunkNext;
+    } else {
+        chunk->scheduledUpdates = entry->chunkNext;
+    }
+    if (entry->chunkNext != 0) {
+        updateWheel.entries[entry->chunkNext].chunkPrev = entry->chunkPrev;
+    }
+
+    entry->next = updateWheel.freeEntry;
+    updateWheel.freeEntry = entryIndex;
+    updateWheel.useCount--;
+}
+
+void ScheduleBlockUpdate(WorldBlockPos pos, i32 fromDirection, i32 delay) {
+    assert(delay > 0);
+    Chunk * chunk = GetChunkInternal(WorldBlockPosChunk(pos));
+    if (chunk == NULL) {
+        // NOTE(traks): chunk isn't loaded, updates in it would be dropped
+        // anyway
+        return;
+    }
+
+    if (updateWheel.useCount == 0) {
+        // NOTE(traks): no need to step through all ticks without updates
+        updateWheel.nextTick = serv->current_tick + 1;
+    }
+
+    if (updateWheel.freeEntry == 0) {
+        i32 oldSize = updateWheel.arraySize;
+        updateWheel.arraySize = MAX(2 * oldSize, 256);
+        updateWheel.entries = realloc(updateWheel.entries, updateWheel.arraySize * sizeof *updateWheel.entries);
+        // NOTE(traks): entry 0 is never used
+        for (i32 i = updateWheel.arraySize - 1; i >= MAX(oldSize, 1); i--) {
+            updateWheel.entries[i].next = updateWheel.freeEntry;
+            updateWheel.freeEntry = i;
+        }
+    }
+
+    i32 entryIndex = updateWheel.freeEntry;
+    ScheduledUpdateEntry * entry = updateWheel.entries + entryIndex;
+    updateWheel.freeEntry = entry->next;
+    updateWheel.useCount++;
+
+    *entry = (ScheduledUpdateEntry) {
+        .pos = pos,
+        .forTick = serv->current_tick + delay,
+        .chunk = chunk,
+        .chunkNext = chunk->scheduledUpdates,
+        .fromDirection = fromDirection,
+    };
+    if (entry->chunkNext != 0) {
+        updateWheel.entries[entry->chunkNext].chunkPrev = entryIndex;
+    }
+    chunk->scheduledUpdates = entryIndex;
+    InsertIntoWheel(entryIndex);
+}
+
+static void AdvanceUpdateWheel(void) {
+    i64 tick = updateWheel.nextTick;
+    updateWheel.nextTick++;
+
+    // NOTE(traks): move updates in higher levels down if we reached the start
+    // of their slot. Start with the highest level, so updates can move down
+    // multiple levels
+    for (i32 level = WHEEL_LEVELS - 1; level >= 1; level--) {
+        if ((tick & (((i64) 1 << (WHEEL_SLOT_SHIFT * level)) - 1)) != 0) {
+            continue;
+        }
+        i32 slot = level * WHEEL_SLOTS_PER_LEVEL + ((tick >> (WHEEL_SLOT_SHIFT * level)) & WHEEL_SLOT_MASK);
+        i32 entryIndex = updateWheel.slots[slot];
+        updateWheel.slots[slot] = 0;
+        // NOTE(traks): insert relative to the tick we're processing
+        updateWheel.nextTick = tick;
+        while (entryIndex != 0) {
+            i32 next = updateWheel.entries[entryIndex].next;
+            InsertIntoWheel(entryIndex);
+            entryIndex = next;
+        }
+        updateWheel.nextTick = tick + 1;
+    }
+
+    i32 slot = tick & WHEEL_SLOT_MASK;
+    i32 entryIndex = updateWheel.slots[slot];
+    updateWheel.slots[slot] = 0;
+    while (entryIndex != 0) {
+        i32 next = updateWheel.entries[entryIndex].next;
+        LinkToWheelSlot(entryIndex, WHEEL_DUE_SLOT);
+        entryIndex = next;
+    }
+}
+
+i32 PopDueBlockUpdate(ScheduledBlockUpdate * update) {
+    for (;;) {
+        i32 entryIndex = updateWheel.slots[WHEEL_DUE_SLOT];
+        if (entryIndex != 0) {
+            ScheduledUpdateEntry * entry = updateWheel.entries + entryIndex;
+            if (entry->chunk->loaderFlags & CHUNK_LOADER_READY) {
+                *update = (ScheduledBlockUpdate) {
+                    .pos = entry->pos,
+                    .fromDirection = entry->fromDirection,
+                };
+                FreeScheduledUpdate(entryIndex);
+                return 1;
+            }
+            UnlinkFromWheelSlot(entryIndex);
+            entry->chunk->parkedUpdateCount++;
+            continue;
+        }
+
+        if (updateWheel.useCount == 0 || updateWheel.nextTick > serv->current_tick) {
+            return 0;
+        }
+        AdvanceUpdateWheel();
+    }
+}
+
+void DropScheduledBlockUpdates(Chunk * chunk) {
+    while (chunk->scheduledUpdates != 0) {
+        FreeScheduledUpdate(chunk->scheduledUpdates);
+    }
+    chunk->parkedUpdateCount = 0;
+}
+
+void ResumeScheduledBlockUpdates(Chunk * chunk) {
+    if (chunk->parkedUpdateCount == 0) {
+        return;
+    }
+    for (i32 entryIndex = chunk->scheduledUpdates; entryIndex != 0; entryIndex = updateWheel.entries[entryIndex].chunkNext) {
+        ScheduledUpdateEntry * entry = updateWheel.entries + entryIndex;
+        if (entry->slot == WHEEL_PARKED_SLOT) {
+            entry->forTick = serv->current_tick + 1;
+            InsertIntoWheel(entryIndex);
+        }
+    }
+    chunk->parkedUpdateCount = 0;
+}
+
+// NOTE(traks): block entity tables with up to this capacity come from the slab
+// allocators below, larger ones from malloc
+#define MIN_BLOCK_ENTITY_CAPACITY (8)
+#define MAX_SLAB_BLOCK_ENTITY_CAPACITY (256)
+
+// NOTE(traks): for capacities 8, 16, ..., 256
+static SlabAllocator blockEntitySlabs[6];
+
+static inline i32 BlockEntityTableAllocSize(i32 capacity) {
+    return capacity * (sizeof (u32) + sizeof (block_entity_base));
+}
+
+static inline SlabAllocator * GetBlockEntitySlab(i32 capacity) {
+    return blockEntitySlabs + (__builtin_ctz(capacity) - __builtin_ctz(MIN_BLOCK_ENTITY_CAPACITY));
+}
+
+static void AllocBlockEntityTable(BlockEntityTable * table, i32 capacity) {
+    void * data;
+    if (capacity <= MAX_SLAB_BLOCK_ENTITY_CAPACITY) {
+        data = SlabAlloc(GetBlockEntitySlab(capacity));
+    } else {
+        data = malloc(BlockEntityTableAllocSize(capacity));
+    }
+    if (data == NULL) {
+        LogInfo("Failed to allocate block entities");
+        exit(1);
+    }
+    memset(data, 0, capacity * sizeof (u32));
+    *table = (BlockEntityTable) {
+        .keys = data,
+        .entries = (block_entity_base *) ((u8 *) data + capacity * sizeof (u32)),
+        .capacity = capacity,
+    };
+}
+
+static void FreeBlockEntityTable(BlockEntityTable * table) {
+    if (table->capacity == 0) {
+        return;
+    } else if (table->capacity <= MAX_SLAB_BLOCK_ENTITY_CAPACITY) {
+        SlabFree(GetBlockEntitySlab(table->capacity), table->keys);
+    } else {
+        free(table->keys);
+    }
+    *table = (BlockEntityTable) {0};
+}
+
+static inline u32 PackBlockEntityKey(BlockPos pos) {
+    return ((u32) (pos.y - MIN_WORLD_Y) << 8 | (u32) (pos.z & 0xf) << 4 | (u32) (pos.x & 0xf)) + 1;
+}
+
+static inline u32 HashBlockEntityKey(BlockEntityTable * table, u32 key) {
+    // NOTE(traks): multiplicative hashing, top bits are mixed best
+    return (key * 0x9e3779b9u) >> (32 - __builtin_ctz(table->capacity));
+}
+
+// NOTE(traks): returns the slot with the key or the empty slot where it
+// should go
+static i32 FindBlockEntitySlot(BlockEntityTable * table, u32 key) {
+    u32 mask = table->capacity - 1;
+    u32 index = HashBlockEntityKey(table, key);
+    for (;;) {
+        if (table->keys[index] == 0 || table->keys[index] == key) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+static void GrowBlockEntityTable(BlockEntityTable * table) {
+    BlockEntityTable oldTable = *table;
+    AllocBlockEntityTable(table, MAX(2 * oldTable.capacity, MIN_BLOCK_ENTITY_CAPACITY));
+    for (i32 i = 0; i < oldTable.capacity; i++) {
+        if (oldTable.keys[i] != 0) {
+            i32 slot = FindBlockEntitySlot(table, oldTable.keys[i]);
+            table->keys[slot] = oldTable.keys[i];
+            table->entries[slot] = oldTable.entries[i];
+            table->count++;
+        }
+    }
+    FreeBlockEntityTable(&oldTable);
+}
+
+block_entity_base * ChunkGetBlockEntity(Chunk * ch, BlockPos pos) {
+    BlockEntityTable * table = &ch->blockEntities;
+    if (table->count == 0) {
+        return NULL;
+    }
+    i32 slot = FindBlockEntitySlot(table, PackBlockEntityKey(pos));
+    if (table->keys[slot] == 0) {
+        return NULL;
+    }
+    return table->entries + slot;
+}
+
+block_entity_base * ChunkGetOrCreateBlockEntity(Chunk * ch, BlockPos pos) {
+    BlockEntityTable * table = &ch->blockEntities;
+    // NOTE(traks): keep the load factor at most 1/2
+    if (2 * (table->count + 1) > table->capacity) {
+        GrowBlockEntityTable(table);
+    }
+
+    u32 key = PackBlockEntityKey(pos);
+    i32 slot = FindBlockEntitySlot(table, key);
+    block_entity_base * res = table->entries + slot;
+    if (table->keys[slot] == 0) {
+        table->keys[slot] = key;
+        table->count++;
+        *res = (block_entity_base) {
+            .type = BLOCK_ENTITY_NULL,
+            .pos = {.x = pos.x & 0xf, .y = pos.y, .z = pos.z & 0xf},
+        };
+    }
+    return res;
+}
+
+void ChunkRemoveBlockEntity(Chunk * ch, BlockPos pos) {
+    BlockEntityTable * table = &ch->blockEntities;
+    if (table->count == 0) {
+        return;
+    }
+    i32 slot = FindBlockEntitySlot(table, PackBlockEntityKey(pos));
+    if (table->keys[slot] == 0) {
+        return;
+    }
+
+    // NOTE(traks): move entries after the removed one back if that brings
+    // them closer to their desired slot, so lookups don't need tombstones
+    u32 mask = table->capacity - 1;
+    u32 indexToFill = slot;
+    table->keys[slot] = 0;
+    table->count--;
+    for (u32 curIndex = (slot + 1) & mask; table->keys[curIndex] != 0; curIndex = (curIndex + 1) & mask) {
+        u32 desiredIndex = HashBlockEntityKey(table, table->keys[curIndex]);
+        i32 shouldFill = (indexToFill < curIndex ?
+                (desiredIndex <= indexToFill || curIndex < desiredIndex)
+                : (desiredIndex <= indexToFill && curIndex < desiredIndex));
+        if (shouldFill) {
+            table->keys[indexToFill] = table->keys[curIndex];
+            table->entries[indexToFill] = table->entries[curIndex];
+            table->keys[curIndex] = 0;
+            indexToFill = curIndex;
+        }
+    }
+
+    if (table->count == 0) {
+        FreeBlockEntityTable(table);
+    }
+}
+
+block_entity_base * ChunkNextBlockEntity(Chunk * ch, i32 * iterator) {
+    BlockEntityTable * table = &ch->blockEntities;
+    while (*iterator < table->capacity) {
+        i32 slot = *iterator;
+        *iterator = slot + 1;
+        if (table->keys[slot] != 0) {
+            return table->entries + slot;
+        }
+    }
+    return NULL;
+}
+
+void FreeChunkBlockEntities(Chunk * ch) {
+    FreeBlockEntityTable(&ch->blockEntities);
+}
+
+void CopyChunkBlockEntities(Chunk * target, Chunk * source) {
+    FreeBlockEntityTable(&target->blockEntities);
+    if (source->blockEntities.count > 0) {
+        AllocBlockEntityTable(&target->blockEntities, source->blockEntities.capacity);
+        memcpy(target->blockEntities.keys, source->blockEntities.keys, BlockEntityTableAllocSize(source->blockEntities.capacity));
+        target->blockEntities.count = source->blockEntities.count;
+    }
+}
+
 void InitChunkSystem() {
-    void * changedMem = mmap(NULL, (1 << 20), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, 0, 0);
+    i64 entriesSize = MAX_CHANGED_CHUNKS * sizeof *changedChunks.entries;
+    i64 bucketsSize = CHANGED_CHUNK_BUCKET_COUNT * sizeof *changedChunks.buckets;
+    void * changedMem = mmap(NULL, entriesSize + bucketsSize, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, 0, 0);
     if (changedMem == MAP_FAILED) {
         LogInfo("Failed to map memory for chunks");
         exit(1);
     }
     changedChunks.entries = changedMem;
+    changedChunks.buckets = (ChangedChunkBucket *) ((u8 *) changedMem + entriesSize);
+    // NOTE(traks): buckets start out with generation 0, so they're all empty
+    changedChunks.generation = 1;
+
+    for (i32 slabIndex = 0; slabIndex < (i32) ARRAY_SIZE(blockEntitySlabs); slabIndex++) {
+        InitSlabAllocator(blockEntitySlabs + slabIndex, BlockEntityTableAllocSize(MIN_BLOCK_ENTITY_CAPACITY << slabIndex));
+    }
+
+    InitChunkLoader();
 }
 
 block_entity_base *
@@ -71,37 +577,216 @@ try_get_block_entity(WorldBlockPos pos) {
         return NULL;
     }
 
-    CompactChunkBlockPos chunk_block_pos = {
-        .x = pos.x & 0xf,
-        .y = pos.y,
-        .z = pos.z & 0xf,
-    };
+    return ChunkGetOrCreateBlockEntity(ch, pos.xyz);
+}
+
+static inline void SectionSetPaletteIndex(SectionBlocks * blocks, u32 index, u32 paletteIndex) {
+    if (blocks->bitsPerEntry == 4) {
+        u8 * entry = blocks->data + (index >> 1);
+        i32 shift = (index & 0x1) << 2;
+        *entry = (*entry & ~(0xf << shift)) | (paletteIndex << shift);
+    } else {
+        blocks->data[index] = paletteIndex;
+    }
+}
 
-    for (int i = 0; i < (i32) ARRAY_SIZE(ch->block_entities); i++) {
-        block_entity_base * block_entity = ch->block_entities + i;
-        if (!(block_entity->flags & BLOCK_ENTITY_IN_USE)) {
-            block_entity->pos = chunk_block_pos;
-            block_entity->type = BLOCK_ENTITY_NULL;
-            return block_entity;
-        } else if (memcmp(&block_entity->pos, &chunk_block_pos,
-                sizeof chunk_block_pos) == 0) {
-            return block_entity;
+static inline u32 HashPaletteBlockState(u32 blockState, u32 hashMask) {
+    return (blockState * 0x9e3779b1) >> 16 & hashMask;
+}
+
+void SectionFillBlockState(SectionBlocks * blocks, i32 blockState) {
+    assert(0 <= blockState && blockState < serv->vanilla_block_state_count);
+    FreeAndClearSectionBlocks(blocks);
+    blocks->singleState = blockState;
+}
+
+void SectionSetAllBlockStates(SectionBlocks * blocks, u16 * blockStates) {
+    BeginTimings(SectionSetAllBlockStates);
+
+    // NOTE(traks): collect the distinct block states in a small hash set, and
+    // stop once there are too many to fit in a palette. Keys are stored as
+    // block state + 1, so 0 means the slot is empty
+    u16 hashKeys[512] = {0};
+    u8 hashValues[512];
+    u16 palette[256];
+    u8 paletteIndices[4096];
+    i32 paletteSize = 0;
+    u32 hashMask = ARRAY_SIZE(hashKeys) - 1;
+
+    for (i32 posIndex = 0; posIndex < 4096; posIndex++) {
+        u32 blockState = blockStates[posIndex];
+        u32 hash = HashPaletteBlockState(blockState, hashMask);
+        for (;;) {
+            if (hashKeys[hash] == blockState + 1) {
+                break;
+            }
+            if (hashKeys[hash] == 0) {
+                if (paletteSize == ARRAY_SIZE(palette)) {
+                    // NOTE(traks): doesn't fit in a palette
+                    paletteSize++;
+                    goto collectedPalette;
+                }
+                hashKeys[hash] = blockState + 1;
+                hashValues[hash] = paletteSize;
+                palette[paletteSize] = blockState;
+                paletteSize++;
+                break;
+            }
+            hash = (hash + 1) & hashMask;
         }
+        paletteIndices[posIndex] = hashValues[hash];
+    }
+collectedPalette:
+
+    FreeAndClearSectionBlocks(blocks);
+
+    if (paletteSize == 1) {
+        blocks->singleState = palette[0];
+    } else if (paletteSize <= 256) {
+        i32 bitsPerEntry = (paletteSize <= 16 ? 4 : 8);
+        i32 capacity = SectionPaletteCapacity(bitsPerEntry);
+        blocks->bitsPerEntry = bitsPerEntry;
+        blocks->data = MallocSectionBlocks(bitsPerEntry);
+        blocks->palette = (u16 *) (blocks->data + 4096 * bitsPerEntry / 8);
+        blocks->paletteCounts = blocks->palette + capacity;
+        blocks->paletteSize = paletteSize;
+        blocks->paletteUsed = paletteSize;
+        memcpy(blocks->palette, palette, paletteSize * sizeof *palette);
+        memset(blocks->paletteCounts, 0, capacity * sizeof *blocks->paletteCounts);
+
+        if (bitsPerEntry == 4) {
+            for (i32 i = 0; i < 2048; i++) {
+                blocks->data[i] = paletteIndices[2 * i] | (paletteIndices[2 * i + 1] << 4);
+            }
+        } else {
+            memcpy(blocks->data, paletteIndices, 4096);
+        }
+        for (i32 posIndex = 0; posIndex < 4096; posIndex++) {
+            blocks->paletteCounts[paletteIndices[posIndex]]++;
+        }
+    } else {
+        blocks->bitsPerEntry = 16;
+        blocks->data = MallocSectionBlocks(16);
+        memcpy(blocks->data, blockStates, 4096 * sizeof *blockStates);
+    }
+
+    EndTimings(SectionSetAllBlockStates);
+}
+
+void SectionGetAllBlockStates(SectionBlocks * blocks, u16 * blockStates) {
+    switch (blocks->bitsPerEntry) {
+    case 0:
+        for (i32 posIndex = 0; posIndex < 4096; posIndex++) {
+            blockStates[posIndex] = blocks->singleState;
+        }
+        break;
+    case 4:
+        for (i32 i = 0; i < 2048; i++) {
+            blockStates[2 * i] = blocks->palette[blocks->data[i] & 0xf];
+            blockStates[2 * i + 1] = blocks->palette[blocks->data[i] >> 4];
+        }
+        break;
+    case 8:
+        for (i32 posIndex = 0; posIndex < 4096; posIndex++) {
+            blockStates[posIndex] = blocks->palette[blocks->data[posIndex]];
+        }
+        break;
+    default:
+        memcpy(blockStates, blocks->data, 4096 * sizeof *blockStates);
+        break;
     }
-    return NULL;
+}
+
+static void SectionCompact(SectionBlocks * blocks) {
+    u16 blockStates[4096];
+    SectionGetAllBlockStates(blocks, blockStates);
+    SectionSetAllBlockStates(blocks, blockStates);
 }
 
 void SectionSetBlockState(SectionBlocks * blocks, u32 index, i32 blockState) {
     assert(index <= 0xfff);
     assert(0 <= blockState && blockState < serv->vanilla_block_state_count);
 
-    if (SectionIsNull(blocks)) {
-        if (blockState == 0) {
+    switch (blocks->bitsPerEntry) {
+    case 0: {
+        if (blocks->singleState == blockState) {
             return;
         }
-        *blocks = CallocSectionBlocks();
+        // NOTE(traks): need a palette now
+        break;
     }
-    blocks->blockStates[index] = blockState;
+    case 4:
+    case 8: {
+        u32 oldPaletteIndex = SectionGetPaletteIndex(blocks, index);
+        if (blocks->palette[oldPaletteIndex] == blockState) {
+            return;
+        }
+
+        i32 newPaletteIndex = -1;
+        i32 freePaletteIndex = -1;
+        for (i32 paletteIndex = 0; paletteIndex < blocks->paletteSize; paletteIndex++) {
+            if (blocks->paletteCounts[paletteIndex] == 0) {
+                if (freePaletteIndex == -1) {
+                    freePaletteIndex = paletteIndex;
+                }
+            } else if (blocks->palette[paletteIndex] == blockState) {
+                newPaletteIndex = paletteIndex;
+                break;
+            }
+        }
+
+        if (newPaletteIndex == -1) {
+            if (freePaletteIndex != -1) {
+                newPaletteIndex = freePaletteIndex;
+            } else if (blocks->paletteSize < SectionPaletteCapacity(blocks->bitsPerEntry)) {
+                newPaletteIndex = blocks->paletteSize;
+                blocks->paletteSize++;
+            } else if (blocks->paletteCounts[oldPaletteIndex] == 1) {
+                // NOTE(traks): replacing the last use of the old entry
+                newPaletteIndex = oldPaletteIndex;
+            } else {
+                // NOTE(traks): palette is full, need more bits per entry
+                break;
+            }
+        }
+
+        blocks->paletteCounts[oldPaletteIndex]--;
+        if (blocks->paletteCounts[oldPaletteIndex] == 0) {
+            blocks->paletteUsed--;
+        }
+        if (blocks->paletteCounts[newPaletteIndex] == 0) {
+            blocks->palette[newPaletteIndex] = blockState;
+            blocks->paletteUsed++;
+        }
+        blocks->paletteCounts[newPaletteIndex]++;
+        SectionSetPaletteIndex(blocks, index, newPaletteIndex);
+
+        if (blocks->paletteUsed == 1) {
+            SectionFillBlockState(blocks, blockState);
+        } else if (blocks->bitsPerEntry == 8 && blocks->paletteUsed <= 8) {
+            // NOTE(traks): leave some room before demoting, so we don't keep
+            // switching between representations
+            SectionCompact(blocks);
+        }
+        return;
+    }
+    default: {
+        ((u16 *) blocks->data)[index] = blockState;
+        blocks->directWrites++;
+        // NOTE(traks): we don't know how many distinct block states there
+        // are in direct mode, so occasionally check if we can use a palette.
+        // This costs about 1 block lookup per write
+        if (blocks->directWrites >= 4096) {
+            SectionCompact(blocks);
+        }
+        return;
+    }
+    }
+
+    u16 blockStates[4096];
+    SectionGetAllBlockStates(blocks, blockStates);
+    blockStates[index] = blockState;
+    SectionSetAllBlockStates(blocks, blockStates);
 }
 
 i32 WorldGetBlockState(WorldBlockPos pos) {
@@ -268,6 +953,9 @@ SetBlockResult ChunkSetBlockState(Chunk * ch, BlockPos pos, i32 blockState) {
     // @TODO(traks) also check for cave air and void air? Should probably avoid
     // the == 0 check either way and use block type lookup or property check
     i32 oldBlockState = SectionGetBlockState(&section->blocks, index);
+    if (ch->sharedBlockSections & ((u32) 1 << sectionIndex)) {
+        UnshareChunkBlockSection(ch, sectionIndex);
+    }
     if (oldBlockState == 0) {
         section->nonAirCount++;
     }
@@ -280,6 +968,10 @@ SetBlockResult ChunkSetBlockState(Chunk * ch, BlockPos pos, i32 blockState) {
 
     SectionSetBlockState(&section->blocks, index, blockState);
 
+    if (ch->blockEntities.count > 0 && serv->block_type_by_state[oldBlockState] != serv->block_type_by_state[blockState]) {
+        ChunkRemoveBlockEntity(ch, pos);
+    }
+
     if (section->nonAirCount == 0) {
         FreeAndClearSectionBlocks(&section->blocks);
     }
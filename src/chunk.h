@@ -3,8 +3,32 @@
 
 #include "shared.h"
 
+// NOTE(traks): Block states of a section are stored in one of the following
+// ways, depending on the number of distinct block states in the section:
+//
+// - 0 bits per entry: all blocks have the same state, stored in singleState.
+//   No memory is allocated. A zero-initialised section is full of air.
+// - 4 or 8 bits per entry: data holds indices into the palette. The palette is
+//   followed by a count per palette entry of how many blocks use it, so we
+//   know when entries can be reused and when the section can be demoted.
+// - 16 bits per entry: data holds the block states directly as u16s.
+//
+// The memory for data, palette and palette counts is one allocation that
+// starts at data.
 typedef struct {
-    u16 * blockStates;
+    u8 * data;
+    u16 * palette;
+    u16 * paletteCounts;
+    u16 singleState;
+    // NOTE(traks): number of palette slots in use, some of which may have a
+    // count of 0 and are free to be reused
+    u16 paletteSize;
+    // NOTE(traks): number of palette entries with a nonzero count
+    u16 paletteUsed;
+    // NOTE(traks): number of writes since the section was last compacted in
+    // direct mode
+    u16 directWrites;
+    u8 bitsPerEntry;
 } SectionBlocks;
 
 typedef struct {
@@ -16,26 +40,53 @@ typedef struct {
 } ChunkSection;
 
 typedef struct {
-    // @OTE(traks): sky light and block light are 1 byte per entry. Currently
-    // never NULL, even if all light is 0.
+    // NOTE(traks): sky light and block light are 4 bits per entry, where the
+    // lower nibble of a byte holds the even entry. This is the same format as
+    // in region files and the protocol. Never NULL. If all light values in a
+    // section are equal, the section points to shared read-only memory. Use
+    // UnshareSectionLight before modifying light!
     // NOTE(traks): index as yzx
     u8 * skyLight;
     u8 * blockLight;
 } LightSection;
 
+// NOTE(traks): Hash table of the block entities in a chunk, keyed by the
+// position in the chunk. The keys are followed by the entries in the same
+// allocation. Small tables come from slab allocators, one per capacity.
+typedef struct {
+    // NOTE(traks): 0 if the slot is empty, otherwise the packed position + 1
+    u32 * keys;
+    block_entity_base * entries;
+    // NOTE(traks): power of 2, or 0 if nothing is allocated
+    i32 capacity;
+    i32 count;
+} BlockEntityTable;
+
 #define CHUNK_ATOMIC_FINISHED_LOAD ((u32) 0x1 << 0)
 #define CHUNK_ATOMIC_LOAD_SUCCESS ((u32) 0x1 << 1)
+// NOTE(traks): the chunk's light was loaded from disk
+#define CHUNK_ATOMIC_GOT_LIGHT ((u32) 0x1 << 2)
 
 #define CHUNK_LOADER_REQUESTING_UPDATE ((u32) 0x1 << 0)
 #define CHUNK_LOADER_FINISHED_LOAD ((u32) 0x1 << 1)
 #define CHUNK_LOADER_STARTED_LOAD ((u32) 0x1 << 2)
+// NOTE(traks): the chunk data came with light, so the chunk doesn't need to be
+// lit anymore
 #define CHUNK_LOADER_GOT_LIGHT ((u32) 0x1 << 3)
 #define CHUNK_LOADER_LOAD_SUCCESS ((u32) 0x1 << 4)
 #define CHUNK_LOADER_READY ((u32) 0x1 << 5)
 #define CHUNK_LOADER_LIT_SELF ((u32) 0x1 << 6)
 #define CHUNK_LOADER_FULLY_LIT ((u32) 0x1 << 7)
-
-typedef struct {
+// NOTE(traks): no one is interested in the chunk anymore, but we keep it
+// around in case someone wants it again soon
+#define CHUNK_LOADER_WARM ((u32) 0x1 << 8)
+// NOTE(traks): the chunk data is copied from a template chunk instead of read
+// from disk
+#define CHUNK_LOADER_MIRROR ((u32) 0x1 << 9)
+// NOTE(traks): the chunk data comes from a world snapshot
+#define CHUNK_LOADER_SNAPSHOT ((u32) 0x1 << 10)
+
+typedef struct Chunk {
     ChunkSection sections[SECTIONS_PER_CHUNK];
     LightSection lightSections[LIGHT_SECTIONS_PER_CHUNK];
     // @NOTE(traks) index as zx
@@ -45,19 +96,14 @@ typedef struct {
 
     i64 lastBlockChangeTick;
     u32 changedBlockSections;
+    // NOTE(traks): whether players should be sent the entire chunk again
+    // because of changes this tick
+    u8 changedFully;
 
-    // @TODO(traks) allow more block entities. Possibly use an internally
-    // chained hashmap for this. The question is, where do we allocate this
-    // hashmap in? We may need some more general-purpose allocator. Could
-    // restrict to allocation sizes of 2^13, 2^12, 2^11, etc. and have separate
-    // linked lists for each. Maybe pull blocks from 2^13 list to 2^12 list,
-    // from 2^12 list to 2^11, etc. when they need more memory.
-
-    // @TODO(traks) flesh out all this block entity business. What if getting
-    // block entity fails? Remove block entities if block gets removed. Load
-    // block entities from region files. Send block entities to players. Send
-    // block entity updates to players.
-    block_entity_base block_entities[10];
+    // @TODO(traks) flesh out all this block entity business. Load block
+    // entities from region files. Send block entities to players. Send block
+    // entity updates to players.
+    BlockEntityTable blockEntities;
 
     level_event localEvents[64];
     i64 lastLocalEventTick;
@@ -70,11 +116,33 @@ typedef struct {
     // populated asynchronously. At the moment this should only be touched
     // (read/write) from the main thread.
     u32 loaderFlags;
-    // increment if you want to keep a chunk available in the map, decrement
-    // if you no longer care for the chunk.
-    // If = 0 the chunk will be removed from the map at some point.
+    // NOTE(traks): number of distinct regions of interest containing the
+    // chunk, and number of distinct regions of interest bordering the chunk.
+    // Actors with the same region of interest only count once. If both are 0,
+    // the chunk will be removed from the map at some point.
     i32 interestCount;
     i32 neighbourInterestCount;
+    // NOTE(traks): number of distinct regions of interest with normal
+    // priority containing or bordering the chunk
+    i32 normalInterestCount;
+    // NOTE(traks): least recently used list of warm chunks
+    struct Chunk * warmPrev;
+    struct Chunk * warmNext;
+    i64 warmMemoryUsage;
+    // NOTE(traks): sections whose memory may be shared with other chunks, see
+    // mirror worlds. The memory must be copied before it is modified!
+    u32 sharedBlockSections;
+    u32 sharedLightSections;
+    // NOTE(traks): for chunks of mirror worlds, the block sections that were
+    // modified since they were copied from the template, and the list of
+    // chunks with such sections
+    u32 mirrorChangedSections;
+    struct Chunk * mirrorChangedPrev;
+    struct Chunk * mirrorChangedNext;
+    // NOTE(traks): list of scheduled block updates in the chunk, and the
+    // number of them that are waiting for the chunk to be ready again
+    i32 scheduledUpdates;
+    i32 parkedUpdateCount;
 } Chunk;
 
 static inline i32 SectionPosToIndex(BlockPos pos) {
@@ -90,16 +158,39 @@ static inline BlockPos SectionIndexToPos(u32 index) {
     return res;
 }
 
+static inline i32 SectionPaletteCapacity(i32 bitsPerEntry) {
+    return (bitsPerEntry == 4 || bitsPerEntry == 8) ? (1 << bitsPerEntry) : 0;
+}
+
+static inline i32 SectionBlocksAllocSize(i32 bitsPerEntry) {
+    // NOTE(traks): data + palette + palette counts
+    return 4096 * bitsPerEntry / 8 + 2 * SectionPaletteCapacity(bitsPerEntry) * sizeof (u16);
+}
+
+// NOTE(traks): whether the section has no memory allocated to it, i.e. whether
+// all blocks in the section have the same state
 static inline i32 SectionIsNull(SectionBlocks * blocks) {
-    return (blocks->blockStates == NULL);
+    return (blocks->data == NULL);
 }
 
-static inline u32 SectionGetBlockState(SectionBlocks * blocks, u32 index) {
-    if (SectionIsNull(blocks)) {
-        return 0;
+static inline u32 SectionGetPaletteIndex(SectionBlocks * blocks, u32 index) {
+    if (blocks->bitsPerEntry == 4) {
+        return (blocks->data[index >> 1] >> ((index & 0x1) << 2)) & 0xf;
     }
+    return blocks->data[index];
+}
+
+static inline u32 SectionGetBlockState(SectionBlocks * blocks, u32 index) {
     assert(index <= 0xfff);
-    return blocks->blockStates[index];
+    switch (blocks->bitsPerEntry) {
+    case 0:
+        return blocks->singleState;
+    case 4:
+    case 8:
+        return blocks->palette[SectionGetPaletteIndex(blocks, index)];
+    default:
+        return ((u16 *) blocks->data)[index];
+    }
 }
 
 static inline WorldChunkPos WorldBlockPosChunk(WorldBlockPos pos) {
@@ -132,7 +223,25 @@ static inline WorldChunkPos UnpackWorldChunkPos(PackedWorldChunkPos pos) {
     return res;
 }
 
-void AddChunkInterest(WorldChunkPos pos, i32 interest);
+// NOTE(traks): Actors tell the chunk system which rectangle of chunks they want
+// to have loaded. The chunk system loads all chunks in the region, plus a
+// border of 1 chunk for lighting. Actors can move or resize their region
+// whenever they like, the chunk system will figure out which chunks to load and
+// unload. The returned ID is never 0.
+//
+// Chunks near the centre of a region are loaded first. Regions take turns
+// loading chunks, so each region makes progress. Speculative regions are meant
+// for chunks that might be needed in the near future, e.g. chunks in front of
+// fast moving players. They only get to load chunks when no normal region is
+// waiting for chunks.
+#define CHUNK_INTEREST_NORMAL (0)
+#define CHUNK_INTEREST_SPECULATIVE (1)
+#define CHUNK_INTEREST_PRIORITY_COUNT (2)
+
+ChunkInterestId RegisterChunkInterest(ChunkRegion region, i32 priority);
+// NOTE(traks): both for moving and resizing regions
+void MoveChunkInterest(ChunkInterestId id, ChunkRegion region);
+void ReleaseChunkInterest(ChunkInterestId id);
 i32 PopChunksToLoad(i32 worldId, Chunk * * chunkArray, i32 maxChunks);
 Chunk * GetChunkIfLoaded(WorldChunkPos pos);
 // NOTE(traks): Before accessing the chunk data, be sure to check the chunk's
@@ -142,8 +251,49 @@ Chunk * GetChunkInternal(WorldChunkPos pos);
 // NOTE(traks): chunkArray will hold the data, may need to zero-initialise it.
 // It is indexed as zx
 void CollectLoadedChunks(WorldChunkPos from, WorldChunkPos to, Chunk * * chunkArray);
+// NOTE(traks): same as above, but also collects chunks that aren't ready yet.
+// Nearby chunks are stored together, so this is much faster than looking up
+// each chunk separately.
+void CollectChunksInternal(WorldChunkPos from, WorldChunkPos to, Chunk * * chunkArray);
+
+// NOTE(traks): collects the 3x3 chunks centred around the given chunk, indexed
+// as zx
+static inline void CollectChunkNeighbours(WorldChunkPos pos, Chunk * * chunkArray) {
+    WorldChunkPos from = {.worldId = pos.worldId, .x = pos.x - 1, .z = pos.z - 1};
+    WorldChunkPos to = {.worldId = pos.worldId, .x = pos.x + 1, .z = pos.z + 1};
+    CollectChunksInternal(from, to, chunkArray);
+}
 i32 CollectChangedChunks(WorldChunkPos from, WorldChunkPos to, Chunk * * chunkArray);
 
+// NOTE(traks): A mirror world starts out as a copy of a region of a template
+// world. Its chunks share block and light memory with the template chunks, and
+// only copy a section once blocks in it are changed. This makes it cheap to
+// host many instances of the same map. The template region is kept loaded for
+// as long as the mirror world exists. Chunks of the mirror world outside of the
+// template region are empty.
+//
+// Resetting a mirror world shares the changed sections with the template
+// again, so it only costs as much as the number of changed sections.
+void CreateMirrorWorld(i32 worldId, ChunkRegion templateRegion);
+void ResetMirrorWorld(i32 worldId);
+void DestroyMirrorWorld(i32 worldId);
+// NOTE(traks): copy shared memory of the chunk, so it can be modified
+void UnshareChunkBlockSection(Chunk * chunk, i32 sectionIndex);
+void UnshareChunkLight(Chunk * chunk);
+// NOTE(traks): sets all light in the chunk to 0
+void ClearChunkLight(Chunk * chunk);
+
+// NOTE(traks): Use the light stored in the world's region files instead of
+// lighting chunks ourselves. Lighting a chunk takes in the order of 1 ms on the
+// main thread, which is wasted on maps that never change on disk, like lobbies
+// and arenas. Chunks saved without light are still lit by us. Stored light is
+// checked against the light of neighbouring chunks as chunks get loaded, and
+// chunks whose light doesn't match get lit by us too. The first chunk to load
+// in an area has nothing to be checked against though, so only enable this for
+// maps whose stored light is known to be good. Only applies to chunks loaded
+// afterwards.
+void SetTrustStoredLight(i32 worldId, i32 trust);
+
 typedef struct {
     i32 oldState;
     i32 newState;
@@ -152,41 +302,205 @@ typedef struct {
 
 u32 SectionGetBlockState(SectionBlocks * blocks, u32 index);
 void SectionSetBlockState(SectionBlocks * blocks, u32 index, i32 blockState);
+// NOTE(traks): replaces all block states in the section and picks the most
+// compact representation for them. Block states are indexed as yzx
+void SectionSetAllBlockStates(SectionBlocks * blocks, u16 * blockStates);
+// NOTE(traks): block states are indexed as yzx
+void SectionGetAllBlockStates(SectionBlocks * blocks, u16 * blockStates);
+void SectionFillBlockState(SectionBlocks * blocks, i32 blockState);
 
 // NOTE(traks): pos can be in world coordinates instead of chunk coordinates.
 // Makes this more convenient to use. Less error conditions = good!
 SetBlockResult ChunkSetBlockState(Chunk * ch, BlockPos pos, i32 blockState);
+// NOTE(traks): returns NULL if there is no block entity at the position
+block_entity_base * ChunkGetBlockEntity(Chunk * ch, BlockPos pos);
+// NOTE(traks): creates an unused entry if there is no block entity at the
+// position yet
+block_entity_base * ChunkGetOrCreateBlockEntity(Chunk * ch, BlockPos pos);
+void ChunkRemoveBlockEntity(Chunk * ch, BlockPos pos);
+// NOTE(traks): for iterating over all block entities in the chunk. Start with
+// iterator 0, returns NULL once done
+block_entity_base * ChunkNextBlockEntity(Chunk * ch, i32 * iterator);
+void FreeChunkBlockEntities(Chunk * ch);
+// NOTE(traks): replaces the block entities of the target with copies of the
+// source's block entities
+void CopyChunkBlockEntities(Chunk * target, Chunk * source);
+
+// NOTE(traks): for when many blocks of a chunk changed at once. Players get
+// sent the entire chunk again, instead of all the changed blocks
+void ChunkMarkChangedFully(Chunk * chunk);
 i32 ChunkGetBlockState(Chunk * ch, BlockPos pos);
 
 SetBlockResult WorldSetBlockState(WorldBlockPos pos, i32 blockState);
 i32 WorldGetBlockState(WorldBlockPos pos);
-void WorldLoadChunk(Chunk * chunk, MemoryArena * scratchArena);
+
+typedef struct {
+    Chunk * chunk;
+    // NOTE(traks): sectors of the chunk, NULL if the chunk isn't stored or
+    // couldn't be read
+    u8 * data;
+    i32 size;
+    // NOTE(traks): used internally by the reader
+    u32 location;
+} ChunkSectorRead;
+
+// NOTE(traks): reads the sectors of chunks that are all in the same region.
+// Chunks stored close to each other are read with a single read. The reads may
+// be reordered. Returns the number of read buffers, which must be freed with
+// FreeReadBuffer once the sector data isn't needed anymore. Needs room for
+// readCount read buffers
+i32 WorldReadChunkSectors(ChunkSectorRead * reads, i32 readCount, u8 * * readBuffers);
+
+// NOTE(traks): buffer holds the sector data of the given reads and must be
+// freed with FreeReadBuffer. It's NULL if the chunks aren't stored or couldn't
+// be read
+typedef void (* ChunkSectorsCallback)(ChunkSectorRead * reads, i32 readCount, u8 * buffer, void * data);
+
+// NOTE(traks): Same as above, but doesn't wait for the reads to complete. Only
+// available if InitAsyncReads succeeded. The callback is called for each group
+// of chunks read together, possibly on another thread and possibly before this
+// returns
+void WorldReadChunkSectorsAsync(ChunkSectorRead * reads, i32 readCount, ChunkSectorsCallback callback, void * data);
+
+struct RegionFile;
+
+// NOTE(traks): Like WorldReadChunkSectors, but the sector data points straight
+// into the region file's mapping. Returns the region file the mapping belongs to, which
+// must be released once the sector data isn't needed anymore. Returns NULL if
+// the region file isn't mapped
+struct RegionFile * WorldMapChunkSectors(ChunkSectorRead * reads, i32 readCount);
+
+// NOTE(traks): sectors may be NULL, in which case loading the chunk fails. If
+// loadLight is set, the chunk's stored light is loaded too if it has any, in
+// which case CHUNK_ATOMIC_GOT_LIGHT is set. The chunk's light must be 0 before
+// calling this. Chunks of more than 32 MiB uncompressed fail to load, and the
+// uncompressed chunk must fit in the scratch arena
+void WorldDecodeChunk(Chunk * chunk, u8 * sectors, i32 size, i32 loadLight, MemoryArena * scratchArena);
+
+// NOTE(traks): Blaze's own format for read-only maps. A world snapshot holds
+// the chunks of a region with their block states already resolved, fully lit
+// and in the same memory layout as our section storage, so chunks can be loaded
+// by pointing their sections into a mapping of the snapshot file. Snapshots
+// are baked from the region files by running the server with the 'bake'
+// argument, and live in world/snapshot. Regions with a snapshot are loaded from
+// the snapshot instead of the region file. Bake again after changing the region
+// files!
+void InitWorldSnapshots(void);
+// NOTE(traks): whether the chunk's region has a snapshot
+i32 WorldHasSnapshot(WorldChunkPos pos);
+// NOTE(traks): starts reading the chunk from disk in the background, so
+// loading it later doesn't have to wait for the disk as much
+void WorldPrefetchSnapshotChunk(WorldChunkPos pos);
+// NOTE(traks): checks that the snapshot has the chunk and that its record is
+// valid. Reads the entire record, so it may have to wait for the disk. Safe to
+// call from any thread. Returns 1 if the chunk can be loaded
+i32 WorldCheckSnapshotChunk(WorldChunkPos pos);
+// NOTE(traks): only for chunks that passed WorldCheckSnapshotChunk. Afterwards
+// the chunk is fully lit and its sections point into the snapshot, which is
+// read-only shared memory. Only sets a few pointers and doesn't touch the
+// block data, so cheap enough for the main thread
+void WorldLoadSnapshotChunk(Chunk * chunk);
+// NOTE(traks): chunks are indexed as zx and may be NULL. Returns 0 on failure
+i32 WorldWriteSnapshotRegion(i32 regionX, i32 regionZ, Chunk * * chunks);
+
+// NOTE(traks): all world snapshots are mapped in here
+extern u8 * snapshotMemory;
+extern i64 snapshotMemorySize;
+
+static inline i32 IsSnapshotMemory(void * data) {
+    return (uintptr_t) data - (uintptr_t) snapshotMemory < (uintptr_t) snapshotMemorySize;
+}
+
+// NOTE(traks): storage types in the header of a chunk's sectors, i.e. how the
+// chunk's NBT data is compressed. 3 and 4 were added in 24w04a, LZ4 uses the
+// block stream format of lz4-java
+enum ChunkStorageType {
+    CHUNK_STORAGE_GZIP = 1,
+    CHUNK_STORAGE_ZLIB = 2,
+    CHUNK_STORAGE_UNCOMPRESSED = 3,
+    CHUNK_STORAGE_LZ4 = 4,
+};
+
+// NOTE(traks): what the vanilla server writes by default. We don't write chunks
+// yet, but whatever does should use this unless configured otherwise
+#define CHUNK_STORAGE_DEFAULT CHUNK_STORAGE_ZLIB
+
+#define SECTION_LIGHT_SIZE (2048)
+
+// NOTE(traks): 16 sections of shared light, one for each light value
+extern u8 * uniformSectionLight;
+
+static inline u8 * GetUniformSectionLight(i32 value) {
+    assert(0 <= value && value <= 15);
+    return uniformSectionLight + value * SECTION_LIGHT_SIZE;
+}
+
+static inline i32 IsSharedSectionLight(u8 * lightArray) {
+    return (uintptr_t) (lightArray - uniformSectionLight) < 16 * SECTION_LIGHT_SIZE;
+}
 
 static inline u8 GetSectionLight(u8 * lightArray, u32 posIndex) {
     assert(posIndex <= 0xfff);
-    return lightArray[posIndex];
+    return (lightArray[posIndex >> 1] >> ((posIndex & 0x1) << 2)) & 0xf;
 }
 
 static inline void SetSectionLight(u8 * lightArray, u32 posIndex, u8 light) {
     assert(posIndex <= 0xfff);
-    lightArray[posIndex] = light & 0xf;
+    assert(!IsSharedSectionLight(lightArray));
+    u8 * entry = lightArray + (posIndex >> 1);
+    i32 shift = (posIndex & 0x1) << 2;
+    *entry = (*entry & ~(0xf << shift)) | ((light & 0xf) << shift);
 }
 
 // @NOTE(traks) assumes all light sections are present in the chunk and assumes
 // all light values are equal to 0
 void LightChunk(Chunk * ch);
 void LightChunkAndExchangeWithNeighbours(Chunk * targetChunk);
+// NOTE(traks): returns 0 if light would spread across the edges between the
+// chunk and its neighbours that have been lit, i.e. if the chunk's light
+// doesn't match up with its neighbours
+i32 LightMatchesNeighbours(Chunk * chunk);
 
 void ChunkRecalculateMotionBlockingHeightMap(Chunk * ch);
 
+typedef struct {
+    WorldBlockPos pos;
+    i32 fromDirection;
+} ScheduledBlockUpdate;
+
+// NOTE(traks): Scheduled block updates belong to the chunk they're in. They're
+// dropped when the chunk is unloaded, and postponed while the chunk isn't
+// ready. There's no limit on the number of pending updates.
+void ScheduleBlockUpdate(WorldBlockPos pos, i32 fromDirection, i32 delay);
+// NOTE(traks): returns 0 if there are no more updates due this tick
+i32 PopDueBlockUpdate(ScheduledBlockUpdate * update);
+void DropScheduledBlockUpdates(Chunk * chunk);
+void ResumeScheduledBlockUpdates(Chunk * chunk);
+
 void InitChunkSystem(void);
 void TickChunkSystem(void);
 
+void InitChunkLoader(void);
 void TickChunkLoader(void);
+// NOTE(traks): writes world snapshots for all region files of the main world
+void BakeWorldSnapshots(void);
 
-SectionBlocks CallocSectionBlocks(void);
+void * MallocSectionBlocks(i32 bitsPerEntry);
+void FreeSectionBlocks(void * data, i32 bitsPerEntry);
 void FreeAndClearSectionBlocks(SectionBlocks * blocks);
-void * CallocSectionLight(void);
-void FreeSectionLight(void * data);
+u8 * MallocSectionLight(void);
+void FreeSectionLight(u8 * data);
+// NOTE(traks): copies the section light if it's shared, so it can be modified.
+// Returns the new light array
+u8 * UnshareSectionLight(u8 * * lightArray);
+// NOTE(traks): switches to shared memory if all light values are equal
+void CompactSectionLight(u8 * * lightArray);
+// NOTE(traks): variants of the above for light of a chunk that's being
+// decoded on a loader thread. Its light arrays are either uniform or were
+// allocated by the decoder, so these don't touch the reference counts of
+// shared section memory, which only the main thread may use
+void FreeDecodedSectionLight(u8 * data);
+u8 * UnshareDecodedSectionLight(u8 * * lightArray);
+void CompactDecodedSectionLight(u8 * * lightArray);
 
 #endif
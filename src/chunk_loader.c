@@ -3,10 +3,19 @@
 
 #include <stdatomic.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include "shared.h"
 #include "nbt.h"
 #include "chunk.h"
+#include "slab.h"
+#include "region.h"
+#include "uring.h"
+#include "decompress.h"
 
 // @TODO(traks) don't use a hash map. Performance depends on the chunks loaded,
 // which depends on the positions of players in the world. Doesn't seem good
@@ -38,15 +47,6 @@
 // We could also add salt to whatever ID system we use, so it's harder for
 // players to force hash collisions.
 
-// TODO(traks): may be worthwhile to store multiple chunks under one hash. E.g.
-// a 4x4 per hash seems good (or even 8x8 so we can fit array of 16-bit
-// interestCounts into 1 cache lane). That adds a border of waste around player
-// loaded chunks (roughly 0.5-0.65 of the total is wasted) (linear!). However,
-// the number of entries is decreased by a factor of 16 (quadratic!).
-//
-// Might also be a bit more cache friendly, since if you access 1 chunk, you
-// probably also want to access some neighbouring chunks.
-
 // TODO(traks): Here's yet another idea. Instead of storing interest per chunk,
 // let actors register rectangular regions they have interest in. The chunk
 // system will take care of loading all the chunks in all the provided regions.
@@ -77,6 +77,9 @@
 //   a way to determine whether it's faster to merge multiple chunks into a
 //   single read vs. reading them all separately. Maybe 500-5000 chunks per tick
 //   is reasonable depending on HDD/SDD (if chunks are 2 sectors each).
+//   Chunk loads started in the same tick are now read per region with merged
+//   reads (see ChunkLoadBatch), but we don't start nearly that many loads per
+//   tick yet.
 // - Loading chunks near players is much more important than loading chunks that
 //   are further away. Nearby chunks should therefore have a higher priority in
 //   case chunk loading can't keep up with the demand. Moreover, progress should
@@ -96,21 +99,59 @@
 // - Based on memory available and configured limits, things like preemtive
 //   chunk loads can be restricted to a certain amount of memory.
 
+// NOTE(traks): Chunks are stored in clusters of 4x4 chunks, with one hash map
+// entry per cluster. This cuts down the number of entries by a factor 16, and
+// neighbouring chunks can usually be found with a single lookup. Clusters are
+// aligned to multiples of 4 chunks, so only clusters near players are wasted
+// partly.
+#define CHUNK_CLUSTER_SHIFT (2)
+
+// NOTE(traks): compares lookups in the chunk index against the old index with
+// one entry per chunk on startup
+// #define MEASURE_CHUNK_INDEX
+#define CHUNK_CLUSTER_DIAM (1 << CHUNK_CLUSTER_SHIFT)
+#define CHUNK_CLUSTER_MASK (CHUNK_CLUSTER_DIAM - 1)
+
+// NOTE(traks): compares reading all chunks of the region files in the world
+// directory one chunk at a time against merged reads on startup. The region
+// files are dropped from the page cache before each pass
+// #define MEASURE_REGION_READS
+
+// NOTE(traks): compares the throughput of zlib against our single pass
+// inflate on all zlib and gzip compressed chunks in the world directory on
+// startup
+// #define MEASURE_INFLATE
+
+// NOTE(traks): moves a few chunk interest regions of various shapes around on
+// startup and checks the interest counts of the chunks after each move
+// #define CHECK_CHUNK_INTEREST
+
+// NOTE(traks): decode chunks straight out of read-only mappings of the region
+// files, instead of reading the chunk sectors into buffers. Good for worlds
+// that fit in the page cache, such as lobbies. Region files must not be
+// modified while the server is running
+// #define MAP_REGION_FILES
+
 typedef struct {
+    // NOTE(traks): chunk position shifted right by the cluster shift. The
+    // packed position is 0 if the entry is empty
     PackedWorldChunkPos packedPos;
-    Chunk * chunk;
-} ChunkHashEntry;
+    i32 chunkCount;
+    // NOTE(traks): index as zx
+    Chunk * chunks[CHUNK_CLUSTER_DIAM * CHUNK_CLUSTER_DIAM];
+} ChunkCluster;
 
 typedef struct {
-    ChunkHashEntry * entries;
+    ChunkCluster * entries;
     // NOTE(traks): must be power of 2
     i32 arraySize;
     u32 sizeMask;
     i32 useCount;
-} ChunkHashMap;
+} ChunkClusterMap;
 
 typedef struct {
-    PackedWorldChunkPos packedPos;
+    // NOTE(traks): chunks aren't freed while they have an update request
+    Chunk * chunk;
 } ChunkUpdateRequest;
 
 // NOTE(traks): this is a ring buffer
@@ -123,10 +164,156 @@ typedef struct {
     u32 startIndex;
 } ChunkUpdateRequestList;
 
-static ChunkHashMap chunkIndex;
-static ChunkUpdateRequestList updateRequests;
+typedef struct {
+    ChunkPos pos;
+    i64 requestTick;
+} ChunkLoadRequest;
+
+typedef struct {
+    ChunkRegion region;
+    i32 priority;
+    // NOTE(traks): number of actors interested in this exact region
+    i32 actorCount;
+    // NOTE(traks): next entry in the hash bucket, or the next free entry
+    i32 next;
+    // NOTE(traks): chunks in the region that may still need to be loaded,
+    // ordered by distance to the centre of the region
+    ChunkLoadRequest * loadRequests;
+    i32 loadRequestCount;
+    i32 loadRequestArraySize;
+    i32 nextLoadRequest;
+    // NOTE(traks): index into the scheduled regions of the priority, or -1 if
+    // there are no load requests
+    i32 scheduleIndex;
+} InterestRegion;
+
+// NOTE(traks): Actors with the exact same region of interest (e.g. players
+// standing around the spawn point) share a single entry, so the chunks only
+// need to be updated once for all of them.
+typedef struct {
+    i32 buckets[1024];
+    InterestRegion * entries;
+    i32 arraySize;
+    i32 freeEntry;
+    // NOTE(traks): index is the interest ID - 1, value is the index of the
+    // actor's region, or -1 if none, or the next free actor if unused
+    i32 * actorRegions;
+    i32 actorArraySize;
+    i32 freeActor;
+} InterestRegionMap;
+
+// NOTE(traks): Chunk loads are started in rounds. Each round, every region
+// with pending load requests gets to start the load of its nearest chunk that
+// isn't loaded yet. That way players waiting for nearby chunks don't need to
+// wait for other players' faraway chunks to load. Speculative regions only get
+// a turn if all normal regions are done.
+typedef struct {
+    i32 * regions;
+    i32 regionCount;
+    i32 arraySize;
+    i32 nextRegion;
+    // NOTE(traks): statistics since the last time they were logged
+    i64 totalWaitTicks;
+    i64 maxWaitTicks;
+    i64 startedLoads;
+} ChunkLoadSchedule;
+
+// NOTE(traks): Limit the number of chunk loads handed to the background
+// threads, so recently requested nearby chunks don't have to wait for a large
+// backlog of loads to finish
+#define MAX_CHUNK_LOADS_IN_FLIGHT (32)
+// NOTE(traks): after this many ticks, speculative loads are no longer put
+// behind other tasks
+#define SPECULATIVE_LOAD_DEADLINE_TICKS (5 * 20)
+
+typedef struct ChunkLoadBatch ChunkLoadBatch;
+
+typedef struct {
+    ChunkLoadBatch * batch;
+    i32 readIndex;
+} ChunkDecodeTask;
+
+// NOTE(traks): Chunk loads started in the same tick are grouped by region, so a
+// background thread can read the chunks of a region with a few large
+// sequential reads instead of a seek and read per chunk. The chunks are then
+// decoded by separate tasks, so decoding still happens in parallel.
+struct ChunkLoadBatch {
+    i32 chunkCount;
+    ChunkSectorRead reads[MAX_CHUNK_LOADS_IN_FLIGHT];
+    ChunkDecodeTask decodeTasks[MAX_CHUNK_LOADS_IN_FLIGHT];
+    u8 * readBuffers[MAX_CHUNK_LOADS_IN_FLIGHT];
+    _Atomic i32 readBufferCount;
+    // NOTE(traks): region file the sector data is mapped from, if any
+    RegionFile * mappedRegion;
+    // NOTE(traks): whether to load the chunks' stored light
+    i32 loadLight;
+    // NOTE(traks): of the most urgent chunk load in the batch
+    i32 taskPriority;
+    i64 deadlineTick;
+    // NOTE(traks): the last decode task frees the batch
+    _Atomic i32 remainingDecodes;
+};
+
+// NOTE(traks): Chunks that no one is interested in anymore are kept around for
+// a while, so players walking back and forth don't cause the same chunks to be
+// read, decompressed, parsed and lit over and over. The least recently used
+// chunks are dropped once the chunks take up too much memory.
+typedef struct {
+    // NOTE(traks): least recently used first
+    Chunk * head;
+    Chunk * tail;
+    i32 chunkCount;
+    i64 memoryUsage;
+    i64 hits;
+    i64 misses;
+} WarmChunkList;
+
+// NOTE(traks): Section memory (block data and light arrays) normally belongs to
+// a single chunk. Chunks of mirror worlds share memory with their template
+// chunks though. This stores the number of references to shared memory. Memory
+// that isn't in here has a single reference.
+typedef struct {
+    // NOTE(traks): NULL if the entry is empty
+    void * data;
+    i32 refCount;
+} SharedSectionEntry;
+
+typedef struct {
+    SharedSectionEntry * entries;
+    // NOTE(traks): must be power of 2
+    i32 arraySize;
+    u32 sizeMask;
+    i32 useCount;
+} SharedSectionMap;
+
+typedef struct {
+    // NOTE(traks): world ID 0 if the world isn't a mirror world
+    ChunkRegion templateRegion;
+    ChunkInterestId templateInterestId;
+    // NOTE(traks): chunks with sections that differ from the template
+    Chunk * changedChunks;
+} MirrorWorld;
+
+static ChunkClusterMap chunkIndex;
+static WarmChunkList warmChunks;
+static SharedSectionMap sharedSections;
+static MirrorWorld mirrorWorlds[MAX_WORLD_ID + 1];
+static u8 trustStoredLight[MAX_WORLD_ID + 1];
+static ChunkUpdateRequestList updateRequests[CHUNK_INTEREST_PRIORITY_COUNT];
+static InterestRegionMap interestRegions;
+static ChunkLoadSchedule loadSchedules[CHUNK_INTEREST_PRIORITY_COUNT];
+static i32 chunkLoadsInFlight;
+// NOTE(traks): whether chunk sectors are read with io_uring
+static i32 asyncReads;
+// NOTE(traks): batches that haven't been handed to the background threads yet
+static ChunkLoadBatch * pendingLoadBatches[MAX_CHUNK_LOADS_IN_FLIGHT];
+static i32 pendingLoadBatchCount;
 static _Atomic i64 sectionBlocksMemoryUsage;
 static _Atomic i64 sectionLightMemoryUsage;
+// NOTE(traks): for 4, 8 and 16 bits per entry
+static SlabAllocator sectionBlocksSlabs[3];
+static SlabAllocator sectionLightSlab;
+u8 * uniformSectionLight;
 
 // NOTE(traks): jenkins one at a time
 static inline u32 HashU64(u64 key) {
@@ -144,23 +331,36 @@ static inline u32 HashU64(u64 key) {
     return hash;
 }
 
-static u32 HashWorldChunkPos(PackedWorldChunkPos pos) {
-    u64 key = pos.packed;
-    u32 hash = HashU64(key);
-    return hash;
+static inline u32 HashClusterPos(PackedWorldChunkPos clusterPos) {
+    // NOTE(traks): multiplicative hashing, top bits are mixed best
+    return (clusterPos.packed * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+static inline PackedWorldChunkPos GetClusterPos(WorldChunkPos pos) {
+    WorldChunkPos clusterPos = {
+        .worldId = pos.worldId,
+        .x = pos.x >> CHUNK_CLUSTER_SHIFT,
+        .z = pos.z >> CHUNK_CLUSTER_SHIFT,
+    };
+    return PackWorldChunkPos(clusterPos);
+}
+
+static inline i32 GetIndexInCluster(WorldChunkPos pos) {
+    return ((pos.z & CHUNK_CLUSTER_MASK) << CHUNK_CLUSTER_SHIFT) | (pos.x & CHUNK_CLUSTER_MASK);
 }
 
-static i32 ChunkHashEntryIsEmpty(ChunkHashEntry * entry) {
-    return entry->packedPos.packed == 0;
+static i32 ChunkClusterIsEmpty(ChunkCluster * cluster) {
+    return cluster->packedPos.packed == 0;
 }
 
-static ChunkHashEntry * FindChunkHashEntryOrEmpty(PackedWorldChunkPos packedPos, u32 startIndex) {
-    ChunkHashEntry * res = NULL;
+static ChunkCluster * FindChunkClusterOrEmpty(PackedWorldChunkPos clusterPos) {
+    ChunkCluster * res = NULL;
+    u32 startIndex = HashClusterPos(clusterPos);
     for (i32 offset = 0; offset < chunkIndex.arraySize; offset++) {
         i32 index = (startIndex + offset) & chunkIndex.sizeMask;
-        ChunkHashEntry * entry = chunkIndex.entries + index;
-        if (ChunkHashEntryIsEmpty(entry) || packedPos.packed == entry->packedPos.packed) {
-            res = entry;
+        ChunkCluster * cluster = chunkIndex.entries + index;
+        if (ChunkClusterIsEmpty(cluster) || clusterPos.packed == cluster->packedPos.packed) {
+            res = cluster;
             break;
         }
     }
@@ -169,20 +369,31 @@ static ChunkHashEntry * FindChunkHashEntryOrEmpty(PackedWorldChunkPos packedPos,
     return res;
 }
 
-static void GrowChunkHashMap() {
+static ChunkCluster * FindChunkCluster(PackedWorldChunkPos clusterPos) {
+    if (chunkIndex.arraySize == 0) {
+        return NULL;
+    }
+    ChunkCluster * res = FindChunkClusterOrEmpty(clusterPos);
+    if (ChunkClusterIsEmpty(res)) {
+        res = NULL;
+    }
+    return res;
+}
+
+static void GrowChunkClusterMap() {
     // NOTE(traks): need a bit of wiggle room for integer operations
     assert(chunkIndex.arraySize < (1 << 20));
 
     i32 oldSize = chunkIndex.arraySize;
-    ChunkHashEntry * oldEntries = chunkIndex.entries;
-    chunkIndex.arraySize = MAX(2 * oldSize, 128);
+    ChunkCluster * oldEntries = chunkIndex.entries;
+    chunkIndex.arraySize = MAX(2 * oldSize, 64);
     chunkIndex.sizeMask = chunkIndex.arraySize - 1;
     chunkIndex.entries = calloc(1, chunkIndex.arraySize * sizeof *chunkIndex.entries);
 
     for (i32 entryIndex = 0; entryIndex < oldSize; entryIndex++) {
-        ChunkHashEntry * oldEntry = oldEntries + entryIndex;
-        if (!ChunkHashEntryIsEmpty(oldEntry)) {
-            ChunkHashEntry * freeEntry = FindChunkHashEntryOrEmpty(oldEntry->packedPos, HashWorldChunkPos(oldEntry->packedPos));
+        ChunkCluster * oldEntry = oldEntries + entryIndex;
+        if (!ChunkClusterIsEmpty(oldEntry)) {
+            ChunkCluster * freeEntry = FindChunkClusterOrEmpty(oldEntry->packedPos);
             *freeEntry = *oldEntry;
         }
     }
@@ -190,39 +401,225 @@ static void GrowChunkHashMap() {
     free(oldEntries);
 }
 
-static void RemoveHashEntry(ChunkHashEntry * entryToRemove) {
-    assert(!ChunkHashEntryIsEmpty(entryToRemove));
+static void RemoveChunkCluster(ChunkCluster * entryToRemove) {
+    assert(!ChunkClusterIsEmpty(entryToRemove));
     chunkIndex.useCount--;
     u32 chainStart = entryToRemove - chunkIndex.entries;
     u32 indexToFill = chainStart;
-    chunkIndex.entries[chainStart] = (ChunkHashEntry) {0};
+    chunkIndex.entries[chainStart] = (ChunkCluster) {0};
     for (i32 offset = 1; offset < chunkIndex.arraySize; offset++) {
         u32 curIndex = (chainStart + offset) & chunkIndex.sizeMask;
-        ChunkHashEntry * chained = chunkIndex.entries + curIndex;
-        if (ChunkHashEntryIsEmpty(chained)) {
+        ChunkCluster * chained = chunkIndex.entries + curIndex;
+        if (ChunkClusterIsEmpty(chained)) {
             break;
         }
-        u32 desiredIndex = HashWorldChunkPos(chained->packedPos) & chunkIndex.sizeMask;
+        u32 desiredIndex = HashClusterPos(chained->packedPos) & chunkIndex.sizeMask;
         i32 shouldFill = (indexToFill < curIndex ?
                 (desiredIndex <= indexToFill || curIndex < desiredIndex)
                 : (desiredIndex <= indexToFill && curIndex < desiredIndex));
         if (shouldFill) {
             // NOTE(traks): move current item to the slot we need to fill
             chunkIndex.entries[indexToFill] = *chained;
-            *chained = (ChunkHashEntry) {0};
+            *chained = (ChunkCluster) {0};
             indexToFill = curIndex;
         }
     }
 }
 
-static void FreeChunk(WorldChunkPos pos) {
-    PackedWorldChunkPos packedPos = PackWorldChunkPos(pos);
-    u32 hash = HashWorldChunkPos(packedPos);
-    ChunkHashEntry * entry = FindChunkHashEntryOrEmpty(packedPos, hash);
-    assert(!ChunkHashEntryIsEmpty(entry));
-    Chunk * chunk = entry->chunk;
+static SharedSectionEntry * FindSharedSectionOrEmpty(void * data) {
+    u32 startIndex = HashU64((uintptr_t) data);
+    for (i32 offset = 0; offset < sharedSections.arraySize; offset++) {
+        SharedSectionEntry * entry = sharedSections.entries + ((startIndex + offset) & sharedSections.sizeMask);
+        if (entry->data == NULL || entry->data == data) {
+            return entry;
+        }
+    }
+    // NOTE(traks): the map is never full
+    assert(0);
+    return NULL;
+}
+
+static SharedSectionEntry * FindSharedSection(void * data) {
+    if (sharedSections.useCount == 0) {
+        return NULL;
+    }
+    SharedSectionEntry * res = FindSharedSectionOrEmpty(data);
+    if (res->data == NULL) {
+        res = NULL;
+    }
+    return res;
+}
+
+static void GrowSharedSectionMap(void) {
+    i32 oldSize = sharedSections.arraySize;
+    SharedSectionEntry * oldEntries = sharedSections.entries;
+    sharedSections.arraySize = MAX(2 * oldSize, 64);
+    sharedSections.sizeMask = sharedSections.arraySize - 1;
+    sharedSections.entries = calloc(1, sharedSections.arraySize * sizeof *sharedSections.entries);
+
+    for (i32 entryIndex = 0; entryIndex < oldSize; entryIndex++) {
+        SharedSectionEntry * oldEntry = oldEntries + entryIndex;
+        if (oldEntry->data != NULL) {
+            *FindSharedSectionOrEmpty(oldEntry->data) = *oldEntry;
+        }
+    }
+
+    free(oldEntries);
+}
+
+static void RemoveSharedSection(SharedSectionEntry * entryToRemove) {
+    sharedSections.useCount--;
+    u32 chainStart = entryToRemove - sharedSections.entries;
+    u32 indexToFill = chainStart;
+    sharedSections.entries[chainStart] = (SharedSectionEntry) {0};
+    for (i32 offset = 1; offset < sharedSections.arraySize; offset++) {
+        u32 curIndex = (chainStart + offset) & sharedSections.sizeMask;
+        SharedSectionEntry * chained = sharedSections.entries + curIndex;
+        if (chained->data == NULL) {
+            break;
+        }
+        u32 desiredIndex = HashU64((uintptr_t) chained->data) & sharedSections.sizeMask;
+        i32 shouldFill = (indexToFill < curIndex ?
+                (desiredIndex <= indexToFill || curIndex < desiredIndex)
+                : (desiredIndex <= indexToFill && curIndex < desiredIndex));
+        if (shouldFill) {
+            sharedSections.entries[indexToFill] = *chained;
+            *chained = (SharedSectionEntry) {0};
+            indexToFill = curIndex;
+        }
+    }
+}
+
+static void RetainSectionMemory(void * data) {
+    assert(data != NULL);
+    if (IsSnapshotMemory(data)) {
+        // NOTE(traks): never freed, no need to count references
+        return;
+    }
+    if (sharedSections.useCount >= sharedSections.arraySize / 2) {
+        GrowSharedSectionMap();
+    }
+    SharedSectionEntry * entry = FindSharedSectionOrEmpty(data);
+    if (entry->data == NULL) {
+        *entry = (SharedSectionEntry) {.data = data, .refCount = 1};
+        sharedSections.useCount++;
+    }
+    entry->refCount++;
+}
+
+// NOTE(traks): returns 1 if this was the last reference, in which case the
+// memory should be freed
+static i32 ReleaseSectionMemory(void * data) {
+    if (IsSnapshotMemory(data)) {
+        return 0;
+    }
+    SharedSectionEntry * entry = FindSharedSection(data);
+    if (entry == NULL) {
+        return 1;
+    }
+    entry->refCount--;
+    if (entry->refCount == 1) {
+        RemoveSharedSection(entry);
+    }
+    return 0;
+}
+
+// NOTE(traks): memory of world snapshots counts as shared too, it's read-only
+static i32 IsSectionMemoryShared(void * data) {
+    return IsSnapshotMemory(data) || FindSharedSection(data) != NULL;
+}
+
+static i64 EstimateChunkMemoryUsage(Chunk * chunk) {
+    i64 res = sizeof *chunk;
+    // NOTE(traks): memory of world snapshots is part of the page cache and
+    // doesn't count
+    for (i32 sectionIndex = 0; sectionIndex < SECTIONS_PER_CHUNK; sectionIndex++) {
+        SectionBlocks * blocks = &chunk->sections[sectionIndex].blocks;
+        if (!SectionIsNull(blocks) && !IsSnapshotMemory(blocks->data)) {
+            res += SectionBlocksAllocSize(blocks->bitsPerEntry);
+        }
+    }
+    for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
+        LightSection * section = chunk->lightSections + sectionIndex;
+        res += (IsSharedSectionLight(section->skyLight) || IsSnapshotMemory(section->skyLight) ? 0 : SECTION_LIGHT_SIZE);
+        res += (IsSharedSectionLight(section->blockLight) || IsSnapshotMemory(section->blockLight) ? 0 : SECTION_LIGHT_SIZE);
+    }
+    return res;
+}
+
+static void AddWarmChunk(Chunk * chunk) {
+    assert(!(chunk->loaderFlags & CHUNK_LOADER_WARM));
+    chunk->loaderFlags |= CHUNK_LOADER_WARM;
+    chunk->warmMemoryUsage = EstimateChunkMemoryUsage(chunk);
+    chunk->warmPrev = warmChunks.tail;
+    chunk->warmNext = NULL;
+    if (warmChunks.tail != NULL) {
+        warmChunks.tail->warmNext = chunk;
+    } else {
+        warmChunks.head = chunk;
+    }
+    warmChunks.tail = chunk;
+    warmChunks.chunkCount++;
+    warmChunks.memoryUsage += chunk->warmMemoryUsage;
+}
+
+static void RemoveWarmChunk(Chunk * chunk) {
+    assert(chunk->loaderFlags & CHUNK_LOADER_WARM);
+    chunk->loaderFlags &= ~CHUNK_LOADER_WARM;
+    if (chunk->warmPrev != NULL) {
+        chunk->warmPrev->warmNext = chunk->warmNext;
+    } else {
+        warmChunks.head = chunk->warmNext;
+    }
+    if (chunk->warmNext != NULL) {
+        chunk->warmNext->warmPrev = chunk->warmPrev;
+    } else {
+        warmChunks.tail = chunk->warmPrev;
+    }
+    chunk->warmPrev = NULL;
+    chunk->warmNext = NULL;
+    warmChunks.chunkCount--;
+    warmChunks.memoryUsage -= chunk->warmMemoryUsage;
+}
+
+static void AddMirrorChangedChunk(Chunk * chunk) {
+    MirrorWorld * mirror = mirrorWorlds + chunk->pos.worldId;
+    chunk->mirrorChangedPrev = NULL;
+    chunk->mirrorChangedNext = mirror->changedChunks;
+    if (mirror->changedChunks != NULL) {
+        mirror->changedChunks->mirrorChangedPrev = chunk;
+    }
+    mirror->changedChunks = chunk;
+}
+
+static void RemoveMirrorChangedChunk(Chunk * chunk) {
+    MirrorWorld * mirror = mirrorWorlds + chunk->pos.worldId;
+    if (chunk->mirrorChangedPrev != NULL) {
+        chunk->mirrorChangedPrev->mirrorChangedNext = chunk->mirrorChangedNext;
+    } else {
+        assert(mirror->changedChunks == chunk);
+        mirror->changedChunks = chunk->mirrorChangedNext;
+    }
+    if (chunk->mirrorChangedNext != NULL) {
+        chunk->mirrorChangedNext->mirrorChangedPrev = chunk->mirrorChangedPrev;
+    }
+    chunk->mirrorChangedPrev = NULL;
+    chunk->mirrorChangedNext = NULL;
+    chunk->mirrorChangedSections = 0;
+}
+
+static void FreeChunk(Chunk * chunk) {
     assert(!(chunk->loaderFlags & CHUNK_LOADER_REQUESTING_UPDATE));
 
+    if (chunk->loaderFlags & CHUNK_LOADER_WARM) {
+        RemoveWarmChunk(chunk);
+    }
+    if (chunk->mirrorChangedSections != 0) {
+        RemoveMirrorChangedChunk(chunk);
+    }
+    DropScheduledBlockUpdates(chunk);
+    FreeChunkBlockEntities(chunk);
+
     for (int sectionIndex = 0; sectionIndex < SECTIONS_PER_CHUNK; sectionIndex++) {
         ChunkSection * section = chunk->sections + sectionIndex;
         FreeAndClearSectionBlocks(&section->blocks);
@@ -233,303 +630,1817 @@ static void FreeChunk(WorldChunkPos pos) {
         FreeSectionLight(section->blockLight);
     }
 
+    ChunkCluster * cluster = FindChunkCluster(GetClusterPos(chunk->pos));
+    assert(cluster != NULL);
+    assert(cluster->chunks[GetIndexInCluster(chunk->pos)] == chunk);
+    cluster->chunks[GetIndexInCluster(chunk->pos)] = NULL;
+    cluster->chunkCount--;
+    if (cluster->chunkCount == 0) {
+        RemoveChunkCluster(cluster);
+    }
+
     free(chunk);
-    RemoveHashEntry(entry);
 }
 
-static void PushUpdateRequest(ChunkHashEntry * entry) {
-    assert(!ChunkHashEntryIsEmpty(entry));
-
-    Chunk * chunk = entry->chunk;
-
+static void PushUpdateRequest(Chunk * chunk) {
     if (chunk->loaderFlags & CHUNK_LOADER_REQUESTING_UPDATE) {
         return;
     }
 
     chunk->loaderFlags |= CHUNK_LOADER_REQUESTING_UPDATE;
 
-    if (updateRequests.useCount >= updateRequests.arraySize) {
+    // NOTE(traks): chunks only wanted by speculative regions (or by no one)
+    // are updated after all the others
+    i32 priority = (chunk->normalInterestCount > 0 ? CHUNK_INTEREST_NORMAL : CHUNK_INTEREST_SPECULATIVE);
+    ChunkUpdateRequestList * requests = updateRequests + priority;
+
+    if (requests->useCount >= requests->arraySize) {
         // NOTE(traks): need a bit of wiggle room for integer operations
         assert(chunkIndex.arraySize < (1 << 20));
-        u32 oldSize = updateRequests.arraySize;
-        ChunkUpdateRequest * oldEntries = updateRequests.entries;
-        updateRequests.arraySize = MAX(2 * oldSize, 128);
-        updateRequests.sizeMask = updateRequests.arraySize - 1;
-        updateRequests.entries = malloc(updateRequests.arraySize * sizeof *updateRequests.entries);
+        u32 oldSize = requests->arraySize;
+        ChunkUpdateRequest * oldEntries = requests->entries;
+        requests->arraySize = MAX(2 * oldSize, 128);
+        requests->sizeMask = requests->arraySize - 1;
+        requests->entries = malloc(requests->arraySize * sizeof *requests->entries);
         // NOTE(traks): for simplicity fill the new entries array twice with the
         // old array, in case the old ring buffer had data wrapping around to
         // the start
-        assert(oldSize == 0 || 2 * oldSize == updateRequests.arraySize);
-        memcpy(updateRequests.entries, oldEntries, oldSize * sizeof *updateRequests.entries);
-        memcpy(updateRequests.entries + oldSize, oldEntries, oldSize * sizeof *updateRequests.entries);
+        assert(oldSize == 0 || 2 * oldSize == requests->arraySize);
+        memcpy(requests->entries, oldEntries, oldSize * sizeof *requests->entries);
+        memcpy(requests->entries + oldSize, oldEntries, oldSize * sizeof *requests->entries);
         free(oldEntries);
     }
 
-    u32 placementIndex = (updateRequests.startIndex + updateRequests.useCount) & updateRequests.sizeMask;
-    updateRequests.entries[placementIndex] = (ChunkUpdateRequest) {
-        .packedPos = entry->packedPos,
+    u32 placementIndex = (requests->startIndex + requests->useCount) & requests->sizeMask;
+    requests->entries[placementIndex] = (ChunkUpdateRequest) {
+        .chunk = chunk,
     };
-    updateRequests.useCount++;
+    requests->useCount++;
 }
 
-static ChunkHashEntry * PopUpdateRequest(void) {
-    assert(updateRequests.useCount > 0);
-    ChunkUpdateRequest request = updateRequests.entries[updateRequests.startIndex];
-    updateRequests.startIndex = (updateRequests.startIndex + 1) & updateRequests.sizeMask;
-    updateRequests.useCount--;
+static Chunk * PopUpdateRequest(ChunkUpdateRequestList * requests) {
+    assert(requests->useCount > 0);
+    ChunkUpdateRequest request = requests->entries[requests->startIndex];
+    requests->startIndex = (requests->startIndex + 1) & requests->sizeMask;
+    requests->useCount--;
 
-    ChunkHashEntry * entry = FindChunkHashEntryOrEmpty(request.packedPos, HashWorldChunkPos(request.packedPos));
-    assert(!ChunkHashEntryIsEmpty(entry));
-    Chunk * chunk = entry->chunk;
+    Chunk * chunk = request.chunk;
     chunk->loaderFlags &= ~CHUNK_LOADER_REQUESTING_UPDATE;
-    return entry;
+    return chunk;
 }
 
-static ChunkHashEntry * GetOrCreateChunk(WorldChunkPos pos) {
+static Chunk * GetOrCreateChunk(WorldChunkPos pos) {
     if (chunkIndex.useCount >= chunkIndex.arraySize / 2) {
-        GrowChunkHashMap();
+        GrowChunkClusterMap();
     }
 
-    PackedWorldChunkPos packedPos = PackWorldChunkPos(pos);
-    u32 hash = HashWorldChunkPos(packedPos);
-    ChunkHashEntry * entry = FindChunkHashEntryOrEmpty(packedPos, hash);
-    if (ChunkHashEntryIsEmpty(entry)) {
+    PackedWorldChunkPos clusterPos = GetClusterPos(pos);
+    ChunkCluster * cluster = FindChunkClusterOrEmpty(clusterPos);
+    if (ChunkClusterIsEmpty(cluster)) {
+        *cluster = (ChunkCluster) {.packedPos = clusterPos};
+        chunkIndex.useCount++;
+    }
+
+    Chunk * * slot = cluster->chunks + GetIndexInCluster(pos);
+    if (*slot == NULL) {
         assert(pos.worldId != 0);
         Chunk * chunk = calloc(1, sizeof *chunk);
-        *entry = (ChunkHashEntry) {
-            .packedPos = packedPos,
-            .chunk = chunk,
-        };
-        chunkIndex.useCount++;
         chunk->pos = pos;
+        *slot = chunk;
+        cluster->chunkCount++;
+    }
+    return *slot;
+}
+
+// NOTE(traks): 2 if the chunk is in the region, 1 if it's in the border
+// around the region, 0 otherwise
+static i32 GetRegionInterestLevel(ChunkRegion * region, i32 worldId, i32 x, i32 z) {
+    if (region->worldId == 0 || region->worldId != worldId) {
+        return 0;
+    }
+    if (x < region->minX - 1 || x > region->maxX + 1 || z < region->minZ - 1 || z > region->maxZ + 1) {
+        return 0;
+    }
+    if (x < region->minX || x > region->maxX || z < region->minZ || z > region->maxZ) {
+        return 1;
     }
-    return entry;
+    return 2;
 }
 
-void AddChunkInterest(WorldChunkPos pos, i32 interest) {
-    if (pos.worldId == 0) {
-        // NOTE(traks): null world, no interest to be added
+static void ScheduleRegion(i32 regionIndex) {
+    InterestRegion * region = interestRegions.entries + regionIndex;
+    if (region->scheduleIndex != -1) {
         return;
     }
-    for (i32 dx = -1; dx <= 1; dx++) {
-        for (i32 dz = -1; dz <= 1; dz++) {
-            WorldChunkPos actualPos = pos;
-            actualPos.x += dx;
-            actualPos.z += dz;
-            ChunkHashEntry * entry = GetOrCreateChunk(actualPos);
-            Chunk * chunk = entry->chunk;
-            if (dx == 0 && dz == 0) {
-                chunk->interestCount += interest;
-                assert(chunk->interestCount >= 0);
-            } else {
-                chunk->neighbourInterestCount += interest;
-                assert(chunk->neighbourInterestCount >= 0);
-            }
-            PushUpdateRequest(entry);
-        }
+    ChunkLoadSchedule * schedule = loadSchedules + region->priority;
+    if (schedule->regionCount >= schedule->arraySize) {
+        schedule->arraySize = MAX(2 * schedule->arraySize, 64);
+        schedule->regions = realloc(schedule->regions, schedule->arraySize * sizeof *schedule->regions);
     }
+    region->scheduleIndex = schedule->regionCount;
+    schedule->regions[schedule->regionCount] = regionIndex;
+    schedule->regionCount++;
 }
 
-Chunk * GetChunkIfLoaded(WorldChunkPos pos) {
-    if (chunkIndex.arraySize == 0) {
-        return NULL;
+static void UnscheduleRegion(i32 regionIndex) {
+    InterestRegion * region = interestRegions.entries + regionIndex;
+    if (region->scheduleIndex == -1) {
+        return;
     }
-    Chunk * res = NULL;
-    PackedWorldChunkPos packedPos = PackWorldChunkPos(pos);
-    u32 hash = HashWorldChunkPos(packedPos);
-    ChunkHashEntry * entry = FindChunkHashEntryOrEmpty(packedPos, hash);
-    if (!ChunkHashEntryIsEmpty(entry)) {
-        Chunk * found = entry->chunk;
-        if (found->loaderFlags & CHUNK_LOADER_READY) {
-            res = found;
-        }
+    ChunkLoadSchedule * schedule = loadSchedules + region->priority;
+    i32 lastRegionIndex = schedule->regions[schedule->regionCount - 1];
+    schedule->regions[region->scheduleIndex] = lastRegionIndex;
+    interestRegions.entries[lastRegionIndex].scheduleIndex = region->scheduleIndex;
+    schedule->regionCount--;
+    region->scheduleIndex = -1;
+    region->loadRequestCount = 0;
+    region->nextLoadRequest = 0;
+}
+
+static void PushLoadRequest(i32 regionIndex, ChunkPos pos) {
+    InterestRegion * region = interestRegions.entries + regionIndex;
+    if (region->loadRequestCount >= region->loadRequestArraySize) {
+        region->loadRequestArraySize = MAX(2 * region->loadRequestArraySize, 64);
+        region->loadRequests = realloc(region->loadRequests, region->loadRequestArraySize * sizeof *region->loadRequests);
     }
-    return res;
+    region->loadRequests[region->loadRequestCount] = (ChunkLoadRequest) {
+        .pos = pos,
+        .requestTick = serv->current_tick,
+    };
+    region->loadRequestCount++;
+    ScheduleRegion(regionIndex);
 }
 
-Chunk * GetChunkInternal(WorldChunkPos pos) {
-    if (chunkIndex.arraySize == 0) {
-        return NULL;
+static void ChangeChunkInterest(WorldChunkPos pos, i32 oldLevel, i32 newLevel, i32 priority, i32 regionIndex) {
+    Chunk * chunk = GetOrCreateChunk(pos);
+    chunk->interestCount += (newLevel == 2) - (oldLevel == 2);
+    chunk->neighbourInterestCount += (newLevel == 1) - (oldLevel == 1);
+    if (priority == CHUNK_INTEREST_NORMAL) {
+        chunk->normalInterestCount += (newLevel > 0) - (oldLevel > 0);
     }
-    Chunk * res = NULL;
-    PackedWorldChunkPos packedPos = PackWorldChunkPos(pos);
-    u32 hash = HashWorldChunkPos(packedPos);
-    ChunkHashEntry * entry = FindChunkHashEntryOrEmpty(packedPos, hash);
-    if (!ChunkHashEntryIsEmpty(entry)) {
-        res = entry->chunk;
+    assert(chunk->interestCount >= 0);
+    assert(chunk->neighbourInterestCount >= 0);
+    assert(chunk->normalInterestCount >= 0);
+
+    if ((chunk->loaderFlags & CHUNK_LOADER_WARM) && newLevel > 0) {
+        RemoveWarmChunk(chunk);
+        warmChunks.hits++;
+        // NOTE(traks): neighbours may have been unloaded in the meantime, so
+        // check again whether the chunk is fully lit
+        chunk->loaderFlags &= ~(CHUNK_LOADER_FULLY_LIT | CHUNK_LOADER_READY);
+    }
+
+    PushUpdateRequest(chunk);
+
+    if (newLevel > 0 && !(chunk->loaderFlags & CHUNK_LOADER_STARTED_LOAD)) {
+        PushLoadRequest(regionIndex, pos.xz);
     }
-    return res;
 }
 
-void CollectLoadedChunks(WorldChunkPos from, WorldChunkPos to, Chunk * * chunkArray) {
-    i32 jumpZ = to.x - from.x + 1;
-    for (i32 x = from.x; x <= to.x; x++) {
-        for (i32 z = from.z; z <= to.z; z++) {
-            WorldChunkPos pos = {.worldId = from.worldId, .x = x, .z = z};
-            if (from.x <= x && x <= to.x && from.z <= z && z <= to.z) {
-                Chunk * chunk = GetChunkIfLoaded(pos);
-                chunkArray[(z - from.z) * jumpZ + (x - from.x)] = chunk;
+static void ChangeRegionRowInterest(ChunkRegion * oldRegion, ChunkRegion * newRegion, i32 priority, i32 regionIndex, i32 requestUnchanged, i32 z, i32 fromX, i32 toX) {
+    // NOTE(traks): clip to the new region and its border. Chunks outside of it
+    // are handled by the pass over the old region
+    if (z < newRegion->minZ - 1 || z > newRegion->maxZ + 1) {
+        return;
+    }
+    fromX = MAX(fromX, newRegion->minX - 1);
+    toX = MIN(toX, newRegion->maxX + 1);
+    for (i32 x = fromX; x <= toX; x++) {
+        i32 oldLevel = GetRegionInterestLevel(oldRegion, newRegion->worldId, x, z);
+        i32 newLevel = GetRegionInterestLevel(newRegion, newRegion->worldId, x, z);
+        WorldChunkPos pos = {.worldId = newRegion->worldId, .x = x, .z = z};
+        if (oldLevel != newLevel) {
+            ChangeChunkInterest(pos, oldLevel, newLevel, priority, regionIndex);
+        } else if (requestUnchanged && newLevel > 0) {
+            Chunk * chunk = GetChunkInternal(pos);
+            assert(chunk != NULL);
+            if (!(chunk->loaderFlags & CHUNK_LOADER_STARTED_LOAD)) {
+                PushLoadRequest(regionIndex, pos.xz);
             }
         }
     }
 }
 
-static void LoadChunkAsync(void * arg) {
-    Chunk * chunk = arg;
-
-    // TODO(traks): turn this into thread local or something?
-    i32 scratchSize = 4 * (1 << 20);
-    MemoryArena scratchArena = {
-        .size = scratchSize,
-        .data = malloc(scratchSize)
-    };
-
-    for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
-        LightSection * section = chunk->lightSections + sectionIndex;
-        section->skyLight = CallocSectionLight();
-        section->blockLight = CallocSectionLight();
+// NOTE(traks): Updates the interest of all chunks that are in one region and
+// not in the other. Both regions may be empty (world ID 0). Only looks at the
+// chunks in the two regions, so the cost doesn't depend on how far apart the
+// regions are.
+//
+// Chunks in the new region that need to be loaded are requested through the
+// region with the given index. If the old region still had pending load
+// requests, set requestUnchanged so those requests carry over to the new
+// region.
+static void ChangeRegionInterest(ChunkRegion * oldRegion, ChunkRegion * newRegion, i32 priority, i32 regionIndex, i32 requestUnchanged) {
+    if (newRegion->worldId != 0) {
+        // NOTE(traks): walk the new region in rings around its centre, so
+        // chunks in the centre are requested (and thus loaded) first
+        i32 centreX = newRegion->minX + (newRegion->maxX - newRegion->minX) / 2;
+        i32 centreZ = newRegion->minZ + (newRegion->maxZ - newRegion->minZ) / 2;
+        i32 maxRing = MAX(MAX(centreX - newRegion->minX, newRegion->maxX - centreX), MAX(centreZ - newRegion->minZ, newRegion->maxZ - centreZ)) + 1;
+        for (i32 ring = 0; ring <= maxRing; ring++) {
+            ChangeRegionRowInterest(oldRegion, newRegion, priority, regionIndex, requestUnchanged, centreZ - ring, centreX - ring, centreX + ring);
+            if (ring == 0) {
+                continue;
+            }
+            ChangeRegionRowInterest(oldRegion, newRegion, priority, regionIndex, requestUnchanged, centreZ + ring, centreX - ring, centreX + ring);
+            for (i32 z = centreZ - ring + 1; z <= centreZ + ring - 1; z++) {
+                ChangeRegionRowInterest(oldRegion, newRegion, priority, regionIndex, requestUnchanged, z, centreX - ring, centreX - ring);
+                ChangeRegionRowInterest(oldRegion, newRegion, priority, regionIndex, requestUnchanged, z, centreX + ring, centreX + ring);
+            }
+        }
     }
 
-    WorldLoadChunk(chunk, &scratchArena);
+    if (oldRegion->worldId != 0) {
+        // NOTE(traks): drop interest in the old chunks that aren't in the new
+        // region at all. The others were handled above.
+        for (i32 z = oldRegion->minZ - 1; z <= oldRegion->maxZ + 1; z++) {
+            for (i32 x = oldRegion->minX - 1; x <= oldRegion->maxX + 1; x++) {
+                if (GetRegionInterestLevel(newRegion, oldRegion->worldId, x, z) == 0) {
+                    i32 oldLevel = GetRegionInterestLevel(oldRegion, oldRegion->worldId, x, z);
+                    ChangeChunkInterest((WorldChunkPos) {.worldId = oldRegion->worldId, .x = x, .z = z}, oldLevel, 0, priority, -1);
+                }
+            }
+        }
+    }
+}
 
-    free(scratchArena.data);
+static u32 HashChunkRegion(ChunkRegion region) {
+    u64 keyMin = ((u64) (region.worldId & 0xfff) << 44)
+            | ((u64) (region.minX & 0x3fffff) << 22)
+            | ((u64) (region.minZ & 0x3fffff) << 0);
+    u64 keyMax = ((u64) (region.maxX & 0x3fffff) << 22)
+            | ((u64) (region.maxZ & 0x3fffff) << 0);
+    return HashU64(keyMin) ^ (HashU64(keyMax) * 0x9e3779b1);
+}
 
-    atomic_fetch_or_explicit(&chunk->atomicFlags, CHUNK_ATOMIC_FINISHED_LOAD, memory_order_release);
+static u32 HashInterestRegion(ChunkRegion region, i32 priority) {
+    return HashChunkRegion(region) ^ priority;
 }
 
-static void UpdateChunk(ChunkHashEntry * entry) {
-    Chunk * chunk = entry->chunk;
-    if (chunk->interestCount == 0 && chunk->neighbourInterestCount == 0) {
-        // TODO(traks): might want to keep the entry around for a little while
-        // instead of aggressively unloading
-        i32 chunkLoading = (chunk->loaderFlags & CHUNK_LOADER_STARTED_LOAD) && !(chunk->loaderFlags & CHUNK_LOADER_FINISHED_LOAD);
+static i32 ChunkRegionEquals(ChunkRegion a, ChunkRegion b) {
+    return a.worldId == b.worldId && a.minX == b.minX && a.minZ == b.minZ
+            && a.maxX == b.maxX && a.maxZ == b.maxZ;
+}
 
-        if (!chunkLoading) {
-            FreeChunk(UnpackWorldChunkPos(entry->packedPos));
-            return;
+static i32 FindOrCreateInterestRegion(ChunkRegion region, i32 priority, i32 * created) {
+    u32 bucket = HashInterestRegion(region, priority) & (ARRAY_SIZE(interestRegions.buckets) - 1);
+    for (i32 index = interestRegions.buckets[bucket]; index != -1; index = interestRegions.entries[index].next) {
+        InterestRegion * entry = interestRegions.entries + index;
+        if (ChunkRegionEquals(entry->region, region) && entry->priority == priority) {
+            *created = 0;
+            return index;
         }
+    }
 
-        // NOTE(traks): can't unload, so try unloading later
-        PushUpdateRequest(entry);
+    if (interestRegions.freeEntry == -1) {
+        i32 oldSize = interestRegions.arraySize;
+        interestRegions.arraySize = MAX(2 * oldSize, 64);
+        interestRegions.entries = realloc(interestRegions.entries, interestRegions.arraySize * sizeof *interestRegions.entries);
+        for (i32 index = interestRegions.arraySize - 1; index >= oldSize; index--) {
+            interestRegions.entries[index].next = interestRegions.freeEntry;
+            interestRegions.freeEntry = index;
+        }
     }
 
-    if ((chunk->interestCount > 0 || chunk->neighbourInterestCount > 0) && !(chunk->loaderFlags & CHUNK_LOADER_STARTED_LOAD)) {
-        chunk->loaderFlags |= CHUNK_LOADER_STARTED_LOAD;
-        PushTaskToQueue(serv->backgroundQueue, LoadChunkAsync, chunk);
+    i32 res = interestRegions.freeEntry;
+    InterestRegion * entry = interestRegions.entries + res;
+    interestRegions.freeEntry = entry->next;
+    *entry = (InterestRegion) {
+        .region = region,
+        .priority = priority,
+        .next = interestRegions.buckets[bucket],
+        .scheduleIndex = -1,
+    };
+    interestRegions.buckets[bucket] = res;
+    *created = 1;
+    return res;
+}
+
+static void FreeInterestRegion(i32 index) {
+    InterestRegion * entry = interestRegions.entries + index;
+    assert(entry->actorCount == 0);
+    UnscheduleRegion(index);
+    free(entry->loadRequests);
+    u32 bucket = HashInterestRegion(entry->region, entry->priority) & (ARRAY_SIZE(interestRegions.buckets) - 1);
+    i32 * link = interestRegions.buckets + bucket;
+    while (*link != index) {
+        assert(*link != -1);
+        link = &interestRegions.entries[*link].next;
     }
+    *link = entry->next;
+    entry->next = interestRegions.freeEntry;
+    interestRegions.freeEntry = index;
+}
 
-    if ((chunk->loaderFlags & CHUNK_LOADER_STARTED_LOAD) && !(chunk->loaderFlags & CHUNK_LOADER_FINISHED_LOAD)) {
-        u32 atomicFlags = atomic_load_explicit(&chunk->atomicFlags, memory_order_acquire);
-        if (atomicFlags & CHUNK_ATOMIC_FINISHED_LOAD) {
-            chunk->loaderFlags |= CHUNK_LOADER_FINISHED_LOAD;
-            if (atomicFlags & CHUNK_ATOMIC_LOAD_SUCCESS) {
-                chunk->loaderFlags |= CHUNK_LOADER_LOAD_SUCCESS;
-            } else {
-                // TODO(traks): what to do with the chunk??
-                LogInfo("Failed to load chunk");
-            }
-        } else {
-            // NOTE(traks): not yet loaded, poll again later
-            PushUpdateRequest(entry);
+// NOTE(traks): The actor leaves its current region (if any) and joins the new
+// region (if any). Chunk interest only changes if the actor was the last one
+// in its old region or the first one in its new region.
+static void SwitchInterestRegion(i32 * regionIndex, ChunkRegion * newRegion, i32 priority) {
+    // NOTE(traks): world ID 0 means empty region
+    ChunkRegion removedRegion = {0};
+    ChunkRegion addedRegion = {0};
+    i32 hadLoadRequests = 0;
+
+    i32 oldIndex = *regionIndex;
+    if (oldIndex != -1) {
+        InterestRegion * oldEntry = interestRegions.entries + oldIndex;
+        oldEntry->actorCount--;
+        if (oldEntry->actorCount == 0) {
+            removedRegion = oldEntry->region;
+            hadLoadRequests = (oldEntry->nextLoadRequest < oldEntry->loadRequestCount);
+            FreeInterestRegion(oldIndex);
         }
     }
 
-    if ((chunk->loaderFlags & CHUNK_LOADER_LOAD_SUCCESS) && !(chunk->loaderFlags & CHUNK_LOADER_LIT_SELF)) {
-        LightChunkAndExchangeWithNeighbours(chunk);
-        chunk->loaderFlags |= CHUNK_LOADER_LIT_SELF;
-        // NOTE(traks): Update neighbours and the chunk itself, to check if
-        // any are fully ready (fully lit by all neighbours)
-        for (i32 dx = -1; dx <= 1; dx++) {
-            for (i32 dz = -1; dz <= 1; dz++) {
-                WorldChunkPos neighbourPos = UnpackWorldChunkPos(entry->packedPos);
-                neighbourPos.x += dx;
-                neighbourPos.z += dz;
-                PackedWorldChunkPos packedNeighbourPos = PackWorldChunkPos(neighbourPos);
-                u32 neighbourHash = HashWorldChunkPos(packedNeighbourPos);
-                ChunkHashEntry * neighbourEntry = FindChunkHashEntryOrEmpty(packedNeighbourPos, neighbourHash);
-                if (!ChunkHashEntryIsEmpty(neighbourEntry)) {
-                    PushUpdateRequest(neighbourEntry);
-                }
-            }
+    i32 newIndex = -1;
+    if (newRegion != NULL) {
+        i32 created;
+        newIndex = FindOrCreateInterestRegion(*newRegion, priority, &created);
+        interestRegions.entries[newIndex].actorCount++;
+        if (created) {
+            addedRegion = *newRegion;
         }
     }
+    *regionIndex = newIndex;
 
-    if ((chunk->loaderFlags & CHUNK_LOADER_LIT_SELF) && !(chunk->loaderFlags & CHUNK_LOADER_FULLY_LIT)) {
-        // NOTE(traks): check if all neighbours have been lit too
-        i32 allNeighboursLit = 1;
-        for (i32 dx = -1; dx <= 1; dx++) {
-            for (i32 dz = -1; dz <= 1; dz++) {
-                WorldChunkPos neighbourPos = UnpackWorldChunkPos(entry->packedPos);
-                neighbourPos.x += dx;
-                neighbourPos.z += dz;
-                Chunk * neighbour = GetChunkInternal(neighbourPos);
-                if (neighbour == NULL || !(neighbour->loaderFlags & CHUNK_LOADER_LIT_SELF)) {
-                    allNeighboursLit = 0;
-                    goto checkNeighboursLitEnd;
-                }
-            }
-        }
-checkNeighboursLitEnd:
-        if (allNeighboursLit) {
-            chunk->loaderFlags |= CHUNK_LOADER_FULLY_LIT;
-            // TODO(traks): Should we be marking chunks with no interest (only
-            // neighbour interest) also as ready?
-            chunk->loaderFlags |= CHUNK_LOADER_READY;
+    // NOTE(traks): if the new region already existed, it either already
+    // requested the chunks it needs or doesn't need any
+    ChangeRegionInterest(&removedRegion, &addedRegion, priority, newIndex, hadLoadRequests && addedRegion.worldId != 0);
+}
+
+ChunkInterestId RegisterChunkInterest(ChunkRegion region, i32 priority) {
+    assert(0 <= priority && priority < CHUNK_INTEREST_PRIORITY_COUNT);
+    if (interestRegions.freeActor == -1) {
+        i32 oldSize = interestRegions.actorArraySize;
+        interestRegions.actorArraySize = MAX(2 * oldSize, 64);
+        interestRegions.actorRegions = realloc(interestRegions.actorRegions, interestRegions.actorArraySize * sizeof *interestRegions.actorRegions);
+        for (i32 index = interestRegions.actorArraySize - 1; index >= oldSize; index--) {
+            // NOTE(traks): free actors link to the next free actor
+            interestRegions.actorRegions[index] = interestRegions.freeActor;
+            interestRegions.freeActor = index;
         }
     }
+
+    i32 actorIndex = interestRegions.freeActor;
+    i32 * regionIndex = interestRegions.actorRegions + actorIndex;
+    interestRegions.freeActor = *regionIndex;
+    *regionIndex = -1;
+    SwitchInterestRegion(regionIndex, &region, priority);
+    return actorIndex + 1;
 }
 
-void TickChunkLoader(void) {
-    i32 maxRemainingChunkUpdates = 64;
-    while (updateRequests.useCount > 0 && maxRemainingChunkUpdates > 0) {
-        ChunkHashEntry * entry = PopUpdateRequest();
-        UpdateChunk(entry);
-        maxRemainingChunkUpdates--;
-
-        // TODO(traks): Not ideal, but currently we need this because lighting
-        // chunks is very laggy
-        if (NanoTime() >= serv->currentTickStartNanos + 40000000LL) {
-            break;
-        }
+void MoveChunkInterest(ChunkInterestId id, ChunkRegion region) {
+    assert(id != 0);
+    i32 * regionIndex = interestRegions.actorRegions + (id - 1);
+    InterestRegion * current = interestRegions.entries + *regionIndex;
+    if (ChunkRegionEquals(current->region, region)) {
+        return;
     }
+    SwitchInterestRegion(regionIndex, &region, current->priority);
+}
 
-    if ((serv->current_tick % (10 * 20)) == 0) {
-        i64 blocksMemory = atomic_load_explicit(&sectionBlocksMemoryUsage, memory_order_relaxed);
-        i64 lightMemory = atomic_load_explicit(&sectionLightMemoryUsage, memory_order_relaxed);
-        LogInfo("Section memory usage: %.0fMB (blocks), %.0fMB (light)", blocksMemory / 1000000.0, lightMemory / 1000000.0);
+void ReleaseChunkInterest(ChunkInterestId id) {
+    if (id == 0) {
+        return;
     }
+    i32 actorIndex = id - 1;
+    i32 * regionIndex = interestRegions.actorRegions + actorIndex;
+    SwitchInterestRegion(regionIndex, NULL, interestRegions.entries[*regionIndex].priority);
+    *regionIndex = interestRegions.freeActor;
+    interestRegions.freeActor = actorIndex;
 }
 
-SectionBlocks CallocSectionBlocks() {
-    SectionBlocks res = {0};
-    i32 allocSize = 2 * 4096;
-    res.blockStates = calloc(1, allocSize);
-    atomic_fetch_add_explicit(&sectionBlocksMemoryUsage, allocSize, memory_order_relaxed);
+Chunk * GetChunkIfLoaded(WorldChunkPos pos) {
+    Chunk * res = GetChunkInternal(pos);
+    if (res != NULL && !(res->loaderFlags & CHUNK_LOADER_READY)) {
+        res = NULL;
+    }
     return res;
 }
 
-void FreeAndClearSectionBlocks(SectionBlocks * blocks) {
-    if (!SectionIsNull(blocks)) {
-        i32 allocSize = 2 * 4096;
-        atomic_fetch_add_explicit(&sectionBlocksMemoryUsage, -allocSize, memory_order_relaxed);
-        free(blocks->blockStates);
+Chunk * GetChunkInternal(WorldChunkPos pos) {
+    Chunk * res = NULL;
+    ChunkCluster * cluster = FindChunkCluster(GetClusterPos(pos));
+    if (cluster != NULL) {
+        res = cluster->chunks[GetIndexInCluster(pos)];
     }
-    *blocks = (SectionBlocks) {0};
+    return res;
 }
 
-void * CallocSectionLight() {
-    i32 size = 4096;
-    void * res = calloc(1, size);
-    atomic_fetch_add_explicit(&sectionLightMemoryUsage, size, memory_order_relaxed);
-    return res;
+void CollectChunksInternal(WorldChunkPos from, WorldChunkPos to, Chunk * * chunkArray) {
+    i32 jumpZ = to.x - from.x + 1;
+    for (i32 clusterZ = from.z >> CHUNK_CLUSTER_SHIFT; clusterZ <= to.z >> CHUNK_CLUSTER_SHIFT; clusterZ++) {
+        for (i32 clusterX = from.x >> CHUNK_CLUSTER_SHIFT; clusterX <= to.x >> CHUNK_CLUSTER_SHIFT; clusterX++) {
+            WorldChunkPos clusterPos = {.worldId = from.worldId, .x = clusterX, .z = clusterZ};
+            ChunkCluster * cluster = FindChunkCluster(PackWorldChunkPos(clusterPos));
+            i32 minX = MAX(from.x, clusterX << CHUNK_CLUSTER_SHIFT);
+            i32 maxX = MIN(to.x, (clusterX << CHUNK_CLUSTER_SHIFT) + CHUNK_CLUSTER_MASK);
+            i32 minZ = MAX(from.z, clusterZ << CHUNK_CLUSTER_SHIFT);
+            i32 maxZ = MIN(to.z, (clusterZ << CHUNK_CLUSTER_SHIFT) + CHUNK_CLUSTER_MASK);
+            for (i32 z = minZ; z <= maxZ; z++) {
+                for (i32 x = minX; x <= maxX; x++) {
+                    Chunk * chunk = NULL;
+                    if (cluster != NULL) {
+                        WorldChunkPos pos = {.worldId = from.worldId, .x = x, .z = z};
+                        chunk = cluster->chunks[GetIndexInCluster(pos)];
+                    }
+                    chunkArray[(z - from.z) * jumpZ + (x - from.x)] = chunk;
+                }
+            }
+        }
+    }
 }
 
-void FreeSectionLight(void * data) {
-    i32 size = 4096;
-    free(data);
-    if (data != NULL) {
-        atomic_fetch_add_explicit(&sectionLightMemoryUsage, -size, memory_order_relaxed);
+void CollectLoadedChunks(WorldChunkPos from, WorldChunkPos to, Chunk * * chunkArray) {
+    CollectChunksInternal(from, to, chunkArray);
+    i32 chunkCount = (to.x - from.x + 1) * (to.z - from.z + 1);
+    for (i32 chunkIndex = 0; chunkIndex < chunkCount; chunkIndex++) {
+        Chunk * chunk = chunkArray[chunkIndex];
+        if (chunk != NULL && !(chunk->loaderFlags & CHUNK_LOADER_READY)) {
+            chunkArray[chunkIndex] = NULL;
+        }
     }
 }
 
+static void ShareSectionBlocks(Chunk * target, Chunk * source, i32 sectionIndex) {
+    ChunkSection * targetSection = target->sections + sectionIndex;
+    ChunkSection * sourceSection = source->sections + sectionIndex;
+    FreeAndClearSectionBlocks(&targetSection->blocks);
+    targetSection->blocks = sourceSection->blocks;
+    targetSection->nonAirCount = sourceSection->nonAirCount;
+    if (!SectionIsNull(&sourceSection->blocks)) {
+        RetainSectionMemory(sourceSection->blocks.data);
+        source->sharedBlockSections |= (u32) 1 << sectionIndex;
+    }
+    // NOTE(traks): also mark null sections of mirror chunks, so we notice
+    // when they get changed
+    target->sharedBlockSections |= (u32) 1 << sectionIndex;
+}
+
+static void ShareSectionLight(u8 * * target, u8 * source) {
+    FreeSectionLight(*target);
+    *target = source;
+    if (!IsSharedSectionLight(source)) {
+        RetainSectionMemory(source);
+    }
+}
+
+// NOTE(traks): returns 1 if the chunk finished loading, 0 if we need to wait
+// for the template chunk
+static i32 CopyTemplateChunk(Chunk * chunk) {
+    MirrorWorld * mirror = mirrorWorlds + chunk->pos.worldId;
+    ChunkRegion * templateRegion = &mirror->templateRegion;
+    if (templateRegion->worldId == 0) {
+        // NOTE(traks): mirror world got destroyed
+        chunk->loaderFlags |= CHUNK_LOADER_FINISHED_LOAD;
+        return 1;
+    }
+
+    for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
+        LightSection * section = chunk->lightSections + sectionIndex;
+        if (section->skyLight == NULL) {
+            section->skyLight = GetUniformSectionLight(0);
+            section->blockLight = GetUniformSectionLight(0);
+        }
+    }
+
+    i32 x = chunk->pos.x;
+    i32 z = chunk->pos.z;
+    if (x < templateRegion->minX || x > templateRegion->maxX || z < templateRegion->minZ || z > templateRegion->maxZ) {
+        // NOTE(traks): empty chunk, light it like any other chunk. Still keep
+        // track of changes, so they can be reset
+        chunk->sharedBlockSections = ((u32) 1 << SECTIONS_PER_CHUNK) - 1;
+        chunk->loaderFlags |= CHUNK_LOADER_FINISHED_LOAD | CHUNK_LOADER_LOAD_SUCCESS;
+        return 1;
+    }
+
+    WorldChunkPos templatePos = {.worldId = templateRegion->worldId, .x = x, .z = z};
+    Chunk * templateChunk = GetChunkInternal(templatePos);
+    if (templateChunk == NULL || !(templateChunk->loaderFlags & CHUNK_LOADER_FULLY_LIT)) {
+        if (templateChunk != NULL && (templateChunk->loaderFlags & CHUNK_LOADER_FINISHED_LOAD)
+                && !(templateChunk->loaderFlags & CHUNK_LOADER_LOAD_SUCCESS)) {
+            chunk->loaderFlags |= CHUNK_LOADER_FINISHED_LOAD;
+            return 1;
+        }
+        return 0;
+    }
+
+    for (i32 sectionIndex = 0; sectionIndex < SECTIONS_PER_CHUNK; sectionIndex++) {
+        ShareSectionBlocks(chunk, templateChunk, sectionIndex);
+    }
+    for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
+        LightSection * section = chunk->lightSections + sectionIndex;
+        LightSection * templateSection = templateChunk->lightSections + sectionIndex;
+        ShareSectionLight(&section->skyLight, templateSection->skyLight);
+        ShareSectionLight(&section->blockLight, templateSection->blockLight);
+        if (!IsSharedSectionLight(templateSection->skyLight) || !IsSharedSectionLight(templateSection->blockLight)) {
+            chunk->sharedLightSections |= (u32) 1 << sectionIndex;
+            templateChunk->sharedLightSections |= (u32) 1 << sectionIndex;
+        }
+    }
+    memcpy(chunk->motion_blocking_height_map, templateChunk->motion_blocking_height_map, sizeof chunk->motion_blocking_height_map);
+    CopyChunkBlockEntities(chunk, templateChunk);
+
+    chunk->loaderFlags |= CHUNK_LOADER_FINISHED_LOAD | CHUNK_LOADER_LOAD_SUCCESS | CHUNK_LOADER_GOT_LIGHT;
+    return 1;
+}
+
+void SetTrustStoredLight(i32 worldId, i32 trust) {
+    assert(0 < worldId && worldId <= MAX_WORLD_ID);
+    trustStoredLight[worldId] = !!trust;
+}
+
+void CreateMirrorWorld(i32 worldId, ChunkRegion templateRegion) {
+    assert(0 < worldId && worldId <= MAX_WORLD_ID);
+    assert(templateRegion.worldId != 0 && templateRegion.worldId != worldId);
+    MirrorWorld * mirror = mirrorWorlds + worldId;
+    assert(mirror->templateRegion.worldId == 0);
+    *mirror = (MirrorWorld) {
+        .templateRegion = templateRegion,
+        .templateInterestId = RegisterChunkInterest(templateRegion, CHUNK_INTEREST_NORMAL),
+    };
+}
+
+void ResetMirrorWorld(i32 worldId) {
+    BeginTimings(ResetMirrorWorld);
+
+    MirrorWorld * mirror = mirrorWorlds + worldId;
+    assert(mirror->templateRegion.worldId != 0);
+
+    while (mirror->changedChunks != NULL) {
+        Chunk * chunk = mirror->changedChunks;
+        u32 changedSections = chunk->mirrorChangedSections;
+        RemoveMirrorChangedChunk(chunk);
+
+        ChunkRegion * templateRegion = &mirror->templateRegion;
+        i32 x = chunk->pos.x;
+        i32 z = chunk->pos.z;
+        if (templateRegion->minX <= x && x <= templateRegion->maxX && templateRegion->minZ <= z && z <= templateRegion->maxZ) {
+            WorldChunkPos templatePos = {.worldId = templateRegion->worldId, .x = x, .z = z};
+            Chunk * templateChunk = GetChunkInternal(templatePos);
+            // NOTE(traks): the template region is kept loaded
+            assert(templateChunk != NULL && (templateChunk->loaderFlags & CHUNK_LOADER_FULLY_LIT));
+            for (i32 sectionIndex = 0; sectionIndex < SECTIONS_PER_CHUNK; sectionIndex++) {
+                if (changedSections & ((u32) 1 << sectionIndex)) {
+                    ShareSectionBlocks(chunk, templateChunk, sectionIndex);
+                }
+            }
+            memcpy(chunk->motion_blocking_height_map, templateChunk->motion_blocking_height_map, sizeof chunk->motion_blocking_height_map);
+            CopyChunkBlockEntities(chunk, templateChunk);
+        } else {
+            // NOTE(traks): chunks outside of the template region are empty
+            for (i32 sectionIndex = 0; sectionIndex < SECTIONS_PER_CHUNK; sectionIndex++) {
+                if (changedSections & ((u32) 1 << sectionIndex)) {
+                    ChunkSection * section = chunk->sections + sectionIndex;
+                    FreeAndClearSectionBlocks(&section->blocks);
+                    section->nonAirCount = 0;
+                    chunk->sharedBlockSections |= (u32) 1 << sectionIndex;
+                }
+            }
+            ChunkRecalculateMotionBlockingHeightMap(chunk);
+            FreeChunkBlockEntities(chunk);
+        }
+        ChunkMarkChangedFully(chunk);
+    }
+
+    EndTimings(ResetMirrorWorld);
+}
+
+void DestroyMirrorWorld(i32 worldId) {
+    MirrorWorld * mirror = mirrorWorlds + worldId;
+    assert(mirror->templateRegion.worldId != 0);
+    ReleaseChunkInterest(mirror->templateInterestId);
+    while (mirror->changedChunks != NULL) {
+        RemoveMirrorChangedChunk(mirror->changedChunks);
+    }
+    *mirror = (MirrorWorld) {0};
+}
+
+static void DecodeChunkAsync(void * arg) {
+    ChunkDecodeTask * task = arg;
+    ChunkLoadBatch * batch = task->batch;
+    ChunkSectorRead * read = batch->reads + task->readIndex;
+    Chunk * chunk = read->chunk;
+
+    MemoryArena * scratchArena = BeginThreadScratch();
+
+    // NOTE(traks): the chunk doesn't have any light yet. Don't go through
+    // ClearChunkLight, we're not on the main thread
+    for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
+        LightSection * section = chunk->lightSections + sectionIndex;
+        section->skyLight = GetUniformSectionLight(0);
+        section->blockLight = GetUniformSectionLight(0);
+    }
+
+    WorldDecodeChunk(chunk, read->data, read->size, batch->loadLight, scratchArena);
+
+    EndThreadScratch(scratchArena);
+
+    atomic_fetch_or_explicit(&chunk->atomicFlags, CHUNK_ATOMIC_FINISHED_LOAD, memory_order_release);
+
+    if (atomic_fetch_sub_explicit(&batch->remainingDecodes, 1, memory_order_acq_rel) == 1) {
+        i32 readBufferCount = atomic_load_explicit(&batch->readBufferCount, memory_order_relaxed);
+        for (i32 bufferIndex = 0; bufferIndex < readBufferCount; bufferIndex++) {
+            FreeReadBuffer(batch->readBuffers[bufferIndex]);
+        }
+        if (batch->mappedRegion != NULL) {
+            ReleaseRegionFile(batch->mappedRegion);
+        }
+        free(batch);
+    }
+}
+
+static void DecodeChunkSectorsAsync(ChunkSectorRead * reads, i32 readCount, u8 * buffer, void * data) {
+    ChunkLoadBatch * batch = data;
+    if (buffer != NULL) {
+        i32 bufferIndex = atomic_fetch_add_explicit(&batch->readBufferCount, 1, memory_order_relaxed);
+        batch->readBuffers[bufferIndex] = buffer;
+    }
+
+    // NOTE(traks): careful, the batch may be freed once the last chunk has
+    // been decoded
+    for (i32 i = 0; i < readCount; i++) {
+        i32 readIndex = reads + i - batch->reads;
+        ChunkDecodeTask * task = batch->decodeTasks + readIndex;
+        *task = (ChunkDecodeTask) {.batch = batch, .readIndex = readIndex};
+        if (!PushPrioritisedTask(serv->backgroundQueue, batch->taskPriority, batch->deadlineTick, DecodeChunkAsync, task)) {
+            DecodeChunkAsync(task);
+        }
+    }
+}
+
+static void LoadChunkBatchAsync(void * arg) {
+    ChunkLoadBatch * batch = arg;
+    i32 chunkCount = batch->chunkCount;
+    atomic_store_explicit(&batch->remainingDecodes, chunkCount, memory_order_release);
+
+#ifdef MAP_REGION_FILES
+    batch->mappedRegion = WorldMapChunkSectors(batch->reads, chunkCount);
+#endif
+
+    if (batch->mappedRegion == NULL) {
+        if (asyncReads) {
+            // NOTE(traks): decode tasks are started as the reads complete
+            WorldReadChunkSectorsAsync(batch->reads, chunkCount, DecodeChunkSectorsAsync, batch);
+            return;
+        }
+
+        i32 readBufferCount = WorldReadChunkSectors(batch->reads, chunkCount, batch->readBuffers);
+        atomic_store_explicit(&batch->readBufferCount, readBufferCount, memory_order_release);
+    }
+
+    // NOTE(traks): decode the last chunk on this thread. Careful, the batch
+    // may be freed once the last chunk has been decoded
+    for (i32 readIndex = 0; readIndex < chunkCount; readIndex++) {
+        ChunkDecodeTask * task = batch->decodeTasks + readIndex;
+        *task = (ChunkDecodeTask) {.batch = batch, .readIndex = readIndex};
+        if (readIndex == chunkCount - 1 || !PushPrioritisedTask(serv->backgroundQueue, batch->taskPriority, batch->deadlineTick, DecodeChunkAsync, task)) {
+            DecodeChunkAsync(task);
+        }
+    }
+}
+
+// NOTE(traks): Players are waiting for normal loads. Speculative loads can
+// wait, but not forever
+static void GetLoadTaskPriority(i32 interestPriority, i32 * taskPriority, i64 * deadlineTick) {
+    *taskPriority = TASK_PRIORITY_CRITICAL;
+    *deadlineTick = TASK_NO_DEADLINE;
+    if (interestPriority == CHUNK_INTEREST_SPECULATIVE) {
+        *taskPriority = TASK_PRIORITY_BACKGROUND;
+        *deadlineTick = serv->current_tick + SPECULATIVE_LOAD_DEADLINE_TICKS;
+    }
+}
+
+static void AddChunkToLoadBatch(Chunk * chunk, i32 interestPriority) {
+    WorldChunkPos pos = chunk->pos;
+    ChunkLoadBatch * batch = NULL;
+    for (i32 batchIndex = 0; batchIndex < pendingLoadBatchCount; batchIndex++) {
+        WorldChunkPos batchPos = pendingLoadBatches[batchIndex]->reads[0].chunk->pos;
+        if (batchPos.worldId == pos.worldId && (batchPos.x >> 5) == (pos.x >> 5) && (batchPos.z >> 5) == (pos.z >> 5)) {
+            batch = pendingLoadBatches[batchIndex];
+            break;
+        }
+    }
+
+    if (batch == NULL) {
+        // NOTE(traks): there can't be more batches than chunk loads in flight
+        assert(pendingLoadBatchCount < (i32) ARRAY_SIZE(pendingLoadBatches));
+        batch = calloc(1, sizeof *batch);
+        if (batch == NULL) {
+            LogInfo("Failed to allocate chunk load batch");
+            exit(1);
+        }
+        batch->loadLight = trustStoredLight[pos.worldId];
+        batch->taskPriority = TASK_PRIORITY_COUNT;
+        batch->deadlineTick = TASK_NO_DEADLINE;
+        pendingLoadBatches[pendingLoadBatchCount] = batch;
+        pendingLoadBatchCount++;
+    }
+
+    i32 taskPriority;
+    i64 deadlineTick;
+    GetLoadTaskPriority(interestPriority, &taskPriority, &deadlineTick);
+    batch->taskPriority = MIN(batch->taskPriority, taskPriority);
+    batch->deadlineTick = MIN(batch->deadlineTick, deadlineTick);
+
+    assert(batch->chunkCount < (i32) ARRAY_SIZE(batch->reads));
+    batch->reads[batch->chunkCount] = (ChunkSectorRead) {.chunk = chunk};
+    batch->chunkCount++;
+}
+
+static void PushPendingLoadBatches(void) {
+    i32 keptCount = 0;
+    for (i32 batchIndex = 0; batchIndex < pendingLoadBatchCount; batchIndex++) {
+        ChunkLoadBatch * batch = pendingLoadBatches[batchIndex];
+        if (!PushPrioritisedTask(serv->backgroundQueue, batch->taskPriority, batch->deadlineTick, LoadChunkBatchAsync, batch)) {
+            // NOTE(traks): queue for this priority is full, try again next
+            // tick. Other priorities may still have room
+            pendingLoadBatches[keptCount] = batch;
+            keptCount++;
+        }
+    }
+    pendingLoadBatchCount = keptCount;
+}
+
+static void EvictWarmChunks(void) {
+    Chunk * chunk = warmChunks.head;
+    while (chunk != NULL && warmChunks.memoryUsage > WARM_CHUNK_MEMORY_BUDGET) {
+        Chunk * next = chunk->warmNext;
+        // NOTE(traks): can't free chunks with pending update requests. These
+        // will be evicted later
+        if (!(chunk->loaderFlags & CHUNK_LOADER_REQUESTING_UPDATE)) {
+            FreeChunk(chunk);
+        }
+        chunk = next;
+    }
+}
+
+// NOTE(traks): returns 1 if the chunk got lit, which is the expensive part
+static i32 UpdateChunk(Chunk * chunk) {
+    if (chunk->interestCount == 0 && chunk->neighbourInterestCount == 0) {
+        i32 chunkLoading = (chunk->loaderFlags & CHUNK_LOADER_STARTED_LOAD) && !(chunk->loaderFlags & CHUNK_LOADER_FINISHED_LOAD)
+                && !(chunk->loaderFlags & CHUNK_LOADER_MIRROR);
+
+        if (!chunkLoading) {
+            if (chunk->loaderFlags & CHUNK_LOADER_LIT_SELF) {
+                // NOTE(traks): all the hard work has been done, keep the chunk
+                // around in case someone wants it again
+                if (!(chunk->loaderFlags & CHUNK_LOADER_WARM)) {
+                    AddWarmChunk(chunk);
+                }
+                EvictWarmChunks();
+            } else {
+                FreeChunk(chunk);
+            }
+            return 0;
+        }
+
+        // NOTE(traks): can't unload, so try unloading later
+        PushUpdateRequest(chunk);
+    }
+
+    // NOTE(traks): chunk loads are started by the load scheduler
+
+    if ((chunk->loaderFlags & CHUNK_LOADER_MIRROR) && !(chunk->loaderFlags & CHUNK_LOADER_FINISHED_LOAD)) {
+        if (!CopyTemplateChunk(chunk)) {
+            // NOTE(traks): template chunk not ready yet, try again later
+            PushUpdateRequest(chunk);
+        } else if (!(chunk->loaderFlags & CHUNK_LOADER_LOAD_SUCCESS)) {
+            LogInfo("Failed to load chunk");
+        }
+    } else if ((chunk->loaderFlags & CHUNK_LOADER_SNAPSHOT) && !(chunk->loaderFlags & CHUNK_LOADER_FINISHED_LOAD)) {
+        u32 atomicFlags = atomic_load_explicit(&chunk->atomicFlags, memory_order_acquire);
+        if (atomicFlags & CHUNK_ATOMIC_FINISHED_LOAD) {
+            chunk->loaderFlags |= CHUNK_LOADER_FINISHED_LOAD;
+            if (atomicFlags & CHUNK_ATOMIC_LOAD_SUCCESS) {
+                // NOTE(traks): the chunk record was checked and read from disk
+                // in the background, so this only sets a few pointers
+                ClearChunkLight(chunk);
+                WorldLoadSnapshotChunk(chunk);
+                chunk->loaderFlags |= CHUNK_LOADER_LOAD_SUCCESS | CHUNK_LOADER_GOT_LIGHT;
+            } else {
+                LogInfo("Failed to load chunk");
+            }
+        } else {
+            // NOTE(traks): not yet checked, poll again later
+            PushUpdateRequest(chunk);
+        }
+    } else if ((chunk->loaderFlags & CHUNK_LOADER_STARTED_LOAD) && !(chunk->loaderFlags & CHUNK_LOADER_FINISHED_LOAD)) {
+        u32 atomicFlags = atomic_load_explicit(&chunk->atomicFlags, memory_order_acquire);
+        if (atomicFlags & CHUNK_ATOMIC_FINISHED_LOAD) {
+            chunk->loaderFlags |= CHUNK_LOADER_FINISHED_LOAD;
+            chunkLoadsInFlight--;
+            if (atomicFlags & CHUNK_ATOMIC_LOAD_SUCCESS) {
+                chunk->loaderFlags |= CHUNK_LOADER_LOAD_SUCCESS;
+                if (atomicFlags & CHUNK_ATOMIC_GOT_LIGHT) {
+                    chunk->loaderFlags |= CHUNK_LOADER_GOT_LIGHT;
+                }
+            } else {
+                // TODO(traks): what to do with the chunk??
+                LogInfo("Failed to load chunk");
+            }
+        } else {
+            // NOTE(traks): not yet loaded, poll again later
+            PushUpdateRequest(chunk);
+        }
+    }
+
+    i32 litChunk = 0;
+    if ((chunk->loaderFlags & CHUNK_LOADER_LOAD_SUCCESS) && !(chunk->loaderFlags & CHUNK_LOADER_LIT_SELF)) {
+        // NOTE(traks): light of mirror chunks comes from fully lit template
+        // chunks, and light of snapshots was baked together with the
+        // neighbours, no need to check that
+        if ((chunk->loaderFlags & CHUNK_LOADER_GOT_LIGHT) && !(chunk->loaderFlags & (CHUNK_LOADER_MIRROR | CHUNK_LOADER_SNAPSHOT))
+                && !LightMatchesNeighbours(chunk)) {
+            // NOTE(traks): The stored light doesn't match up with chunks that
+            // are already lit, e.g. because some neighbour was saved without
+            // light or at a different time. Light the chunk ourselves after
+            // all. Note that this can only add light to the neighbours, not
+            // remove light from them.
+            ClearChunkLight(chunk);
+            chunk->loaderFlags &= ~CHUNK_LOADER_GOT_LIGHT;
+        }
+        if (!(chunk->loaderFlags & CHUNK_LOADER_GOT_LIGHT)) {
+            LightChunkAndExchangeWithNeighbours(chunk);
+            litChunk = 1;
+        }
+        chunk->loaderFlags |= CHUNK_LOADER_LIT_SELF;
+        // NOTE(traks): Update neighbours and the chunk itself, to check if
+        // any are fully ready (fully lit by all neighbours)
+        Chunk * neighbours[3 * 3];
+        CollectChunkNeighbours(chunk->pos, neighbours);
+        for (i32 i = 0; i < 3 * 3; i++) {
+            if (neighbours[i] != NULL) {
+                PushUpdateRequest(neighbours[i]);
+            }
+        }
+    }
+
+    if ((chunk->loaderFlags & CHUNK_LOADER_LIT_SELF) && !(chunk->loaderFlags & CHUNK_LOADER_FULLY_LIT)) {
+        // NOTE(traks): check if all neighbours have been lit too
+        i32 allNeighboursLit = 1;
+        Chunk * neighbours[3 * 3];
+        CollectChunkNeighbours(chunk->pos, neighbours);
+        for (i32 i = 0; i < 3 * 3; i++) {
+            Chunk * neighbour = neighbours[i];
+            if (neighbour == NULL || !(neighbour->loaderFlags & CHUNK_LOADER_LIT_SELF)) {
+                allNeighboursLit = 0;
+                break;
+            }
+        }
+        if (allNeighboursLit) {
+            chunk->loaderFlags |= CHUNK_LOADER_FULLY_LIT;
+            // TODO(traks): Should we be marking chunks with no interest (only
+            // neighbour interest) also as ready?
+            chunk->loaderFlags |= CHUNK_LOADER_READY;
+            ResumeScheduledBlockUpdates(chunk);
+        }
+    }
+    return litChunk;
+}
+
+static void CheckSnapshotChunkAsync(void * arg) {
+    Chunk * chunk = arg;
+    u32 atomicFlags = CHUNK_ATOMIC_FINISHED_LOAD;
+    if (WorldCheckSnapshotChunk(chunk->pos)) {
+        atomicFlags |= CHUNK_ATOMIC_LOAD_SUCCESS;
+    }
+    atomic_fetch_or_explicit(&chunk->atomicFlags, atomicFlags, memory_order_release);
+}
+
+static void StartNextChunkLoad(InterestRegion * region, ChunkLoadSchedule * schedule) {
+    while (region->nextLoadRequest < region->loadRequestCount) {
+        ChunkLoadRequest * request = region->loadRequests + region->nextLoadRequest;
+        WorldChunkPos pos = {.worldId = region->region.worldId, .xz = request->pos};
+        Chunk * chunk = GetChunkInternal(pos);
+        if (chunk == NULL || (chunk->loaderFlags & CHUNK_LOADER_STARTED_LOAD)) {
+            // NOTE(traks): chunk got unloaded or another region got to it first
+            region->nextLoadRequest++;
+            continue;
+        }
+
+        if (mirrorWorlds[pos.worldId].templateRegion.worldId != 0) {
+            // NOTE(traks): nothing to read from disk, the chunk is copied from
+            // the template once the template chunk is ready
+            chunk->loaderFlags |= CHUNK_LOADER_STARTED_LOAD | CHUNK_LOADER_MIRROR;
+            PushUpdateRequest(chunk);
+            region->nextLoadRequest++;
+            continue;
+        }
+
+        if (WorldHasSnapshot(pos)) {
+            // NOTE(traks): The chunk record is checked in the background, so
+            // the main thread doesn't have to wait for the disk. Once that's
+            // done the chunk gets loaded when it's updated. Snapshot chunks
+            // are cheap and don't count towards the loads in flight, the task
+            // queue keeps them in check
+            WorldPrefetchSnapshotChunk(pos);
+            i32 taskPriority;
+            i64 deadlineTick;
+            GetLoadTaskPriority(schedule - loadSchedules, &taskPriority, &deadlineTick);
+            if (!PushPrioritisedTask(serv->backgroundQueue, taskPriority, deadlineTick, CheckSnapshotChunkAsync, chunk)) {
+                // NOTE(traks): queue is full, try again next tick
+                break;
+            }
+            chunk->loaderFlags |= CHUNK_LOADER_STARTED_LOAD | CHUNK_LOADER_SNAPSHOT;
+            warmChunks.misses++;
+            PushUpdateRequest(chunk);
+            region->nextLoadRequest++;
+            continue;
+        }
+
+        AddChunkToLoadBatch(chunk, schedule - loadSchedules);
+        chunk->loaderFlags |= CHUNK_LOADER_STARTED_LOAD;
+        chunkLoadsInFlight++;
+        warmChunks.misses++;
+        // NOTE(traks): poll until the load finishes
+        PushUpdateRequest(chunk);
+
+        i64 waitTicks = serv->current_tick - request->requestTick;
+        schedule->totalWaitTicks += waitTicks;
+        schedule->maxWaitTicks = MAX(schedule->maxWaitTicks, waitTicks);
+        schedule->startedLoads++;
+        region->nextLoadRequest++;
+        break;
+    }
+}
+
+static void ScheduleChunkLoads(void) {
+    for (i32 priority = 0; priority < CHUNK_INTEREST_PRIORITY_COUNT; priority++) {
+        ChunkLoadSchedule * schedule = loadSchedules + priority;
+        while (schedule->regionCount > 0) {
+            if (chunkLoadsInFlight >= MAX_CHUNK_LOADS_IN_FLIGHT) {
+                return;
+            }
+
+            // NOTE(traks): round robin through the regions
+            if (schedule->nextRegion >= schedule->regionCount) {
+                schedule->nextRegion = 0;
+            }
+            i32 regionIndex = schedule->regions[schedule->nextRegion];
+            InterestRegion * region = interestRegions.entries + regionIndex;
+            StartNextChunkLoad(region, schedule);
+
+            if (region->nextLoadRequest >= region->loadRequestCount) {
+                // NOTE(traks): this moves another region into the current
+                // slot, so don't advance
+                UnscheduleRegion(regionIndex);
+            } else {
+                schedule->nextRegion++;
+            }
+        }
+    }
+}
+
+void TickChunkLoader(void) {
+    BeginTimings(ScheduleChunkLoads);
+    ScheduleChunkLoads();
+    PushPendingLoadBatches();
+    EndTimings(ScheduleChunkLoads);
+
+    // NOTE(traks): only updates that light chunks count, the others are cheap
+    i32 maxRemainingChunkUpdates = 64;
+    for (i32 priority = 0; priority < CHUNK_INTEREST_PRIORITY_COUNT; priority++) {
+        ChunkUpdateRequestList * requests = updateRequests + priority;
+        // NOTE(traks): updating chunks can push new requests to the list, don't
+        // keep going forever
+        u32 maxRequests = requests->useCount;
+        for (u32 i = 0; i < maxRequests && maxRemainingChunkUpdates > 0; i++) {
+            Chunk * chunk = PopUpdateRequest(requests);
+            if (UpdateChunk(chunk)) {
+                maxRemainingChunkUpdates--;
+            }
+
+            // TODO(traks): Not ideal, but currently we need this because
+            // lighting chunks is very laggy
+            if (NanoTime() >= serv->currentTickStartNanos + 40000000LL) {
+                goto updatesDone;
+            }
+        }
+    }
+updatesDone:
+
+    if ((serv->current_tick % (10 * 20)) == 0) {
+        i64 blocksMemory = atomic_load_explicit(&sectionBlocksMemoryUsage, memory_order_relaxed);
+        i64 lightMemory = atomic_load_explicit(&sectionLightMemoryUsage, memory_order_relaxed);
+        i64 mappedMemory = atomic_load_explicit(&sectionLightSlab.mappedBytes, memory_order_relaxed);
+        for (i32 slabIndex = 0; slabIndex < (i32) ARRAY_SIZE(sectionBlocksSlabs); slabIndex++) {
+            mappedMemory += atomic_load_explicit(&sectionBlocksSlabs[slabIndex].mappedBytes, memory_order_relaxed);
+        }
+
+        // NOTE(traks): average and max number of ticks load requests had to
+        // wait before their load started, and number of pending requests
+        // (including some that no longer need a load)
+        f64 averageWait[CHUNK_INTEREST_PRIORITY_COUNT];
+        i64 maxWait[CHUNK_INTEREST_PRIORITY_COUNT];
+        i64 pendingRequests[CHUNK_INTEREST_PRIORITY_COUNT];
+        for (i32 priority = 0; priority < CHUNK_INTEREST_PRIORITY_COUNT; priority++) {
+            ChunkLoadSchedule * schedule = loadSchedules + priority;
+            averageWait[priority] = (schedule->startedLoads > 0 ? (f64) schedule->totalWaitTicks / schedule->startedLoads : 0);
+            maxWait[priority] = schedule->maxWaitTicks;
+            pendingRequests[priority] = 0;
+            for (i32 i = 0; i < schedule->regionCount; i++) {
+                InterestRegion * region = interestRegions.entries + schedule->regions[i];
+                pendingRequests[priority] += region->loadRequestCount - region->nextLoadRequest;
+            }
+            schedule->totalWaitTicks = 0;
+            schedule->maxWaitTicks = 0;
+            schedule->startedLoads = 0;
+        }
+
+        LogInfo("Section memory usage: %.0fMB (blocks), %.0fMB (light), %.0fMB (slabs mapped); chunk loads: %d in flight, %lld/%lld queued, waited %.1f/%.1f ticks (max %lld/%lld) (normal/speculative); warm chunks: %d (%.0fMB), %lld hits, %lld misses",
+                blocksMemory / 1000000.0, lightMemory / 1000000.0, mappedMemory / 1000000.0,
+                (int) chunkLoadsInFlight,
+                (long long) pendingRequests[CHUNK_INTEREST_NORMAL], (long long) pendingRequests[CHUNK_INTEREST_SPECULATIVE],
+                averageWait[CHUNK_INTEREST_NORMAL], averageWait[CHUNK_INTEREST_SPECULATIVE],
+                (long long) maxWait[CHUNK_INTEREST_NORMAL], (long long) maxWait[CHUNK_INTEREST_SPECULATIVE],
+                (int) warmChunks.chunkCount, warmChunks.memoryUsage / 1000000.0,
+                (long long) warmChunks.hits, (long long) warmChunks.misses);
+
+        // NOTE(traks): per thread, so we know how much memory chunk decoding
+        // really needs
+        i64 highWaterMarks[64];
+        i32 scratchCount = GetThreadScratchHighWaterMarks(highWaterMarks, ARRAY_SIZE(highWaterMarks));
+        if (scratchCount > 0) {
+            char marks[64 * 12] = {0};
+            i32 marksSize = 0;
+            for (i32 i = 0; i < scratchCount; i++) {
+                i32 written = snprintf(marks + marksSize, sizeof marks - marksSize, "%s%.1fMB", i > 0 ? ", " : "", highWaterMarks[i] / 1000000.0);
+                if (written < 0 || written >= (i32) sizeof marks - marksSize) {
+                    // NOTE(traks): out of space, the output got cut off
+                    break;
+                }
+                marksSize += written;
+            }
+            LogInfo("Scratch arena high water marks: %s", marks);
+        }
+    }
+}
+
+// NOTE(traks): whether the chunk's light won't change anymore, i.e. whether the
+// chunk and all its neighbours that could be loaded have been lit
+static i32 IsChunkSettled(Chunk * chunk) {
+    if (chunk == NULL || !(chunk->loaderFlags & CHUNK_LOADER_FINISHED_LOAD)) {
+        return 0;
+    }
+    if (!(chunk->loaderFlags & CHUNK_LOADER_LOAD_SUCCESS)) {
+        return 1;
+    }
+    Chunk * neighbours[3 * 3];
+    CollectChunkNeighbours(chunk->pos, neighbours);
+    for (i32 i = 0; i < 3 * 3; i++) {
+        Chunk * neighbour = neighbours[i];
+        if (neighbour == NULL || !(neighbour->loaderFlags & CHUNK_LOADER_FINISHED_LOAD)) {
+            return 0;
+        }
+        if ((neighbour->loaderFlags & CHUNK_LOADER_LOAD_SUCCESS) && !(neighbour->loaderFlags & CHUNK_LOADER_LIT_SELF)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void BakeWorldSnapshots(void) {
+    DIR * dir = opendir("world/region");
+    if (dir == NULL) {
+        LogErrno("Failed to open region directory: %s");
+        return;
+    }
+    if (mkdir("world/snapshot", 0755) && errno != EEXIST) {
+        LogErrno("Failed to create snapshot directory: %s");
+        closedir(dir);
+        return;
+    }
+
+    Chunk * * chunks = malloc(REGION_CHUNKS * sizeof *chunks);
+    i64 startTime = NanoTime();
+    i32 regionCount = 0;
+    i32 chunkCount = 0;
+
+    struct dirent * entry;
+    while ((entry = readdir(dir)) != NULL) {
+        i32 regionX;
+        i32 regionZ;
+        char suffix;
+        if (sscanf(entry->d_name, "r.%d.%d.mca%c", &regionX, &regionZ, &suffix) != 2) {
+            continue;
+        }
+
+        // NOTE(traks): let the chunk system load and light the chunks like it
+        // normally would, so the snapshot holds exactly what we'd compute
+        // ourselves
+        ChunkRegion region = {
+            .worldId = 1,
+            .minX = regionX << 5,
+            .minZ = regionZ << 5,
+            .maxX = (regionX << 5) + 31,
+            .maxZ = (regionZ << 5) + 31,
+        };
+        WorldChunkPos from = {.worldId = 1, .x = region.minX, .z = region.minZ};
+        WorldChunkPos to = {.worldId = 1, .x = region.maxX, .z = region.maxZ};
+        ChunkInterestId interestId = RegisterChunkInterest(region, CHUNK_INTEREST_NORMAL);
+
+        for (;;) {
+            serv->tickArena->index = 0;
+            serv->currentTickStartNanos = NanoTime();
+            TickChunkSystem();
+            TickChunkLoader();
+            serv->current_tick++;
+
+            CollectChunksInternal(from, to, chunks);
+            i32 settled = 1;
+            for (i32 chunkIndex = 0; chunkIndex < REGION_CHUNKS; chunkIndex++) {
+                if (!IsChunkSettled(chunks[chunkIndex])) {
+                    settled = 0;
+                    break;
+                }
+            }
+            if (settled) {
+                break;
+            }
+            struct timespec sleepTime = {.tv_nsec = 1000000};
+            nanosleep(&sleepTime, NULL);
+        }
+
+        i32 storedCount = 0;
+        for (i32 chunkIndex = 0; chunkIndex < REGION_CHUNKS; chunkIndex++) {
+            if (!(chunks[chunkIndex]->loaderFlags & CHUNK_LOADER_LOAD_SUCCESS)) {
+                chunks[chunkIndex] = NULL;
+            } else {
+                storedCount++;
+            }
+        }
+        if (storedCount > 0 && WorldWriteSnapshotRegion(regionX, regionZ, chunks)) {
+            regionCount++;
+            chunkCount += storedCount;
+        }
+
+        // NOTE(traks): chunks bordering the next region stay around as warm
+        // chunks for a bit
+        ReleaseChunkInterest(interestId);
+    }
+    closedir(dir);
+    free(chunks);
+
+    LogInfo("Baked world snapshots of %d regions with %d chunks in %.1fs", regionCount, chunkCount, (NanoTime() - startTime) / 1e9);
+}
+
+static SlabAllocator * GetSectionBlocksSlab(i32 bitsPerEntry) {
+    switch (bitsPerEntry) {
+    case 4: return sectionBlocksSlabs + 0;
+    case 8: return sectionBlocksSlabs + 1;
+    default: return sectionBlocksSlabs + 2;
+    }
+}
+
+void * MallocSectionBlocks(i32 bitsPerEntry) {
+    i32 allocSize = SectionBlocksAllocSize(bitsPerEntry);
+    void * res = SlabAlloc(GetSectionBlocksSlab(bitsPerEntry));
+    atomic_fetch_add_explicit(&sectionBlocksMemoryUsage, allocSize, memory_order_relaxed);
+    return res;
+}
+
+void FreeSectionBlocks(void * data, i32 bitsPerEntry) {
+    if (data != NULL && ReleaseSectionMemory(data)) {
+        i32 allocSize = SectionBlocksAllocSize(bitsPerEntry);
+        atomic_fetch_add_explicit(&sectionBlocksMemoryUsage, -allocSize, memory_order_relaxed);
+        SlabFree(GetSectionBlocksSlab(bitsPerEntry), data);
+    }
+}
+
+void FreeAndClearSectionBlocks(SectionBlocks * blocks) {
+    FreeSectionBlocks(blocks->data, blocks->bitsPerEntry);
+    *blocks = (SectionBlocks) {0};
+}
+
+u8 * MallocSectionLight(void) {
+    i32 size = SECTION_LIGHT_SIZE;
+    u8 * res = SlabAlloc(&sectionLightSlab);
+    atomic_fetch_add_explicit(&sectionLightMemoryUsage, size, memory_order_relaxed);
+    return res;
+}
+
+void FreeSectionLight(u8 * data) {
+    i32 size = SECTION_LIGHT_SIZE;
+    if (data != NULL && !IsSharedSectionLight(data) && ReleaseSectionMemory(data)) {
+        SlabFree(&sectionLightSlab, data);
+        atomic_fetch_add_explicit(&sectionLightMemoryUsage, -size, memory_order_relaxed);
+    }
+}
+
+u8 * UnshareSectionLight(u8 * * lightArray) {
+    u8 * res = *lightArray;
+    if (IsSharedSectionLight(res) || IsSectionMemoryShared(res)) {
+        res = MallocSectionLight();
+        memcpy(res, *lightArray, SECTION_LIGHT_SIZE);
+        // NOTE(traks): drops our reference if the memory was shared with
+        // other chunks
+        FreeSectionLight(*lightArray);
+        *lightArray = res;
+    }
+    return res;
+}
+
+void UnshareChunkBlockSection(Chunk * chunk, i32 sectionIndex) {
+    SectionBlocks * blocks = &chunk->sections[sectionIndex].blocks;
+    if (blocks->data != NULL && IsSectionMemoryShared(blocks->data)) {
+        u8 * oldData = blocks->data;
+        u8 * newData = MallocSectionBlocks(blocks->bitsPerEntry);
+        memcpy(newData, oldData, SectionBlocksAllocSize(blocks->bitsPerEntry));
+        if (blocks->palette != NULL) {
+            blocks->palette = (u16 *) (newData + ((u8 *) blocks->palette - oldData));
+            blocks->paletteCounts = (u16 *) (newData + ((u8 *) blocks->paletteCounts - oldData));
+        }
+        blocks->data = newData;
+        FreeSectionBlocks(oldData, blocks->bitsPerEntry);
+    }
+    chunk->sharedBlockSections &= ~((u32) 1 << sectionIndex);
+
+    if (chunk->loaderFlags & CHUNK_LOADER_MIRROR) {
+        if (chunk->mirrorChangedSections == 0) {
+            AddMirrorChangedChunk(chunk);
+        }
+        chunk->mirrorChangedSections |= (u32) 1 << sectionIndex;
+    }
+}
+
+void ClearChunkLight(Chunk * chunk) {
+    for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
+        LightSection * section = chunk->lightSections + sectionIndex;
+        FreeSectionLight(section->skyLight);
+        FreeSectionLight(section->blockLight);
+        section->skyLight = GetUniformSectionLight(0);
+        section->blockLight = GetUniformSectionLight(0);
+    }
+    chunk->sharedLightSections = 0;
+}
+
+void UnshareChunkLight(Chunk * chunk) {
+    for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
+        if (chunk->sharedLightSections & ((u32) 1 << sectionIndex)) {
+            LightSection * section = chunk->lightSections + sectionIndex;
+            if (IsSectionMemoryShared(section->skyLight)) {
+                UnshareSectionLight(&section->skyLight);
+            }
+            if (IsSectionMemoryShared(section->blockLight)) {
+                UnshareSectionLight(&section->blockLight);
+            }
+        }
+    }
+    chunk->sharedLightSections = 0;
+}
+
+// NOTE(traks): returns the light value if all light values are equal, or -1
+// otherwise
+static i32 GetUniformLightValue(u8 * light) {
+    u64 first;
+    memcpy(&first, light, 8);
+    if ((first & 0xf) != ((first >> 4) & 0xf)) {
+        return -1;
+    }
+    // NOTE(traks): all nibbles equal means all bytes equal to the first byte
+    if (first != (first & 0xff) * 0x0101010101010101ULL) {
+        return -1;
+    }
+    for (i32 i = 8; i < SECTION_LIGHT_SIZE; i += 8) {
+        u64 next;
+        memcpy(&next, light + i, 8);
+        if (next != first) {
+            return -1;
+        }
+    }
+    return first & 0xf;
+}
+
+void CompactSectionLight(u8 * * lightArray) {
+    u8 * light = *lightArray;
+    if (IsSharedSectionLight(light)) {
+        return;
+    }
+    i32 value = GetUniformLightValue(light);
+    if (value != -1) {
+        *lightArray = GetUniformSectionLight(value);
+        FreeSectionLight(light);
+    }
+}
+
+void FreeDecodedSectionLight(u8 * data) {
+    if (data != NULL && !IsSharedSectionLight(data)) {
+        SlabFree(&sectionLightSlab, data);
+        atomic_fetch_add_explicit(&sectionLightMemoryUsage, -SECTION_LIGHT_SIZE, memory_order_relaxed);
+    }
+}
+
+u8 * UnshareDecodedSectionLight(u8 * * lightArray) {
+    u8 * res = *lightArray;
+    if (IsSharedSectionLight(res)) {
+        res = MallocSectionLight();
+        memcpy(res, *lightArray, SECTION_LIGHT_SIZE);
+        *lightArray = res;
+    }
+    return res;
+}
+
+void CompactDecodedSectionLight(u8 * * lightArray) {
+    u8 * light = *lightArray;
+    if (IsSharedSectionLight(light)) {
+        return;
+    }
+    i32 value = GetUniformLightValue(light);
+    if (value != -1) {
+        *lightArray = GetUniformSectionLight(value);
+        FreeDecodedSectionLight(light);
+    }
+}
+
+#ifdef MEASURE_CHUNK_INDEX
+typedef struct {
+    PackedWorldChunkPos packedPos;
+    Chunk * chunk;
+} PerChunkIndexEntry;
+
+static Chunk * GetChunkFromPerChunkIndex(PerChunkIndexEntry * entries, u32 sizeMask, WorldChunkPos pos) {
+    PackedWorldChunkPos packedPos = PackWorldChunkPos(pos);
+    for (u32 index = HashU64(packedPos.packed); ; index++) {
+        PerChunkIndexEntry * entry = entries + (index & sizeMask);
+        if (entry->packedPos.packed == packedPos.packed) {
+            return entry->chunk;
+        }
+        if (entry->packedPos.packed == 0) {
+            return NULL;
+        }
+    }
+}
+
+static void MeasureChunkIndex(void) {
+    // NOTE(traks): a bunch of worlds with a 64x64 area of chunks loaded, like
+    // a few hundred players spread out in each world
+    i32 worldCount = 4;
+    i32 diam = 64;
+    i32 chunkCount = worldCount * diam * diam;
+    u32 perChunkSize = 1;
+    while (perChunkSize < 2 * (u32) chunkCount) {
+        perChunkSize *= 2;
+    }
+    PerChunkIndexEntry * perChunkEntries = calloc(perChunkSize, sizeof *perChunkEntries);
+
+    for (i32 worldId = 1; worldId <= worldCount; worldId++) {
+        for (i32 x = -diam / 2; x < diam / 2; x++) {
+            for (i32 z = -diam / 2; z < diam / 2; z++) {
+                WorldChunkPos pos = {.worldId = worldId, .x = x, .z = z};
+                Chunk * chunk = GetOrCreateChunk(pos);
+                PackedWorldChunkPos packedPos = PackWorldChunkPos(pos);
+                for (u32 index = HashU64(packedPos.packed); ; index++) {
+                    PerChunkIndexEntry * entry = perChunkEntries + (index & (perChunkSize - 1));
+                    if (entry->packedPos.packed == 0) {
+                        *entry = (PerChunkIndexEntry) {.packedPos = packedPos, .chunk = chunk};
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // NOTE(traks): look up random chunks in and a bit outside the loaded area
+    i32 lookupCount = 1 << 22;
+    WorldChunkPos * lookups = malloc(lookupCount * sizeof *lookups);
+    u32 random = 0x12345678;
+    for (i32 i = 0; i < lookupCount; i++) {
+        random = random * 1664525 + 1013904223;
+        lookups[i] = (WorldChunkPos) {
+            .worldId = 1 + (random >> 8) % worldCount,
+            .x = (i32) ((random >> 12) % (diam + 8)) - diam / 2 - 4,
+            .z = (i32) ((random >> 22) % (diam + 8)) - diam / 2 - 4,
+        };
+    }
+
+    uintptr_t sink = 0;
+    i64 startTime = NanoTime();
+    for (i32 i = 0; i < lookupCount; i++) {
+        sink += (uintptr_t) GetChunkFromPerChunkIndex(perChunkEntries, perChunkSize - 1, lookups[i]);
+    }
+    i64 perChunkTime = NanoTime() - startTime;
+
+    startTime = NanoTime();
+    for (i32 i = 0; i < lookupCount; i++) {
+        sink += (uintptr_t) GetChunkInternal(lookups[i]);
+    }
+    i64 clusterTime = NanoTime() - startTime;
+
+    i32 neighbourhoodCount = lookupCount / 9;
+    startTime = NanoTime();
+    for (i32 i = 0; i < neighbourhoodCount; i++) {
+        for (i32 dz = -1; dz <= 1; dz++) {
+            for (i32 dx = -1; dx <= 1; dx++) {
+                WorldChunkPos pos = lookups[i];
+                pos.x += dx;
+                pos.z += dz;
+                sink += (uintptr_t) GetChunkFromPerChunkIndex(perChunkEntries, perChunkSize - 1, pos);
+            }
+        }
+    }
+    i64 perChunkNeighbourTime = NanoTime() - startTime;
+
+    startTime = NanoTime();
+    for (i32 i = 0; i < neighbourhoodCount; i++) {
+        Chunk * neighbours[3 * 3];
+        CollectChunkNeighbours(lookups[i], neighbours);
+        for (i32 j = 0; j < 3 * 3; j++) {
+            sink += (uintptr_t) neighbours[j];
+        }
+    }
+    i64 clusterNeighbourTime = NanoTime() - startTime;
+
+    LogInfo("Chunk index lookups: %.1fM/s per chunk index, %.1fM/s cluster index; 3x3 lookups: %.1fM/s per chunk index, %.1fM/s cluster index (%d)",
+            lookupCount / (perChunkTime / 1000.0), lookupCount / (clusterTime / 1000.0),
+            neighbourhoodCount / (perChunkNeighbourTime / 1000.0), neighbourhoodCount / (clusterNeighbourTime / 1000.0),
+            (int) (sink & 1));
+
+    for (i32 i = 0; i < chunkIndex.arraySize; i++) {
+        ChunkCluster * cluster = chunkIndex.entries + i;
+        for (i32 j = 0; j < (i32) ARRAY_SIZE(cluster->chunks); j++) {
+            free(cluster->chunks[j]);
+        }
+    }
+    free(chunkIndex.entries);
+    chunkIndex = (ChunkClusterMap) {0};
+    free(perChunkEntries);
+    free(lookups);
+}
+#endif
+
+#ifdef MEASURE_REGION_READS
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <time.h>
+
+enum {
+    REGION_READ_BLOCKING,
+    REGION_READ_ASYNC,
+    REGION_READ_MAPPED,
+};
+
+typedef struct {
+    i64 time;
+    _Atomic i64 readCount;
+    _Atomic i64 bytesRead;
+    _Atomic i32 chunksDone;
+    u32 sink;
+} RegionReadStats;
+
+static void CountAsyncChunkReads(ChunkSectorRead * reads, i32 readCount, u8 * buffer, void * data) {
+    RegionReadStats * stats = data;
+    for (i32 readIndex = 0; readIndex < readCount; readIndex++) {
+        atomic_fetch_add_explicit(&stats->bytesRead, reads[readIndex].size, memory_order_relaxed);
+    }
+    if (buffer != NULL) {
+        atomic_fetch_add_explicit(&stats->readCount, 1, memory_order_relaxed);
+        FreeReadBuffer(buffer);
+    }
+    atomic_fetch_add_explicit(&stats->chunksDone, readCount, memory_order_release);
+}
+
+static void ReadRegionChunks(i32 regionX, i32 regionZ, i32 batchSize, i32 mode, RegionReadStats * stats) {
+    RegionFile * region = AcquireRegionFile(1, regionX, regionZ);
+    u32 locations[REGION_CHUNKS];
+    memcpy(locations, region->locations, sizeof locations);
+    // NOTE(traks): evict the region file from the page cache
+    if (region->fd != -1) {
+        posix_fadvise(region->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    ReleaseRegionFile(region);
+
+    // NOTE(traks): chunks aren't requested in the order they're stored, and
+    // reading in storage order would let the kernel's readahead merge the
+    // separate reads for us
+    i32 storedIndices[REGION_CHUNKS];
+    i32 storedCount = 0;
+    for (i32 index = 0; index < REGION_CHUNKS; index++) {
+        if (locations[index] != 0) {
+            storedIndices[storedCount] = index;
+            storedCount++;
+        }
+    }
+    u32 random = 0x12345678;
+    for (i32 i = storedCount - 1; i > 0; i--) {
+        random = random * 1664525 + 1013904223;
+        i32 j = (random >> 8) % (i + 1);
+        i32 swap = storedIndices[i];
+        storedIndices[i] = storedIndices[j];
+        storedIndices[j] = swap;
+    }
+
+    Chunk * chunks = calloc(REGION_CHUNKS, sizeof *chunks);
+    ChunkSectorRead * reads = calloc(REGION_CHUNKS, sizeof *reads);
+    u8 * readBuffers[MAX_CHUNK_LOADS_IN_FLIGHT];
+    for (i32 readIndex = 0; readIndex < storedCount; readIndex++) {
+        i32 index = storedIndices[readIndex];
+        chunks[readIndex].pos = (WorldChunkPos) {.worldId = 1, .x = (regionX << 5) | (index & 0x1f), .z = (regionZ << 5) | (index >> 5)};
+        reads[readIndex] = (ChunkSectorRead) {.chunk = chunks + readIndex};
+    }
+
+    i64 startTime = NanoTime();
+    atomic_store_explicit(&stats->chunksDone, 0, memory_order_relaxed);
+    for (i32 start = 0; start < storedCount; start += batchSize) {
+        i32 chunkCount = MIN(batchSize, storedCount - start);
+        if (mode == REGION_READ_ASYNC) {
+            WorldReadChunkSectorsAsync(reads + start, chunkCount, CountAsyncChunkReads, stats);
+            continue;
+        }
+        if (mode == REGION_READ_MAPPED) {
+            RegionFile * mappedRegion = WorldMapChunkSectors(reads + start, chunkCount);
+            if (mappedRegion != NULL) {
+                // NOTE(traks): touch every page, like inflating would
+                for (i32 readIndex = start; readIndex < start + chunkCount; readIndex++) {
+                    for (i32 offset = 0; offset < reads[readIndex].size; offset += 4096) {
+                        stats->sink += reads[readIndex].data[offset];
+                    }
+                    stats->bytesRead += reads[readIndex].size;
+                }
+                ReleaseRegionFile(mappedRegion);
+            }
+            continue;
+        }
+
+        i32 readBufferCount = WorldReadChunkSectors(reads + start, chunkCount, readBuffers);
+        stats->readCount += readBufferCount;
+        for (i32 readIndex = start; readIndex < start + chunkCount; readIndex++) {
+            stats->bytesRead += reads[readIndex].size;
+        }
+        for (i32 bufferIndex = 0; bufferIndex < readBufferCount; bufferIndex++) {
+            FreeReadBuffer(readBuffers[bufferIndex]);
+        }
+    }
+    if (mode == REGION_READ_ASYNC) {
+        while (atomic_load_explicit(&stats->chunksDone, memory_order_acquire) < storedCount) {
+            struct timespec sleepTime = {.tv_nsec = 100000};
+            nanosleep(&sleepTime, NULL);
+        }
+    }
+    stats->time += NanoTime() - startTime;
+
+    free(chunks);
+    free(reads);
+}
+
+static void MeasureRegionReads(void) {
+    DIR * dir = opendir("world/region");
+    if (dir == NULL) {
+        LogErrno("Failed to open region directory: %s");
+        return;
+    }
+
+    RegionReadStats separate = {0};
+    RegionReadStats merged = {0};
+    RegionReadStats async = {0};
+    RegionReadStats mapped = {0};
+    i32 regionCount = 0;
+
+    struct dirent * entry;
+    while ((entry = readdir(dir)) != NULL) {
+        i32 regionX;
+        i32 regionZ;
+        if (sscanf(entry->d_name, "r.%d.%d.mca", &regionX, &regionZ) != 2) {
+            continue;
+        }
+        regionCount++;
+
+        ReadRegionChunks(regionX, regionZ, 1, REGION_READ_BLOCKING, &separate);
+        ReadRegionChunks(regionX, regionZ, MAX_CHUNK_LOADS_IN_FLIGHT, REGION_READ_BLOCKING, &merged);
+        if (asyncReads) {
+            ReadRegionChunks(regionX, regionZ, MAX_CHUNK_LOADS_IN_FLIGHT, REGION_READ_ASYNC, &async);
+        }
+        ReadRegionChunks(regionX, regionZ, MAX_CHUNK_LOADS_IN_FLIGHT, REGION_READ_MAPPED, &mapped);
+    }
+    closedir(dir);
+
+    LogInfo("Region reads (%d regions, cold page cache): separate %lld reads, %.1fMB in %.1fms; merged %lld reads, %.1fMB in %.1fms; io_uring %lld reads, %.1fMB in %.1fms; mapped %.1fMB in %.1fms (%d)",
+            regionCount,
+            (long long) separate.readCount, separate.bytesRead / 1000000.0, separate.time / 1000000.0,
+            (long long) merged.readCount, merged.bytesRead / 1000000.0, merged.time / 1000000.0,
+            (long long) async.readCount, async.bytesRead / 1000000.0, async.time / 1000000.0,
+            mapped.bytesRead / 1000000.0, mapped.time / 1000000.0, (int) (mapped.sink & 1));
+}
+#endif
+
+#ifdef MEASURE_INFLATE
+#include <dirent.h>
+#include <stdio.h>
+
+#define INFLATE_MEASURE_PASSES (5)
+
+typedef struct {
+    i64 time;
+    i64 bytesInflated;
+} InflateStats;
+
+static void InflateRegionChunks(i32 regionX, i32 regionZ, u8 * * outputs, i64 * compressedBytes, i32 * chunkCount, i32 * mismatches, InflateStats * zlibStats, InflateStats * singlePassStats) {
+    RegionFile * region = AcquireRegionFile(1, regionX, regionZ);
+    if (region->mapping == NULL) {
+        ReleaseRegionFile(region);
+        return;
+    }
+
+    i32 maxSize = 2 * (1 << 20);
+    for (i32 index = 0; index < REGION_CHUNKS; index++) {
+        u32 location = region->locations[index];
+        i64 offset = (i64) (location >> 8) << 12;
+        if (location == 0 || offset + 5 > region->fileSize) {
+            continue;
+        }
+        u8 * sectors = region->mapping + offset;
+        i32 size = ((u32) sectors[0] << 24) | ((u32) sectors[1] << 16) | ((u32) sectors[2] << 8) | sectors[3];
+        u8 storageType = sectors[4];
+        if (size < 1 || offset + 4 + size > region->fileSize) {
+            continue;
+        }
+        i32 format;
+        if (storageType == CHUNK_STORAGE_ZLIB) {
+            format = INFLATE_FORMAT_ZLIB;
+        } else if (storageType == CHUNK_STORAGE_GZIP) {
+            format = INFLATE_FORMAT_GZIP;
+        } else {
+            continue;
+        }
+        u8 * in = sectors + 5;
+        i32 inSize = size - 1;
+
+        // NOTE(traks): fault in the mapping and warm up both
+        i32 expectedSize = InflateWithZlib(in, inSize, outputs[0], maxSize, format);
+        InflateSinglePass(in, inSize, outputs[1], maxSize, format);
+
+        i64 startTime = NanoTime();
+        for (i32 pass = 0; pass < INFLATE_MEASURE_PASSES; pass++) {
+            zlibStats->bytesInflated += MAX(0, InflateWithZlib(in, inSize, outputs[0], maxSize, format));
+        }
+        i64 midTime = NanoTime();
+        i32 outSize = 0;
+        for (i32 pass = 0; pass < INFLATE_MEASURE_PASSES; pass++) {
+            outSize = InflateSinglePass(in, inSize, outputs[1], maxSize, format);
+            singlePassStats->bytesInflated += MAX(0, outSize);
+        }
+        i64 endTime = NanoTime();
+        zlibStats->time += midTime - startTime;
+        singlePassStats->time += endTime - midTime;
+
+        if (outSize != expectedSize || (outSize > 0 && memcmp(outputs[0], outputs[1], outSize) != 0)) {
+            (*mismatches)++;
+        }
+        *compressedBytes += inSize;
+        (*chunkCount)++;
+    }
+
+    ReleaseRegionFile(region);
+}
+
+static void MeasureInflate(void) {
+    DIR * dir = opendir("world/region");
+    if (dir == NULL) {
+        LogErrno("Failed to open region directory: %s");
+        return;
+    }
+
+    u8 * outputs[2] = {malloc(2 * (1 << 20)), malloc(2 * (1 << 20))};
+    i64 compressedBytes = 0;
+    i32 chunkCount = 0;
+    i32 mismatches = 0;
+    InflateStats zlibStats = {0};
+    InflateStats singlePassStats = {0};
+
+    struct dirent * entry;
+    while ((entry = readdir(dir)) != NULL) {
+        i32 regionX;
+        i32 regionZ;
+        if (sscanf(entry->d_name, "r.%d.%d.mca", &regionX, &regionZ) != 2) {
+            continue;
+        }
+        InflateRegionChunks(regionX, regionZ, outputs, &compressedBytes, &chunkCount, &mismatches, &zlibStats, &singlePassStats);
+    }
+    closedir(dir);
+    free(outputs[0]);
+    free(outputs[1]);
+
+    LogInfo("Inflate %d chunks (%.1fMB compressed, %d passes): zlib %.1fMB in %.1fms (%.0fMB/s); single pass %.1fMB in %.1fms (%.0fMB/s); mismatches %d",
+            chunkCount, compressedBytes / 1000000.0, INFLATE_MEASURE_PASSES,
+            zlibStats.bytesInflated / 1000000.0, zlibStats.time / 1000000.0, zlibStats.bytesInflated * 1000.0 / MAX(zlibStats.time, 1),
+            singlePassStats.bytesInflated / 1000000.0, singlePassStats.time / 1000000.0, singlePassStats.bytesInflated * 1000.0 / MAX(singlePassStats.time, 1),
+            mismatches);
+}
+#endif
+
+#ifdef CHECK_CHUNK_INTEREST
+static i32 CheckChunkInterestCounts(ChunkRegion * regions, i32 regionCount) {
+    i32 mismatches = 0;
+    for (i32 z = -16; z <= 16; z++) {
+        for (i32 x = -16; x <= 16; x++) {
+            i32 expectInterest = 0;
+            i32 expectNeighbour = 0;
+            for (i32 i = 0; i < regionCount; i++) {
+                i32 level = GetRegionInterestLevel(regions + i, 1, x, z);
+                expectInterest += (level == 2);
+                expectNeighbour += (level == 1);
+            }
+            Chunk * chunk = GetChunkInternal((WorldChunkPos) {.worldId = 1, .x = x, .z = z});
+            i32 interest = (chunk != NULL ? chunk->interestCount : 0);
+            i32 neighbour = (chunk != NULL ? chunk->neighbourInterestCount : 0);
+            if (interest != expectInterest || neighbour != expectNeighbour) {
+                mismatches++;
+            }
+        }
+    }
+    return mismatches;
+}
+
+static void CheckChunkInterest(void) {
+    // NOTE(traks): regions that aren't square or have an even size have a
+    // centre that isn't in the middle, so moving them exercises the clipping
+    // of the rings
+    ChunkRegion moves[] = {
+        {.worldId = 1, .minX = 0, .minZ = 0, .maxX = 10, .maxZ = 2},
+        {.worldId = 1, .minX = 0, .minZ = 3, .maxX = 10, .maxZ = 5},
+        {.worldId = 1, .minX = 2, .minZ = 1, .maxX = 7, .maxZ = 8},
+        {.worldId = 1, .minX = -3, .minZ = -3, .maxX = 4, .maxZ = 4},
+        {.worldId = 1, .minX = 5, .minZ = 5, .maxX = 5, .maxZ = 5},
+        {.worldId = 1, .minX = -12, .minZ = 0, .maxX = -11, .maxZ = 12},
+        {.worldId = 1, .minX = 0, .minZ = 0, .maxX = 1, .maxZ = 0},
+    };
+    // NOTE(traks): a second region that stays put, so some chunks are wanted
+    // by both
+    ChunkRegion regions[2] = {
+        {.worldId = 1, .minX = 1, .minZ = 1, .maxX = 6, .maxZ = 3},
+        moves[0],
+    };
+    ChunkInterestId fixedId = RegisterChunkInterest(regions[0], CHUNK_INTEREST_NORMAL);
+    ChunkInterestId movingId = RegisterChunkInterest(regions[1], CHUNK_INTEREST_NORMAL);
+    i32 mismatches = CheckChunkInterestCounts(regions, 2);
+    for (i32 i = 1; i < (i32) ARRAY_SIZE(moves); i++) {
+        regions[1] = moves[i];
+        MoveChunkInterest(movingId, regions[1]);
+        mismatches += CheckChunkInterestCounts(regions, 2);
+    }
+    ReleaseChunkInterest(movingId);
+    mismatches += CheckChunkInterestCounts(regions, 1);
+    ReleaseChunkInterest(fixedId);
+    mismatches += CheckChunkInterestCounts(regions, 0);
+
+    LogInfo("Chunk interest check: %d moves, %d mismatches", (i32) ARRAY_SIZE(moves), mismatches);
+
+    // NOTE(traks): none of the chunks got loaded, so we can simply drop them
+    for (i32 i = 0; i < chunkIndex.arraySize; i++) {
+        ChunkCluster * cluster = chunkIndex.entries + i;
+        for (i32 j = 0; j < (i32) ARRAY_SIZE(cluster->chunks); j++) {
+            free(cluster->chunks[j]);
+        }
+    }
+    free(chunkIndex.entries);
+    chunkIndex = (ChunkClusterMap) {0};
+    for (i32 priority = 0; priority < CHUNK_INTEREST_PRIORITY_COUNT; priority++) {
+        free(updateRequests[priority].entries);
+        updateRequests[priority] = (ChunkUpdateRequestList) {0};
+    }
+}
+#endif
+
+void InitChunkLoader(void) {
+    InitRegionCache();
+    asyncReads = InitAsyncReads();
+
+    InitSlabAllocator(sectionBlocksSlabs + 0, SectionBlocksAllocSize(4));
+    InitSlabAllocator(sectionBlocksSlabs + 1, SectionBlocksAllocSize(8));
+    InitSlabAllocator(sectionBlocksSlabs + 2, SectionBlocksAllocSize(16));
+    InitSlabAllocator(&sectionLightSlab, SECTION_LIGHT_SIZE);
+
+    for (i32 bucket = 0; bucket < (i32) ARRAY_SIZE(interestRegions.buckets); bucket++) {
+        interestRegions.buckets[bucket] = -1;
+    }
+    interestRegions.freeEntry = -1;
+    interestRegions.freeActor = -1;
+
+    void * uniformMem = mmap(NULL, 16 * SECTION_LIGHT_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (uniformMem == MAP_FAILED) {
+        LogInfo("Failed to map memory for shared light");
+        exit(1);
+    }
+    for (i32 value = 0; value < 16; value++) {
+        memset((u8 *) uniformMem + value * SECTION_LIGHT_SIZE, value | (value << 4), SECTION_LIGHT_SIZE);
+    }
+    // NOTE(traks): catch anyone writing to shared light
+    mprotect(uniformMem, 16 * SECTION_LIGHT_SIZE, PROT_READ);
+    uniformSectionLight = uniformMem;
+
+#ifdef MEASURE_CHUNK_INDEX
+    MeasureChunkIndex();
+#endif
+#ifdef MEASURE_REGION_READS
+    MeasureRegionReads();
+#endif
+#ifdef MEASURE_INFLATE
+    MeasureInflate();
+#endif
+#ifdef CHECK_CHUNK_INTEREST
+    CheckChunkInterest();
+#endif
+}
+
 #endif
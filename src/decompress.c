@@ -0,0 +1,856 @@
+#include <zlib.h>
+#include "decompress.h"
+
+// NOTE(traks): inflate with zlib instead of our own single pass decoder. Ours
+// needs the entire input and room for the entire output up front, which is
+// always the case for us, and doesn't pay for zlib's support for streaming
+// #define INFLATE_WITH_ZLIB
+
+static inline u32 ReadLittleEndianU32(u8 * data) {
+    return (u32) data[0] | ((u32) data[1] << 8) | ((u32) data[2] << 16) | ((u32) data[3] << 24);
+}
+
+#define LITLEN_TABLE_BITS (11)
+#define DIST_TABLE_BITS (8)
+#define CODELEN_TABLE_BITS (7)
+#define MAX_CODE_LENGTH (15)
+
+// NOTE(traks): Entries of the Huffman decode tables. The low 4 bits are the
+// length of the code, the next 4 bits the number of extra bits after the code,
+// followed by flags. The high 16 bits are the value: a literal byte, a base
+// length, a base distance or a code length symbol.
+#define HUFFMAN_LITERAL ((u32) 0x1 << 8)
+#define HUFFMAN_END_OF_BLOCK ((u32) 0x1 << 9)
+#define HUFFMAN_INVALID ((u32) 0x1 << 10)
+// NOTE(traks): the code is longer than the table bits and must be decoded the
+// slow way. Long codes are rare, because they're only given to rare symbols
+#define HUFFMAN_LONG_CODE ((u32) 0x1 << 11)
+
+enum {
+    HUFFMAN_LITLEN,
+    HUFFMAN_DIST,
+    HUFFMAN_CODELEN,
+};
+
+typedef struct {
+    u32 entries[1 << LITLEN_TABLE_BITS];
+    i32 tableBits;
+    i32 kind;
+    // NOTE(traks): number of codes per code length and the symbols sorted by
+    // code, for decoding long codes
+    u16 counts[MAX_CODE_LENGTH + 1];
+    u16 symbols[288];
+} HuffmanTable;
+
+typedef struct {
+    HuffmanTable litlen;
+    HuffmanTable dist;
+    HuffmanTable codelen;
+    HuffmanTable fixedLitlen;
+    HuffmanTable fixedDist;
+    i32 fixedTablesBuilt;
+    u8 lengths[288 + 32];
+} InflateState;
+
+typedef struct {
+    u8 * data;
+    i64 size;
+    // NOTE(traks): may move past the end of the data, in which case zeros are
+    // read. Whoever's done reading should check for this
+    i64 index;
+    u64 bits;
+    i32 bitCount;
+} BitReader;
+
+// NOTE(traks): the tables are too large to set up for every inflate, and too
+// large for the stack
+static _Thread_local InflateState inflateState;
+
+// NOTE(traks): never ended, since threads don't exit. Keeps zlib's window
+// around in between uses
+static _Thread_local z_stream zlibStream;
+static _Thread_local i32 zlibStreamReady;
+
+static const u16 lengthBases[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static const u8 lengthExtraBits[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static const u16 distBases[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static const u8 distExtraBits[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+static const u8 codelenOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+
+static inline void RefillBits(BitReader * reader) {
+    // NOTE(traks): makes sure there are at least 56 bits available. The fast
+    // path loads 8 bytes at once, but only counts the whole bytes that fit.
+    // The bits of the partial byte at the top are loaded again next time
+    if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && reader->index + 8 <= reader->size) {
+        u64 word;
+        memcpy(&word, reader->data + reader->index, 8);
+        reader->bits |= word << reader->bitCount;
+        reader->index += (63 - reader->bitCount) >> 3;
+        reader->bitCount |= 56;
+    } else {
+        while (reader->bitCount <= 56) {
+            if (reader->index < reader->size) {
+                reader->bits |= (u64) reader->data[reader->index] << reader->bitCount;
+            }
+            reader->index++;
+            reader->bitCount += 8;
+        }
+    }
+}
+
+static inline void ConsumeBits(BitReader * reader, i32 count) {
+    reader->bits >>= count;
+    reader->bitCount -= count;
+}
+
+static inline u32 ReadBits(BitReader * reader, i32 count) {
+    u32 res = reader->bits & (((u64) 1 << count) - 1);
+    ConsumeBits(reader, count);
+    return res;
+}
+
+// NOTE(traks): drops the bits up to the next byte boundary and moves the index
+// back to the first byte that hasn't been consumed
+static void AlignToByte(BitReader * reader) {
+    ConsumeBits(reader, reader->bitCount & 7);
+    reader->index -= reader->bitCount >> 3;
+    reader->bits = 0;
+    reader->bitCount = 0;
+}
+
+static u32 MakeHuffmanEntry(i32 kind, i32 symbol, i32 codeLength) {
+    u32 res = codeLength;
+    if (kind == HUFFMAN_LITLEN) {
+        if (symbol < 256) {
+            res |= HUFFMAN_LITERAL | ((u32) symbol << 16);
+        } else if (symbol == 256) {
+            res |= HUFFMAN_END_OF_BLOCK;
+        } else if (symbol < 286) {
+            i32 index = symbol - 257;
+            res |= ((u32) lengthExtraBits[index] << 4) | ((u32) lengthBases[index] << 16);
+        } else {
+            res |= HUFFMAN_INVALID;
+        }
+    } else if (kind == HUFFMAN_DIST) {
+        if (symbol < 30) {
+            res |= ((u32) distExtraBits[symbol] << 4) | ((u32) distBases[symbol] << 16);
+        } else {
+            res |= HUFFMAN_INVALID;
+        }
+    } else {
+        res |= (u32) symbol << 16;
+    }
+    return res;
+}
+
+// NOTE(traks): returns 0 if the code lengths don't describe a prefix code.
+// Incomplete codes are allowed (e.g. a distance code with a single symbol),
+// unused codes decode as invalid.
+static i32 BuildHuffmanTable(HuffmanTable * table, u8 * lengths, i32 symbolCount, i32 tableBits, i32 kind) {
+    table->tableBits = tableBits;
+    table->kind = kind;
+
+    memset(table->counts, 0, sizeof table->counts);
+    for (i32 symbol = 0; symbol < symbolCount; symbol++) {
+        table->counts[lengths[symbol]]++;
+    }
+    table->counts[0] = 0;
+
+    i32 left = 1;
+    u16 offsets[MAX_CODE_LENGTH + 2];
+    offsets[1] = 0;
+    for (i32 length = 1; length <= MAX_CODE_LENGTH; length++) {
+        left = (left << 1) - table->counts[length];
+        if (left < 0) {
+            // NOTE(traks): over-subscribed
+            return 0;
+        }
+        offsets[length + 1] = offsets[length] + table->counts[length];
+    }
+    for (i32 symbol = 0; symbol < symbolCount; symbol++) {
+        if (lengths[symbol] != 0) {
+            table->symbols[offsets[lengths[symbol]]] = symbol;
+            offsets[lengths[symbol]]++;
+        }
+    }
+
+    u32 tableSize = (u32) 1 << tableBits;
+    if (left > 0) {
+        for (u32 index = 0; index < tableSize; index++) {
+            table->entries[index] = HUFFMAN_INVALID;
+        }
+    }
+
+    // NOTE(traks): deflate stores codes starting at the most significant bit,
+    // but we read bits starting at the least significant bit, so the table is
+    // indexed by reversed codes
+    u32 code = 0;
+    i32 symbolIndex = 0;
+    for (i32 length = 1; length <= MAX_CODE_LENGTH; length++) {
+        for (i32 i = 0; i < table->counts[length]; i++) {
+            i32 symbol = table->symbols[symbolIndex];
+            symbolIndex++;
+
+            u32 reversed = 0;
+            for (i32 bit = 0; bit < length; bit++) {
+                reversed = (reversed << 1) | ((code >> bit) & 1);
+            }
+
+            if (length <= tableBits) {
+                u32 entry = MakeHuffmanEntry(kind, symbol, length);
+                for (u32 index = reversed; index < tableSize; index += (u32) 1 << length) {
+                    table->entries[index] = entry;
+                }
+            } else {
+                table->entries[reversed & (tableSize - 1)] = HUFFMAN_LONG_CODE;
+            }
+            code++;
+        }
+        code <<= 1;
+    }
+    return 1;
+}
+
+static u32 DecodeLongCode(HuffmanTable * table, u64 bits) {
+    // NOTE(traks): walk the canonical code one bit at a time, like zlib's puff
+    i32 code = 0;
+    i32 first = 0;
+    i32 index = 0;
+    for (i32 length = 1; length <= MAX_CODE_LENGTH; length++) {
+        code |= bits & 1;
+        bits >>= 1;
+        i32 count = table->counts[length];
+        if (code - first < count) {
+            return MakeHuffmanEntry(table->kind, table->symbols[index + code - first], length);
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return HUFFMAN_INVALID;
+}
+
+static inline u32 DecodeHuffman(HuffmanTable * table, u64 bits) {
+    u32 entry = table->entries[bits & (((u32) 1 << table->tableBits) - 1)];
+    if (entry & HUFFMAN_LONG_CODE) {
+        entry = DecodeLongCode(table, bits);
+    }
+    return entry;
+}
+
+static void BuildFixedTables(InflateState * state) {
+    u8 * lengths = state->lengths;
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 256 - 144);
+    memset(lengths + 256, 7, 280 - 256);
+    memset(lengths + 280, 8, 288 - 280);
+    BuildHuffmanTable(&state->fixedLitlen, lengths, 288, LITLEN_TABLE_BITS, HUFFMAN_LITLEN);
+    memset(lengths, 5, 32);
+    BuildHuffmanTable(&state->fixedDist, lengths, 32, DIST_TABLE_BITS, HUFFMAN_DIST);
+    state->fixedTablesBuilt = 1;
+}
+
+static i32 ReadDynamicTables(InflateState * state, BitReader * reader) {
+    RefillBits(reader);
+    i32 litlenCount = ReadBits(reader, 5) + 257;
+    i32 distCount = ReadBits(reader, 5) + 1;
+    i32 codelenCount = ReadBits(reader, 4) + 4;
+    if (litlenCount > 286 || distCount > 30) {
+        return 0;
+    }
+
+    u8 codelenLengths[19] = {0};
+    for (i32 i = 0; i < codelenCount; i++) {
+        RefillBits(reader);
+        codelenLengths[codelenOrder[i]] = ReadBits(reader, 3);
+    }
+    if (!BuildHuffmanTable(&state->codelen, codelenLengths, 19, CODELEN_TABLE_BITS, HUFFMAN_CODELEN)) {
+        return 0;
+    }
+
+    u8 * lengths = state->lengths;
+    i32 totalCount = litlenCount + distCount;
+    i32 index = 0;
+    while (index < totalCount) {
+        RefillBits(reader);
+        u32 entry = DecodeHuffman(&state->codelen, reader->bits);
+        if (entry & HUFFMAN_INVALID) {
+            return 0;
+        }
+        ConsumeBits(reader, entry & 0xf);
+
+        i32 symbol = entry >> 16;
+        if (symbol < 16) {
+            lengths[index] = symbol;
+            index++;
+            continue;
+        }
+
+        u8 value = 0;
+        i32 repeat;
+        if (symbol == 16) {
+            if (index == 0) {
+                return 0;
+            }
+            value = lengths[index - 1];
+            repeat = 3 + ReadBits(reader, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + ReadBits(reader, 3);
+        } else {
+            repeat = 11 + ReadBits(reader, 7);
+        }
+        if (repeat > totalCount - index) {
+            return 0;
+        }
+        memset(lengths + index, value, repeat);
+        index += repeat;
+    }
+
+    if (lengths[256] == 0) {
+        // NOTE(traks): no end of block code
+        return 0;
+    }
+    if (!BuildHuffmanTable(&state->litlen, lengths, litlenCount, LITLEN_TABLE_BITS, HUFFMAN_LITLEN)) {
+        return 0;
+    }
+    if (!BuildHuffmanTable(&state->dist, lengths + litlenCount, distCount, DIST_TABLE_BITS, HUFFMAN_DIST)) {
+        return 0;
+    }
+    return 1;
+}
+
+// NOTE(traks): returns the new end of the output, or NULL on failure
+static u8 * InflateHuffmanBlock(BitReader * reader, HuffmanTable * litlen, HuffmanTable * dist, u8 * out, u8 * outCur, u8 * outEnd) {
+    for (;;) {
+        // NOTE(traks): a length and distance take at most 48 bits
+        RefillBits(reader);
+        u32 entry = DecodeHuffman(litlen, reader->bits);
+        ConsumeBits(reader, entry & 0xf);
+
+        if (entry & HUFFMAN_LITERAL) {
+            if (outCur == outEnd) {
+                return NULL;
+            }
+            *outCur = entry >> 16;
+            outCur++;
+
+            // NOTE(traks): literals are common and at most 15 bits, so decode
+            // a couple more before refilling
+            entry = DecodeHuffman(litlen, reader->bits);
+            if (!(entry & HUFFMAN_LITERAL)) {
+                continue;
+            }
+            ConsumeBits(reader, entry & 0xf);
+            if (outCur == outEnd) {
+                return NULL;
+            }
+            *outCur = entry >> 16;
+            outCur++;
+            continue;
+        }
+        if (entry & HUFFMAN_END_OF_BLOCK) {
+            return outCur;
+        }
+        if (entry & HUFFMAN_INVALID) {
+            return NULL;
+        }
+
+        i32 length = (entry >> 16) + ReadBits(reader, (entry >> 4) & 0xf);
+        u32 distEntry = DecodeHuffman(dist, reader->bits);
+        if (distEntry & HUFFMAN_INVALID) {
+            return NULL;
+        }
+        ConsumeBits(reader, distEntry & 0xf);
+        i32 distance = (distEntry >> 16) + ReadBits(reader, (distEntry >> 4) & 0xf);
+
+        if (distance > outCur - out || length > outEnd - outCur) {
+            return NULL;
+        }
+
+        u8 * match = outCur - distance;
+        u8 * matchEnd = outCur + length;
+        if (distance >= 8 && outEnd - matchEnd >= 8) {
+            // NOTE(traks): copy 8 bytes at a time, possibly past the end of
+            // the match. Whatever comes next overwrites that
+            do {
+                u64 word;
+                memcpy(&word, match, 8);
+                memcpy(outCur, &word, 8);
+                match += 8;
+                outCur += 8;
+            } while (outCur < matchEnd);
+            outCur = matchEnd;
+        } else {
+            while (outCur < matchEnd) {
+                *outCur = *match;
+                outCur++;
+                match++;
+            }
+        }
+    }
+}
+
+// NOTE(traks): returns the number of bytes written, or -1 on failure
+static i32 InflateBlocks(InflateState * state, BitReader * reader, u8 * out, i32 outSize) {
+    u8 * outCur = out;
+    u8 * outEnd = out + outSize;
+
+    for (;;) {
+        RefillBits(reader);
+        i32 finalBlock = ReadBits(reader, 1);
+        i32 blockType = ReadBits(reader, 2);
+
+        if (blockType == 0) {
+            // NOTE(traks): stored block
+            AlignToByte(reader);
+            if (reader->index + 4 > reader->size) {
+                return -1;
+            }
+            u8 * header = reader->data + reader->index;
+            i32 length = header[0] | (header[1] << 8);
+            i32 lengthComplement = header[2] | (header[3] << 8);
+            reader->index += 4;
+            if (length != (~lengthComplement & 0xffff)) {
+                return -1;
+            }
+            if (length > reader->size - reader->index || length > outEnd - outCur) {
+                return -1;
+            }
+            memcpy(outCur, reader->data + reader->index, length);
+            reader->index += length;
+            outCur += length;
+        } else if (blockType == 1) {
+            if (!state->fixedTablesBuilt) {
+                BuildFixedTables(state);
+            }
+            outCur = InflateHuffmanBlock(reader, &state->fixedLitlen, &state->fixedDist, out, outCur, outEnd);
+        } else if (blockType == 2) {
+            if (!ReadDynamicTables(state, reader)) {
+                return -1;
+            }
+            outCur = InflateHuffmanBlock(reader, &state->litlen, &state->dist, out, outCur, outEnd);
+        } else {
+            return -1;
+        }
+
+        if (outCur == NULL) {
+            return -1;
+        }
+        if (finalBlock) {
+            break;
+        }
+    }
+    return outCur - out;
+}
+
+// NOTE(traks): returns the size of the header, or -1 if it's invalid
+static i32 SkipGzipHeader(u8 * data, i32 size) {
+    if (size < 10 || data[0] != 0x1f || data[1] != 0x8b || data[2] != 8 || (data[3] & 0xe0)) {
+        return -1;
+    }
+    u8 flags = data[3];
+    i32 index = 10;
+    if (flags & 0x4) {
+        // NOTE(traks): extra field
+        if (size - index < 2) {
+            return -1;
+        }
+        index += 2 + (data[index] | (data[index + 1] << 8));
+    }
+    if (flags & 0x8) {
+        // NOTE(traks): zero-terminated file name
+        while (index < size && data[index] != 0) {
+            index++;
+        }
+        index++;
+    }
+    if (flags & 0x10) {
+        // NOTE(traks): zero-terminated comment
+        while (index < size && data[index] != 0) {
+            index++;
+        }
+        index++;
+    }
+    if (flags & 0x2) {
+        // NOTE(traks): header CRC
+        index += 2;
+    }
+    if (index > size) {
+        return -1;
+    }
+    return index;
+}
+
+i32 InflateSinglePass(u8 * in, i32 inSize, u8 * out, i32 outSize, i32 format) {
+    InflateState * state = &inflateState;
+    BitReader reader = {
+        .data = in,
+        .size = inSize,
+    };
+
+    if (format == INFLATE_FORMAT_GZIP) {
+        reader.index = SkipGzipHeader(in, inSize);
+        if (reader.index < 0) {
+            return -1;
+        }
+    } else {
+        if (inSize < 2) {
+            return -1;
+        }
+        u32 header = ((u32) in[0] << 8) | in[1];
+        // NOTE(traks): deflate, window size at most 32 KiB, valid check bits
+        // and no preset dictionary
+        if ((header & 0x0f00) != 0x0800 || (header >> 12) > 7 || header % 31 != 0 || (header & 0x20)) {
+            return -1;
+        }
+        reader.index = 2;
+    }
+
+    i32 res = InflateBlocks(state, &reader, out, outSize);
+    if (res < 0) {
+        return -1;
+    }
+
+    AlignToByte(&reader);
+    if (reader.index > inSize) {
+        // NOTE(traks): read past the end of the input
+        return -1;
+    }
+    u8 * trailer = in + reader.index;
+    i64 trailerSize = inSize - reader.index;
+
+    // NOTE(traks): like zlib, trailing data is an error
+    if (format == INFLATE_FORMAT_GZIP) {
+        if (trailerSize != 8) {
+            return -1;
+        }
+        if (crc32(crc32(0, Z_NULL, 0), out, res) != ReadLittleEndianU32(trailer)
+                || (u32) res != ReadLittleEndianU32(trailer + 4)) {
+            return -1;
+        }
+    } else {
+        if (trailerSize != 4) {
+            return -1;
+        }
+        u32 checksum = ((u32) trailer[0] << 24) | ((u32) trailer[1] << 16) | ((u32) trailer[2] << 8) | trailer[3];
+        if (adler32(adler32(0, Z_NULL, 0), out, res) != checksum) {
+            return -1;
+        }
+    }
+    return res;
+}
+
+i32 InflateWithZlib(u8 * in, i32 inSize, u8 * out, i32 outSize, i32 format) {
+    z_stream * zstream = &zlibStream;
+
+    // NOTE(traks): 0 means zlib stream, 16 means gzip stream, and determine
+    // window size from header
+    int windowBits = format == INFLATE_FORMAT_GZIP ? 16 : 0;
+    if (!zlibStreamReady) {
+        zstream->zalloc = Z_NULL;
+        zstream->zfree = Z_NULL;
+        zstream->opaque = Z_NULL;
+        if (inflateInit2(zstream, windowBits) != Z_OK) {
+            LogInfo("inflateInit failed");
+            return -1;
+        }
+        zlibStreamReady = 1;
+    } else if (inflateReset2(zstream, windowBits) != Z_OK) {
+        LogInfo("inflateReset failed");
+        return -1;
+    }
+
+    zstream->next_in = in;
+    zstream->avail_in = inSize;
+    zstream->next_out = out;
+    zstream->avail_out = outSize;
+
+    int inflate_status = inflate(zstream, Z_FINISH);
+    switch (inflate_status) {
+    case Z_STREAM_END:
+        // all good
+        break;
+    case Z_NEED_DICT:
+    case Z_STREAM_ERROR:
+        LogInfo("Inflate stream error");
+        break;
+    case Z_DATA_ERROR:
+        LogInfo("Failed to finish inflating: %s", zstream->msg);
+        break;
+    case Z_MEM_ERROR:
+        LogInfo("Inflate not enough memory");
+        break;
+    case Z_BUF_ERROR:
+    case Z_OK:
+        LogInfo("Uncompressed size too large");
+        break;
+    }
+
+    if (inflate_status != Z_STREAM_END || zstream->avail_in != 0) {
+        return -1;
+    }
+    return zstream->total_out;
+}
+
+static Cursor Inflate(u8 * data, i32 size, i32 maxSize, MemoryArena * arena, i32 format) {
+    BeginTimings(Inflate);
+
+    Cursor res = {
+        .data = MallocInArena(arena, maxSize),
+    };
+    if (res.data == NULL) {
+        res.error = 1;
+        EndTimings(Inflate);
+        return res;
+    }
+
+#ifdef INFLATE_WITH_ZLIB
+    i32 uncompressedSize = InflateWithZlib(data, size, res.data, maxSize, format);
+#else
+    i32 uncompressedSize = InflateSinglePass(data, size, res.data, maxSize, format);
+    if (uncompressedSize < 0) {
+        LogInfo("Invalid deflate stream or uncompressed size too large");
+    }
+#endif
+
+    if (uncompressedSize < 0) {
+        res.error = 1;
+    } else {
+        res.size = uncompressedSize;
+    }
+    ShrinkArenaAllocation(arena, res.data, res.size);
+    EndTimings(Inflate);
+    return res;
+}
+
+Cursor InflateZlib(u8 * data, i32 size, i32 maxSize, MemoryArena * arena) {
+    return Inflate(data, size, maxSize, arena, INFLATE_FORMAT_ZLIB);
+}
+
+Cursor InflateGzip(u8 * data, i32 size, i32 maxSize, MemoryArena * arena) {
+    return Inflate(data, size, maxSize, arena, INFLATE_FORMAT_GZIP);
+}
+
+static inline u32 RotateLeftU32(u32 value, i32 shift) {
+    return (value << shift) | (value >> (32 - shift));
+}
+
+#define XXH32_PRIME_1 (0x9e3779b1u)
+#define XXH32_PRIME_2 (0x85ebca77u)
+#define XXH32_PRIME_3 (0xc2b2ae3du)
+#define XXH32_PRIME_4 (0x27d4eb2fu)
+#define XXH32_PRIME_5 (0x165667b1u)
+
+static inline u32 Xxh32Round(u32 acc, u32 input) {
+    acc += input * XXH32_PRIME_2;
+    acc = RotateLeftU32(acc, 13);
+    return acc * XXH32_PRIME_1;
+}
+
+static u32 Xxh32(u8 * data, i32 size, u32 seed) {
+    u8 * cur = data;
+    u8 * end = data + size;
+    u32 hash;
+
+    if (size >= 16) {
+        u32 v1 = seed + XXH32_PRIME_1 + XXH32_PRIME_2;
+        u32 v2 = seed + XXH32_PRIME_2;
+        u32 v3 = seed;
+        u32 v4 = seed - XXH32_PRIME_1;
+        while (end - cur >= 16) {
+            v1 = Xxh32Round(v1, ReadLittleEndianU32(cur));
+            v2 = Xxh32Round(v2, ReadLittleEndianU32(cur + 4));
+            v3 = Xxh32Round(v3, ReadLittleEndianU32(cur + 8));
+            v4 = Xxh32Round(v4, ReadLittleEndianU32(cur + 12));
+            cur += 16;
+        }
+        hash = RotateLeftU32(v1, 1) + RotateLeftU32(v2, 7) + RotateLeftU32(v3, 12) + RotateLeftU32(v4, 18);
+    } else {
+        hash = seed + XXH32_PRIME_5;
+    }
+
+    hash += (u32) size;
+    while (end - cur >= 4) {
+        hash += ReadLittleEndianU32(cur) * XXH32_PRIME_3;
+        hash = RotateLeftU32(hash, 17) * XXH32_PRIME_4;
+        cur += 4;
+    }
+    while (cur < end) {
+        hash += *cur * XXH32_PRIME_5;
+        hash = RotateLeftU32(hash, 11) * XXH32_PRIME_1;
+        cur++;
+    }
+
+    hash ^= hash >> 15;
+    hash *= XXH32_PRIME_2;
+    hash ^= hash >> 13;
+    hash *= XXH32_PRIME_3;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+// NOTE(traks): returns the number of bytes written, or -1 if the input is
+// invalid or doesn't fit
+static i32 DecompressLz4Block(u8 * in, i32 inSize, u8 * out, i32 outSize) {
+    u8 * inCur = in;
+    u8 * inEnd = in + inSize;
+    u8 * outCur = out;
+    u8 * outEnd = out + outSize;
+
+    for (;;) {
+        if (inCur >= inEnd) {
+            return -1;
+        }
+        u32 token = *inCur++;
+
+        i64 literalLength = token >> 4;
+        if (literalLength == 15) {
+            u32 extra;
+            do {
+                if (inCur >= inEnd) {
+                    return -1;
+                }
+                extra = *inCur++;
+                literalLength += extra;
+            } while (extra == 255);
+        }
+        if (literalLength > inEnd - inCur || literalLength > outEnd - outCur) {
+            return -1;
+        }
+        memcpy(outCur, inCur, literalLength);
+        inCur += literalLength;
+        outCur += literalLength;
+
+        // NOTE(traks): the last sequence only contains literals
+        if (inCur == inEnd) {
+            break;
+        }
+
+        if (inEnd - inCur < 2) {
+            return -1;
+        }
+        i64 offset = inCur[0] | (inCur[1] << 8);
+        inCur += 2;
+        if (offset == 0 || offset > outCur - out) {
+            return -1;
+        }
+
+        i64 matchLength = token & 0xf;
+        if (matchLength == 15) {
+            u32 extra;
+            do {
+                if (inCur >= inEnd) {
+                    return -1;
+                }
+                extra = *inCur++;
+                matchLength += extra;
+            } while (extra == 255);
+        }
+        matchLength += 4;
+        if (matchLength > outEnd - outCur) {
+            return -1;
+        }
+
+        u8 * match = outCur - offset;
+        if (offset >= matchLength) {
+            memcpy(outCur, match, matchLength);
+            outCur += matchLength;
+        } else {
+            // NOTE(traks): overlapping match, repeats the last offset bytes
+            u8 * matchEnd = outCur + matchLength;
+            while (outCur < matchEnd) {
+                *outCur++ = *match++;
+            }
+        }
+    }
+
+    return outCur - out;
+}
+
+#define LZ4_BLOCK_HEADER_SIZE (8 + 1 + 4 + 4 + 4)
+#define LZ4_BLOCK_METHOD_RAW (0x10)
+#define LZ4_BLOCK_METHOD_LZ4 (0x20)
+#define LZ4_BLOCK_CHECKSUM_SEED (0x9747b28c)
+
+Cursor DecompressLz4Blocks(u8 * data, i32 size, i32 maxSize, MemoryArena * arena) {
+    BeginTimings(DecompressLz4);
+
+    Cursor res = {
+        .data = MallocInArena(arena, maxSize),
+    };
+    if (res.data == NULL) {
+        res.error = 1;
+        EndTimings(DecompressLz4);
+        return res;
+    }
+    u8 * cur = data;
+    u8 * end = data + size;
+
+    for (;;) {
+        if (end - cur < LZ4_BLOCK_HEADER_SIZE || memcmp(cur, "LZ4Block", 8) != 0) {
+            LogInfo("Invalid LZ4 block header");
+            res.error = 1;
+            break;
+        }
+        u32 method = cur[8] & 0xf0;
+        i32 compressedSize = ReadLittleEndianU32(cur + 9);
+        i32 decompressedSize = ReadLittleEndianU32(cur + 13);
+        u32 checksum = ReadLittleEndianU32(cur + 17);
+        cur += LZ4_BLOCK_HEADER_SIZE;
+
+        if (compressedSize == 0 && decompressedSize == 0) {
+            // NOTE(traks): end of the stream
+            break;
+        }
+        if (compressedSize < 0 || compressedSize > end - cur || decompressedSize < 0 || decompressedSize > maxSize - res.size) {
+            LogInfo("LZ4 block too large");
+            res.error = 1;
+            break;
+        }
+
+        u8 * out = res.data + res.size;
+        if (method == LZ4_BLOCK_METHOD_RAW && compressedSize == decompressedSize) {
+            memcpy(out, cur, decompressedSize);
+        } else if (method == LZ4_BLOCK_METHOD_LZ4) {
+            if (DecompressLz4Block(cur, compressedSize, out, decompressedSize) != decompressedSize) {
+                LogInfo("Invalid LZ4 block");
+                res.error = 1;
+                break;
+            }
+        } else {
+            LogInfo("Unknown LZ4 block method");
+            res.error = 1;
+            break;
+        }
+
+        // NOTE(traks): lz4-java masks the checksum to 28 bits in some places,
+        // so only compare those
+        if (((Xxh32(out, decompressedSize, LZ4_BLOCK_CHECKSUM_SEED) ^ checksum) & 0xfffffff) != 0) {
+            LogInfo("LZ4 block checksum mismatch");
+            res.error = 1;
+            break;
+        }
+
+        cur += compressedSize;
+        res.size += decompressedSize;
+    }
+
+    ShrinkArenaAllocation(arena, res.data, res.size);
+    EndTimings(DecompressLz4);
+    return res;
+}
@@ -0,0 +1,29 @@
+#ifndef DECOMPRESS_H
+#define DECOMPRESS_H
+
+#include "base.h"
+#include "buffer.h"
+
+// NOTE(traks): All of these decompress the input into memory allocated from
+// the arena, up to maxSize bytes. The returned cursor points to the
+// decompressed data, and has its error flag set if decompression failed. The
+// part of the maxSize bytes that isn't needed is given back to the arena.
+
+Cursor InflateZlib(u8 * data, i32 size, i32 maxSize, MemoryArena * arena);
+Cursor InflateGzip(u8 * data, i32 size, i32 maxSize, MemoryArena * arena);
+// NOTE(traks): the block stream format of lz4-java's LZ4BlockOutputStream, not
+// the LZ4 frame format
+Cursor DecompressLz4Blocks(u8 * data, i32 size, i32 maxSize, MemoryArena * arena);
+
+enum {
+    INFLATE_FORMAT_ZLIB,
+    INFLATE_FORMAT_GZIP,
+};
+
+// NOTE(traks): The inflate backends used by the above, exposed for benchmarks.
+// Both inflate the entire input into the output buffer in one go and reuse
+// per-thread state. Return the uncompressed size, or -1 on failure
+i32 InflateSinglePass(u8 * in, i32 inSize, u8 * out, i32 outSize, i32 format);
+i32 InflateWithZlib(u8 * in, i32 inSize, u8 * out, i32 outSize, i32 format);
+
+#endif
@@ -29,6 +29,10 @@ typedef struct {
     i32 writeIndex;
     // NOTE(traks): index as yzx
     u8 * lightSections[4 * 4 * 32];
+    // NOTE(traks): where the chunks store their light sections, so we can
+    // replace shared light sections by a copy when we modify them. NULL for
+    // sections outside of loaded chunks, which should never be modified
+    u8 * * lightSectionRefs[4 * 4 * 32];
     SectionBlocks blockSections[4 * 4 * 32];
 #ifdef MEASURE_BANDWIDTH
     i64 blockAccessCount;
@@ -110,6 +114,16 @@ static inline void LightQueuePush(LightQueue * queue, LightQueueEntry entry) {
     queue->writeIndex++;
 }
 
+static inline void SetQueueLight(LightQueue * queue, i32 sectionIndex, i32 posIndex, i32 value) {
+    u8 * light = queue->lightSections[sectionIndex];
+    if (IsSharedSectionLight(light)) {
+        assert(queue->lightSectionRefs[sectionIndex] != NULL);
+        light = UnshareSectionLight(queue->lightSectionRefs[sectionIndex]);
+        queue->lightSections[sectionIndex] = light;
+    }
+    SetSectionLight(light, posIndex, value);
+}
+
 // NOTE(traks): update a neighbour's light and push the neighbour to the
 // queue if further propagation is necessary
 static inline void PropagateLight(LightQueue * queue, u32 toPos, i32 dir, i32 fromState, i32 fromValue, i32 lightReduction) {
@@ -143,7 +157,7 @@ static inline void PropagateLight(LightQueue * queue, u32 toPos, i32 dir, i32 fr
         return;
     }
 
-    SetSectionLight(queue->lightSections[sectionIndex], posIndex, spreadValue);
+    SetQueueLight(queue, sectionIndex, posIndex, spreadValue);
 
     LightQueuePush(queue, PackEntry(toPos));
 }
@@ -197,7 +211,7 @@ static void PropagateMaxSkyLightDown(LightQueue * queue) {
                     break;
                 }
 
-                SetSectionLight(queue->lightSections[sectionIndex], posIndex, 15);
+                SetQueueLight(queue, sectionIndex, posIndex, 15);
                 u32 toPos = PosFromXYZ(x, y, z);
                 LightQueuePush(queue, PackEntry(toPos));
                 fromState = toState;
@@ -248,6 +262,7 @@ static void DoSkyLight(LightQueue * queue, Chunk * * chunkGrid) {
         }
         for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
             queue->lightSections[(sectionIndex << 4) | zx] = chunk->lightSections[sectionIndex].skyLight;
+            queue->lightSectionRefs[(sectionIndex << 4) | zx] = &chunk->lightSections[sectionIndex].skyLight;
         }
     }
 
@@ -293,6 +308,7 @@ static void DoBlockLight(LightQueue * queue, Chunk * * chunkGrid) {
         }
         for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
             queue->lightSections[(sectionIndex << 4) | zx] = chunk->lightSections[sectionIndex].blockLight;
+            queue->lightSectionRefs[(sectionIndex << 4) | zx] = &chunk->lightSections[sectionIndex].blockLight;
         }
     }
 
@@ -312,7 +328,7 @@ static void DoBlockLight(LightQueue * queue, Chunk * * chunkGrid) {
 #endif
             i32 emitted = serv->emittedLightByState[blockState];
             if (emitted > 0) {
-                SetSectionLight(queue->lightSections[sectionIndex], posIndex, emitted);
+                SetQueueLight(queue, sectionIndex, posIndex, emitted);
                 u32 pos = PosFromXYZ(zx & 0xf, y, zx >> 4);
                 LightQueuePush(queue, PackEntry(pos));
             }
@@ -351,17 +367,15 @@ static void LoadChunkGrid(Chunk * targetChunk, Chunk * * chunkGrid) {
 #ifdef MEASURE_BANDWIDTH
     return;
 #endif
+    Chunk * neighbours[3 * 3];
+    CollectChunkNeighbours(targetChunk->pos, neighbours);
     for (i32 dz = -1; dz <= 1; dz++) {
         for (i32 dx = -1; dx <= 1; dx++) {
             if (dx == 0 && dz == 0) {
                 continue;
             }
-            WorldChunkPos mid = targetChunk->pos;
-            WorldChunkPos pos = mid;
-            pos.x += dx;
-            pos.z += dz;
             i32 index = GetNeighbourIndex(dx, dz);
-            Chunk * neighbour = GetChunkInternal(pos);
+            Chunk * neighbour = neighbours[(dz + 1) * 3 + (dx + 1)];
             if (neighbour != NULL && (neighbour->loaderFlags & CHUNK_LOADER_LIT_SELF)) {
                 // NOTE(traks): the neighbouring chunk lit itself, so we can
                 // exchange light with it
@@ -399,6 +413,14 @@ void LightChunkAndExchangeWithNeighbours(Chunk * targetChunk) {
     Chunk * chunkGrid[4 * 4] = {0};
     LoadChunkGrid(targetChunk, chunkGrid);
 
+    // NOTE(traks): light of mirror world chunks and their templates may be
+    // shared with other chunks, so copy it before we modify it
+    for (i32 zx = 0; zx < 16; zx++) {
+        if (chunkGrid[zx] != NULL && chunkGrid[zx]->sharedLightSections != 0) {
+            UnshareChunkLight(chunkGrid[zx]);
+        }
+    }
+
     EndTimings(LoadChunkGrid);
 
     BeginTimings(InitQueue);
@@ -412,8 +434,7 @@ void LightChunkAndExchangeWithNeighbours(Chunk * targetChunk) {
 
     // NOTE(traks): set up section references for easy access
     SectionBlocks sectionAir = {0};
-    u8 sectionFullLight[4096];
-    memset(sectionFullLight, 0xff, 4096);
+    u8 * sectionFullLight = GetUniformSectionLight(15);
 
     for (i32 i = 0; i < (i32) ARRAY_SIZE(lightQueue.blockSections); i++) {
         lightQueue.blockSections[i] = sectionAir;
@@ -446,9 +467,138 @@ void LightChunkAndExchangeWithNeighbours(Chunk * targetChunk) {
 #endif
     DoBlockLight(&lightQueue, chunkGrid);
 
+    BeginTimings(CompactLight);
+
+    // NOTE(traks): lighting unshares light sections when it touches them, but
+    // many of them end up uniform again (e.g. full sky light above the ground)
+    for (i32 zx = 0; zx < 16; zx++) {
+        Chunk * chunk = chunkGrid[zx];
+        if (chunk == NULL) {
+            continue;
+        }
+        for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
+            LightSection * section = chunk->lightSections + sectionIndex;
+            CompactSectionLight(&section->skyLight);
+            CompactSectionLight(&section->blockLight);
+        }
+    }
+
+    EndTimings(CompactLight);
+
     EndTimings(LightChunk);
 }
 
+// NOTE(traks): whether light would spread from one side of the edge to the
+// other, going the same way as PropagateLight
+static i32 LightSpreadsAcrossEdge(i32 fromValue, i32 toValue, i32 fromState, i32 toState, i32 dir) {
+    i32 spreadValue = fromValue - MAX(1, serv->lightReductionByState[toState]);
+    return spreadValue > toValue && FindLightCanPropagate(fromState, toState, dir);
+}
+
+// NOTE(traks): dir is the direction from the chunk to the neighbour
+static i32 LightMatchesAcrossEdge(Chunk * chunk, Chunk * neighbour, i32 dir) {
+    i32 fromX = 0;
+    i32 fromZ = 0;
+    i32 addX = 0;
+    i32 addZ = 0;
+    switch (dir) {
+    case DIRECTION_NEG_X: fromX = 0; addZ = 1; break;
+    case DIRECTION_POS_X: fromX = 15; addZ = 1; break;
+    case DIRECTION_NEG_Z: fromZ = 0; addX = 1; break;
+    case DIRECTION_POS_Z: fromZ = 15; addX = 1; break;
+    default: assert(0);
+    }
+    // NOTE(traks): position of the neighbouring block on the other side of the
+    // edge, within the neighbour
+    i32 toX = (addX == 0 ? 15 - fromX : 0);
+    i32 toZ = (addZ == 0 ? 15 - fromZ : 0);
+    i32 oppositeDir = get_opposite_direction(dir);
+    SectionBlocks sectionAir = {0};
+
+    for (i32 sectionIndex = 0; sectionIndex < LIGHT_SECTIONS_PER_CHUNK; sectionIndex++) {
+        LightSection * fromSection = chunk->lightSections + sectionIndex;
+        LightSection * toSection = neighbour->lightSections + sectionIndex;
+        // NOTE(traks): light sections above and below the world are air
+        i32 blockSectionIndex = sectionIndex - 1;
+        SectionBlocks * fromBlocks = &sectionAir;
+        SectionBlocks * toBlocks = &sectionAir;
+        if (0 <= blockSectionIndex && blockSectionIndex < SECTIONS_PER_CHUNK) {
+            fromBlocks = &chunk->sections[blockSectionIndex].blocks;
+            toBlocks = &neighbour->sections[blockSectionIndex].blocks;
+        }
+
+        for (i32 lightType = 0; lightType < 2; lightType++) {
+            u8 * fromLight = (lightType == 0 ? fromSection->skyLight : fromSection->blockLight);
+            u8 * toLight = (lightType == 0 ? toSection->skyLight : toSection->blockLight);
+            if (fromLight == toLight) {
+                // NOTE(traks): most likely the same uniform light, e.g. full
+                // sky light above the ground
+                continue;
+            }
+
+            for (i32 y = 0; y < 16; y++) {
+                for (i32 h = 0; h < 16; h++) {
+                    i32 fromPosIndex = (y << 8) | ((fromZ + h * addZ) << 4) | (fromX + h * addX);
+                    i32 toPosIndex = (y << 8) | ((toZ + h * addZ) << 4) | (toX + h * addX);
+                    i32 fromValue = GetSectionLight(fromLight, fromPosIndex);
+                    i32 toValue = GetSectionLight(toLight, toPosIndex);
+                    // NOTE(traks): light spreads with a reduction of at least 1,
+                    // so only need to look at the blocks if the light differs
+                    // by more than that
+                    if (fromValue > toValue + 1) {
+                        i32 fromState = SectionGetBlockState(fromBlocks, fromPosIndex);
+                        i32 toState = SectionGetBlockState(toBlocks, toPosIndex);
+                        if (LightSpreadsAcrossEdge(fromValue, toValue, fromState, toState, dir)) {
+                            return 0;
+                        }
+                    } else if (toValue > fromValue + 1) {
+                        i32 fromState = SectionGetBlockState(fromBlocks, fromPosIndex);
+                        i32 toState = SectionGetBlockState(toBlocks, toPosIndex);
+                        if (LightSpreadsAcrossEdge(toValue, fromValue, toState, fromState, oppositeDir)) {
+                            return 0;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+i32 LightMatchesNeighbours(Chunk * chunk) {
+    BeginTimings(LightMatchesNeighbours);
+
+    Chunk * neighbours[3 * 3];
+    CollectChunkNeighbours(chunk->pos, neighbours);
+    // NOTE(traks): light only spreads through the faces of blocks, so corner
+    // neighbours don't matter
+    struct {
+        i32 index;
+        i32 dir;
+    } edges[] = {
+        {1 * 3 + 0, DIRECTION_NEG_X},
+        {1 * 3 + 2, DIRECTION_POS_X},
+        {0 * 3 + 1, DIRECTION_NEG_Z},
+        {2 * 3 + 1, DIRECTION_POS_Z},
+    };
+
+    i32 res = 1;
+    for (i32 edgeIndex = 0; edgeIndex < (i32) ARRAY_SIZE(edges); edgeIndex++) {
+        Chunk * neighbour = neighbours[edges[edgeIndex].index];
+        if (neighbour == NULL || !(neighbour->loaderFlags & CHUNK_LOADER_LIT_SELF)) {
+            // NOTE(traks): the neighbour checks against us once it's loaded
+            continue;
+        }
+        if (!LightMatchesAcrossEdge(chunk, neighbour, edges[edgeIndex].dir)) {
+            res = 0;
+            break;
+        }
+    }
+
+    EndTimings(LightMatchesNeighbours);
+    return res;
+}
+
 void UpdateLighting(void) {
     // @TODO(traks) further implementation
     /*
@@ -25,6 +25,11 @@
 #include <time.h>
 #endif
 
+// NOTE(traks): use the light stored in the region files of the main world
+// instead of lighting chunks ourselves, see SetTrustStoredLight. Only for maps
+// whose stored light is known to be good, such as lobbies
+// #define TRUST_STORED_LIGHT
+
 static volatile sig_atomic_t interruptCount;
 
 server * serv;
@@ -644,13 +649,17 @@ server_tick(void) {
     EndTimings(TickChunkLoader);
 
     serv->current_tick++;
+    SetTaskQueueTick(serv->backgroundQueue, serv->current_tick);
     EndTimings(ServerTick);
 }
 
 int
-main(void) {
+main(int argc, char * * argv) {
     InitNanoTime();
 
+    // NOTE(traks): bakes world snapshots instead of running the server
+    i32 bake = (argc > 1 && strcmp(argv[1], "bake") == 0);
+
     LogInfo("Running Blaze");
 
     // Ignore SIGPIPE so the server doesn't crash (by getting signals) if a
@@ -679,7 +688,9 @@ main(void) {
     // signal(SIGINT, OnSigInt);
 
     InitPlayerControl();
-    InitNetwork();
+    if (!bake) {
+        InitNetwork();
+    }
 
     serv = calloc(1, sizeof *serv);
     if (serv == NULL) {
@@ -723,10 +734,20 @@ main(void) {
     serv->current_tick = 10;
 
     TaskQueue * backgroundQueue = MallocInArena(serv->permanentArena, sizeof *backgroundQueue);
-    CreateTaskQueue(backgroundQueue, 2);
+    // NOTE(traks): a worker for every core but the main thread's
+    CreateTaskQueue(backgroundQueue, 0);
     serv->backgroundQueue = backgroundQueue;
 
     InitChunkSystem();
+#ifdef TRUST_STORED_LIGHT
+    SetTrustStoredLight(1, 1);
+#endif
+
+    if (bake) {
+        BakeWorldSnapshots();
+        return 0;
+    }
+    InitWorldSnapshots();
 
     LogInfo("Entering tick loop");
 
@@ -1114,3 +1114,118 @@ NbtCompound NbtNextCompound(NbtList * list) {
     NbtCompound res = {.internal = value};
     return res;
 }
+
+String NbtReadString(Cursor * buf) {
+    u16 size = ReadU16(buf);
+    u8 * data = ReadData(buf, size);
+    if (data == NULL) {
+        return (String) {0};
+    }
+    return (String) {.data = data, .size = size};
+}
+
+u64 NbtReadUAny(Cursor * buf, i32 tag) {
+    switch (tag) {
+    case NBT_TAG_BYTE: return ReadU8(buf);
+    case NBT_TAG_SHORT: return ReadU16(buf);
+    case NBT_TAG_INT: return ReadU32(buf);
+    case NBT_TAG_LONG: return ReadU64(buf);
+    default:
+        NbtSkip(buf, tag);
+        return 0;
+    }
+}
+
+u8 * NbtReadArray(Cursor * buf, i32 elemSize, i32 * count) {
+    i32 size = ReadU32(buf);
+    if (size < 0 || size > CursorRemaining(buf) / elemSize) {
+        buf->error = 1;
+        buf->index = buf->size;
+        *count = 0;
+        return NULL;
+    }
+    *count = size;
+    return ReadData(buf, size * elemSize);
+}
+
+// NOTE(traks): size of values with a fixed size, 0 for the others
+static i32 NbtFixedSize(i32 tag) {
+    switch (tag) {
+    case NBT_TAG_BYTE: return 1;
+    case NBT_TAG_SHORT: return 2;
+    case NBT_TAG_INT: return 4;
+    case NBT_TAG_LONG: return 8;
+    case NBT_TAG_FLOAT: return 4;
+    case NBT_TAG_DOUBLE: return 8;
+    default: return 0;
+    }
+}
+
+static void NbtSkipLevel(Cursor * buf, i32 tag, i32 level) {
+    // @TODO(traks) more appropriate max level, same as NbtRead for now
+    if (level >= 64) {
+        buf->error = 1;
+        buf->index = buf->size;
+        return;
+    }
+
+    i32 count;
+    switch (tag) {
+    case NBT_TAG_BYTE:
+    case NBT_TAG_SHORT:
+    case NBT_TAG_INT:
+    case NBT_TAG_LONG:
+    case NBT_TAG_FLOAT:
+    case NBT_TAG_DOUBLE:
+        CursorSkip(buf, NbtFixedSize(tag));
+        break;
+    case NBT_TAG_BYTE_ARRAY:
+        NbtReadArray(buf, 1, &count);
+        break;
+    case NBT_TAG_INT_ARRAY:
+        NbtReadArray(buf, 4, &count);
+        break;
+    case NBT_TAG_LONG_ARRAY:
+        NbtReadArray(buf, 8, &count);
+        break;
+    case NBT_TAG_STRING:
+        NbtReadString(buf);
+        break;
+    case NBT_TAG_LIST: {
+        u8 elemTag = ReadU8(buf);
+        i32 elemSize = NbtFixedSize(elemTag);
+        if (elemSize > 0) {
+            NbtReadArray(buf, elemSize, &count);
+            break;
+        }
+        count = ReadU32(buf);
+        if (count > 0 && (elemTag == NBT_TAG_END || elemTag > NBT_TAG_LONG_ARRAY)) {
+            buf->error = 1;
+            buf->index = buf->size;
+            break;
+        }
+        for (i32 i = 0; i < count && !buf->error; i++) {
+            NbtSkipLevel(buf, elemTag, level + 1);
+        }
+        break;
+    }
+    case NBT_TAG_COMPOUND:
+        for (;;) {
+            u8 entryTag = ReadU8(buf);
+            if (entryTag == NBT_TAG_END || buf->error) {
+                break;
+            }
+            NbtReadString(buf);
+            NbtSkipLevel(buf, entryTag, level + 1);
+        }
+        break;
+    default:
+        buf->error = 1;
+        buf->index = buf->size;
+        break;
+    }
+}
+
+void NbtSkip(Cursor * buf, i32 tag) {
+    NbtSkipLevel(buf, tag, 0);
+}
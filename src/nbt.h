@@ -79,4 +79,19 @@ NbtList NbtNextArrayU64(NbtList * list);
 NbtList NbtNextList(NbtList * list, i32 elemType);
 NbtCompound NbtNextCompound(NbtList * list);
 
+// NOTE(traks): For walking over NBT data in a single pass without building a
+// tree, when only a few values are needed. Callers read tags and keys
+// themselves. All of these set the cursor's error flag on invalid data.
+
+// NOTE(traks): reads a key or string value
+String NbtReadString(Cursor * buf);
+// NOTE(traks): reads any integer value as unsigned. Skips non-integer values
+// and returns 0 for them
+u64 NbtReadUAny(Cursor * buf, i32 tag);
+// NOTE(traks): reads the length of an array of elements of the given size and
+// returns a pointer to the big endian elements, or NULL if the array is invalid
+u8 * NbtReadArray(Cursor * buf, i32 elemSize, i32 * count);
+// NOTE(traks): skips over a value without looking at it more than necessary
+void NbtSkip(Cursor * buf, i32 tag);
+
 #endif
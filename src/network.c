@@ -230,6 +230,7 @@ static void WriteAllRegistries(Client * client, Cursor * sendCursor) {
         &serv->itemRegistry,
         &serv->entityTypeRegistry,
         &serv->fluidRegistry,
+        &serv->blockEntityTypeRegistry,
         &serv->gameEventRegistry,
         &serv->biomeRegistry,
         &serv->chatTypeRegistry,
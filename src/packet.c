@@ -1,6 +1,7 @@
 #include <zlib.h>
 #include <stdlib.h>
 #include "packet.h"
+#include "decompress.h"
 
 #define INTERNAL_HEADER_SIZE (1)
 #define INTERNAL_PACKET_PREFIX_SIZE (INTERNAL_HEADER_SIZE + 5)
@@ -182,48 +183,14 @@ Cursor TryReadPacket(Cursor * recCursor, MemoryArena * arena, i32 shouldDecompre
         // threshold, we should validate this!
         ReadVarU32(packetCursor);
 
-        // TODO(traks): move to a zlib alternative that is optimised
-        // for single pass inflate/deflate. If we don't end up doing
-        // this, make sure the code below is actually correct (when
-        // do we need to clean stuff up?)!
-
-        z_stream zstream;
-        zstream.zalloc = Z_NULL;
-        zstream.zfree = Z_NULL;
-        zstream.opaque = Z_NULL;
-
-        if (inflateInit2(&zstream, 0) != Z_OK) {
-            LogInfo("inflateInit failed");
-            recCursor->error = 1;
-            return res;
-        }
-
-        zstream.next_in = packetCursor->data + packetCursor->index;
-        zstream.avail_in = packetCursor->size - packetCursor->index;
-
         // TODO(traks): appropriate value?
-        size_t maxUncompressedSize = 2 * (1 << 20);
-        u8 * uncompressed = MallocInArena(arena, maxUncompressedSize);
-
-        zstream.next_out = uncompressed;
-        zstream.avail_out = maxUncompressedSize;
-
-        inflate(&zstream, Z_FINISH);
-
-        if (inflateEnd(&zstream) != Z_OK) {
-            LogInfo("inflateEnd failed");
-            recCursor->error = 1;
-            return res;
-        }
-
-        if (zstream.avail_in != 0) {
-            LogInfo("Didn't inflate entire packet");
+        i32 maxUncompressedSize = 2 * (1 << 20);
+        res = InflateZlib(packetCursor->data + packetCursor->index, packetCursor->size - packetCursor->index, maxUncompressedSize, arena);
+        if (res.error) {
+            LogInfo("Failed to inflate packet");
             recCursor->error = 1;
-            return res;
+            return (Cursor) {0};
         }
-
-        res.data = uncompressed;
-        res.size = zstream.total_out;
     } else {
         res.data = packetCursor->data + packetCursor->index;
         res.size = packetCursor->size - packetCursor->index;
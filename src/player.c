@@ -10,6 +10,7 @@
 #include "chunk.h"
 #include "packet.h"
 #include "player.h"
+#include "bitpack.h"
 
 // TODO(traks): apprioriate size
 #define MAX_JOINS_PER_TICK (16)
@@ -1361,13 +1362,23 @@ static void FinishPlayerPacket(Cursor * cursor, PlayerController * control) {
 }
 
 static void PackLightSection(Cursor * targetCursor, u8 * source) {
-    WriteVarU32(targetCursor, 2048);
-    u8 * target = targetCursor->data + targetCursor->index;
-    if (CursorSkip(targetCursor, 2048)) {
-        for (i32 i = 0; i < 2048; i++) {
-            target[i] = GetSectionLight(source, 2 * i) | (GetSectionLight(source, 2 * i + 1) << 4);
-        }
+    // NOTE(traks): we store light in the same nibble layout as the protocol
+    WriteVarU32(targetCursor, SECTION_LIGHT_SIZE);
+    WriteData(targetCursor, source, SECTION_LIGHT_SIZE);
+}
+
+// NOTE(traks): ID in vanilla's minecraft:block_entity_type registry
+static i32 GetBlockEntityTypeNetworkId(i32 type) {
+    char * resourceLoc;
+    switch (type) {
+    case BLOCK_ENTITY_BED: resourceLoc = "minecraft:bed"; break;
+    default:
+        assert(0);
+        return 0;
     }
+    i32 res = ResolveRegistryEntryId(&serv->blockEntityTypeRegistry, STR(resourceLoc));
+    assert(res >= 0);
+    return res;
 }
 
 void
@@ -1467,24 +1478,12 @@ send_chunk_fully(Cursor * send_cursor, Chunk * ch,
             // number of longs used for the block states
             int longs = (16 * 16 * 16 + blocks_per_long - 1) / blocks_per_long;
             WriteVarU32(send_cursor, longs);
-            u64 val = 0;
-            int offset = 0;
-            assert(blocks_per_long == 4);
 
             u8 * cursorData = send_cursor->data + send_cursor->index;
             if (CursorSkip(send_cursor, longs * 8)) {
-                for (i32 longIndex = 0; longIndex < longs; longIndex++) {
-                    u16 blockStates[4];
-                    blockStates[0] = SectionGetBlockState(&section->blocks, 4 * longIndex + 0);
-                    blockStates[1] = SectionGetBlockState(&section->blocks, 4 * longIndex + 1);
-                    blockStates[2] = SectionGetBlockState(&section->blocks, 4 * longIndex + 2);
-                    blockStates[3] = SectionGetBlockState(&section->blocks, 4 * longIndex + 3);
-                    u64 longValue = ((u64) blockStates[0])
-                            | ((u64) blockStates[1] << 15)
-                            | ((u64) blockStates[2] << 30)
-                            | ((u64) blockStates[3] << 45);
-                    WriteDirectU64(cursorData + (8 * longIndex), longValue);
-                }
+                u16 blockStates[4096];
+                SectionGetAllBlockStates(&section->blocks, blockStates);
+                PackBlockStates(blockStates, bits_per_block, cursorData);
             }
         }
 
@@ -1495,8 +1494,28 @@ send_chunk_fully(Cursor * send_cursor, Chunk * ch,
         WriteVarU32(send_cursor, 0);
     }
 
-    // number of block entities
-    WriteVarU32(send_cursor, 0);
+    // NOTE(traks): block entities without a type haven't been set up yet, the
+    // client doesn't need to know about them
+    i32 blockEntityCount = 0;
+    i32 iterator = 0;
+    for (block_entity_base * entity; (entity = ChunkNextBlockEntity(ch, &iterator)) != NULL; ) {
+        blockEntityCount += (entity->type != BLOCK_ENTITY_NULL);
+    }
+    WriteVarU32(send_cursor, blockEntityCount);
+
+    iterator = 0;
+    for (block_entity_base * entity; (entity = ChunkNextBlockEntity(ch, &iterator)) != NULL; ) {
+        if (entity->type == BLOCK_ENTITY_NULL) {
+            continue;
+        }
+        WriteU8(send_cursor, (entity->pos.x << 4) | entity->pos.z);
+        WriteU16(send_cursor, entity->pos.y);
+        WriteVarU32(send_cursor, GetBlockEntityTypeNetworkId(entity->type));
+        // NOTE(traks): the client only needs the type for the block entities
+        // we have, so send an empty compound
+        WriteU8(send_cursor, NBT_TAG_COMPOUND);
+        WriteU8(send_cursor, NBT_TAG_END);
+    }
 
     EndTimings(WriteBlocks);
 
@@ -1511,12 +1530,28 @@ send_chunk_fully(Cursor * send_cursor, Chunk * ch,
 
     i32 lightSections = LIGHT_SECTIONS_PER_CHUNK;
     // @NOTE(traks) light sections present as arrays in this packet
-    u64 sky_light_mask = (0x1 << lightSections) - 1;
-    u64 block_light_mask = (0x1 << lightSections) - 1;
+    u64 sky_light_mask = 0;
+    u64 block_light_mask = 0;
     // @NOTE(traks) sections with all light values equal to 0
     u64 zero_sky_light_mask = 0;
     u64 zero_block_light_mask = 0;
 
+    u8 * zeroLight = GetUniformSectionLight(0);
+    for (int sectionIndex = 0; sectionIndex < lightSections; sectionIndex++) {
+        LightSection * section = ch->lightSections + sectionIndex;
+        u64 sectionBit = (u64) 1 << sectionIndex;
+        if (section->skyLight == zeroLight) {
+            zero_sky_light_mask |= sectionBit;
+        } else {
+            sky_light_mask |= sectionBit;
+        }
+        if (section->blockLight == zeroLight) {
+            zero_block_light_mask |= sectionBit;
+        } else {
+            block_light_mask |= sectionBit;
+        }
+    }
+
     WriteVarU32(send_cursor, 1);
     WriteU64(send_cursor, sky_light_mask);
     WriteVarU32(send_cursor, 1);
@@ -1526,16 +1561,20 @@ send_chunk_fully(Cursor * send_cursor, Chunk * ch,
     WriteVarU32(send_cursor, 1);
     WriteU64(send_cursor, zero_block_light_mask);
 
-    WriteVarU32(send_cursor, lightSections);
+    WriteVarU32(send_cursor, __builtin_popcountll(sky_light_mask));
     for (int sectionIndex = 0; sectionIndex < lightSections; sectionIndex++) {
-        LightSection * section = ch->lightSections + sectionIndex;
-        PackLightSection(send_cursor, section->skyLight);
+        if (sky_light_mask & ((u64) 1 << sectionIndex)) {
+            LightSection * section = ch->lightSections + sectionIndex;
+            PackLightSection(send_cursor, section->skyLight);
+        }
     }
 
-    WriteVarU32(send_cursor, lightSections);
+    WriteVarU32(send_cursor, __builtin_popcountll(block_light_mask));
     for (int sectionIndex = 0; sectionIndex < lightSections; sectionIndex++) {
-        LightSection * section = ch->lightSections + sectionIndex;
-        PackLightSection(send_cursor, section->blockLight);
+        if (block_light_mask & ((u64) 1 << sectionIndex)) {
+            LightSection * section = ch->lightSections + sectionIndex;
+            PackLightSection(send_cursor, section->blockLight);
+        }
     }
 
     EndTimings(WriteLight);
@@ -2278,10 +2317,6 @@ static void UpdateChunkCache(PlayerController * control, Entity * player, Cursor
                 continue;
             }
 
-            if (cacheEntry->flags & PLAYER_CHUNK_ADDED_INTEREST) {
-                AddChunkInterest(pos, -1);
-            }
-
             if (cacheEntry->flags & PLAYER_CHUNK_SENT) {
                 BeginPacket(sendCursor, CBP_FORGET_LEVEL_CHUNK);
                 WriteU32(sendCursor, z);
@@ -2293,6 +2328,47 @@ static void UpdateChunkCache(PlayerController * control, Entity * player, Cursor
         }
     }
 
+    // NOTE(traks): the chunk system figures out which chunks to load and unload
+    ChunkRegion interestRegion = {
+        .worldId = nextChunkCacheWorldId,
+        .minX = nextChunkCacheMinX,
+        .minZ = nextChunkCacheMinZ,
+        .maxX = nextChunkCacheMaxX,
+        .maxZ = nextChunkCacheMaxZ,
+    };
+    if (control->chunkInterestId == 0) {
+        control->chunkInterestId = RegisterChunkInterest(interestRegion, CHUNK_INTEREST_NORMAL);
+    } else {
+        MoveChunkInterest(control->chunkInterestId, interestRegion);
+    }
+
+    // NOTE(traks): preload chunks in the direction the player is moving in, so
+    // they are hopefully ready by the time the player gets there
+    i32 moveX = nextChunkCacheCentreX - control->chunkCacheCentreX;
+    i32 moveZ = nextChunkCacheCentreZ - control->chunkCacheCentreZ;
+    if ((moveX != 0 || moveZ != 0) && nextChunkCacheWorldId == control->chunkCacheWorldId) {
+        control->lastChunkCacheMoveTick = serv->current_tick;
+        i32 offsetX = CLAMP(moveX, -1, 1) * SPECULATIVE_CHUNK_LOAD_DISTANCE;
+        i32 offsetZ = CLAMP(moveZ, -1, 1) * SPECULATIVE_CHUNK_LOAD_DISTANCE;
+        ChunkRegion speculativeRegion = {
+            .worldId = nextChunkCacheWorldId,
+            .minX = nextChunkCacheMinX + offsetX,
+            .minZ = nextChunkCacheMinZ + offsetZ,
+            .maxX = nextChunkCacheMaxX + offsetX,
+            .maxZ = nextChunkCacheMaxZ + offsetZ,
+        };
+        if (control->speculativeChunkInterestId == 0) {
+            control->speculativeChunkInterestId = RegisterChunkInterest(speculativeRegion, CHUNK_INTEREST_SPECULATIVE);
+        } else {
+            MoveChunkInterest(control->speculativeChunkInterestId, speculativeRegion);
+        }
+    } else if (control->speculativeChunkInterestId != 0
+            && (serv->current_tick - control->lastChunkCacheMoveTick > SPECULATIVE_CHUNK_LOAD_TIMEOUT
+            || nextChunkCacheWorldId != control->chunkCacheWorldId)) {
+        ReleaseChunkInterest(control->speculativeChunkInterestId);
+        control->speculativeChunkInterestId = 0;
+    }
+
     control->chunkCacheRadius = control->nextChunkCacheRadius;
     control->chunkCacheCentreX = nextChunkCacheCentreX;
     control->chunkCacheCentreZ = nextChunkCacheCentreZ;
@@ -2323,6 +2399,12 @@ static void SendTrackedBlockChanges(PlayerController * control, Cursor * sendCur
             continue;
         }
 
+        if (chunk->changedFully) {
+            // NOTE(traks): send the chunk again below
+            cacheEntry->flags &= ~PLAYER_CHUNK_SENT;
+            continue;
+        }
+
         Chunk * ch = changedChunks[chunkIndex];
         assert(ch != NULL);
 
@@ -2568,7 +2650,6 @@ send_packets_to_player(PlayerController * control, Entity * player, MemoryArena
     // don't need to wait for the chunk they are in to load) and allows
     // players to move around much earlier.
     int newly_sent_chunks = 0;
-    int newInterestAdded = 0;
     int chunk_cache_diam = 2 * control->chunkCacheRadius + 1;
     int chunk_cache_area = chunk_cache_diam * chunk_cache_diam;
     int off_x = 0;
@@ -2582,13 +2663,6 @@ send_packets_to_player(PlayerController * control, Entity * player, MemoryArena
         PlayerChunkCacheEntry * cacheEntry = control->chunkCache + cache_index;
         WorldChunkPos pos = {.worldId = player->worldId, .x = x, .z = z};
 
-        if (!(cacheEntry->flags & PLAYER_CHUNK_ADDED_INTEREST)
-                && newInterestAdded < MAX_CHUNK_LOADS_PER_TICK) {
-            AddChunkInterest(pos, 1);
-            cacheEntry->flags |= PLAYER_CHUNK_ADDED_INTEREST;
-            newInterestAdded++;
-        }
-
         if (!(cacheEntry->flags & PLAYER_CHUNK_SENT)
                 && newly_sent_chunks < MAX_CHUNK_SENDS_PER_TICK) {
             Chunk * ch = GetChunkIfLoaded(pos);
@@ -2935,20 +3009,8 @@ static void DestroyPlayer(PlayerController * control) {
     close(control->sock);
     EndTimings(SystemClose);
 
-    i32 chunk_cache_min_x = control->chunkCacheCentreX - control->chunkCacheRadius;
-    i32 chunk_cache_max_x = control->chunkCacheCentreX + control->chunkCacheRadius;
-    i32 chunk_cache_min_z = control->chunkCacheCentreZ - control->chunkCacheRadius;
-    i32 chunk_cache_max_z = control->chunkCacheCentreZ + control->chunkCacheRadius;
-
-    for (i32 x = chunk_cache_min_x; x <= chunk_cache_max_x; x++) {
-        for (i32 z = chunk_cache_min_z; z <= chunk_cache_max_z; z++) {
-            WorldChunkPos pos = {.worldId = control->chunkCacheWorldId, .x = x, .z = z};
-            PlayerChunkCacheEntry * cacheEntry = control->chunkCache + chunk_cache_index(pos.xz);
-            if (cacheEntry->flags & PLAYER_CHUNK_ADDED_INTEREST) {
-                AddChunkInterest(pos, -1);
-            }
-        }
-    }
+    ReleaseChunkInterest(control->chunkInterestId);
+    ReleaseChunkInterest(control->speculativeChunkInterestId);
 
     free(control->recBuffer);
     free(control->sendBuffer);
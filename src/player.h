@@ -4,7 +4,6 @@
 #include "shared.h"
 
 #define PLAYER_CHUNK_SENT (0x1 << 0)
-#define PLAYER_CHUNK_ADDED_INTEREST (0x1 << 1)
 
 typedef struct {
     u8 flags;
@@ -73,6 +72,9 @@ typedef struct {
     i32 chunkCacheWorldId;
     // @TODO(traks) maybe this should just be a bitmap
     PlayerChunkCacheEntry chunkCache[MAX_CHUNK_CACHE_DIAM * MAX_CHUNK_CACHE_DIAM];
+    ChunkInterestId chunkInterestId;
+    ChunkInterestId speculativeChunkInterestId;
+    i64 lastChunkCacheMoveTick;
 
     u32 lastSentTeleportId;
 
@@ -0,0 +1,233 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "region.h"
+#include "buffer.h"
+
+// NOTE(traks): upper bound on the number of region files we keep open. Also
+// limited by the process's file descriptor limit
+#define MAX_OPEN_REGION_FILES (64)
+
+typedef struct {
+    pthread_mutex_t mutex;
+    // NOTE(traks): signalled when a region file finished loading, or when a
+    // region file's ref count drops to 0 and it becomes evictable
+    pthread_cond_t cond;
+    RegionFile files[MAX_OPEN_REGION_FILES];
+    // NOTE(traks): files that are being opened, must wait for these
+    u8 loading[MAX_OPEN_REGION_FILES];
+    i32 fileLimit;
+    u64 useCounter;
+} RegionCache;
+
+static RegionCache regionCache;
+
+void InitRegionCache(void) {
+    if (pthread_mutex_init(&regionCache.mutex, NULL)) {
+        LogErrno("Failed to create region cache mutex: %s");
+        exit(1);
+    }
+    if (pthread_cond_init(&regionCache.cond, NULL)) {
+        LogErrno("Failed to create region cache condition: %s");
+        exit(1);
+    }
+
+    regionCache.fileLimit = MAX_OPEN_REGION_FILES;
+    struct rlimit fdLimit;
+    if (getrlimit(RLIMIT_NOFILE, &fdLimit) == 0 && fdLimit.rlim_cur != RLIM_INFINITY) {
+        // NOTE(traks): leave plenty of file descriptors for network
+        // connections and such
+        regionCache.fileLimit = MAX(1, MIN(regionCache.fileLimit, (i64) fdLimit.rlim_cur / 4));
+    }
+}
+
+static char * GetWorldDirectory(i32 worldId) {
+    if (worldId == 1) {
+        return "world";
+    }
+    return NULL;
+}
+
+static void CloseRegionFile(int fd, u8 * mapping, i64 fileSize) {
+    BeginTimings(CloseFile);
+    if (mapping != NULL) {
+        munmap(mapping, fileSize);
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    EndTimings(CloseFile);
+}
+
+static void OpenRegionFile(RegionFile * region) {
+    region->fd = -1;
+    region->fileSize = 0;
+    region->mapping = NULL;
+    memset(region->locations, 0, sizeof region->locations);
+    memset(region->timestamps, 0, sizeof region->timestamps);
+
+    char * worldName = GetWorldDirectory(region->worldId);
+    if (worldName == NULL) {
+        LogInfo("Unknown world ID: %lld", (i64) region->worldId);
+        return;
+    }
+
+    char fileName[64];
+    snprintf(fileName, sizeof fileName, "%s/region/r.%d.%d.mca", worldName, region->regionX, region->regionZ);
+
+    BeginTimings(OpenFile);
+    int fd = open(fileName, O_RDONLY);
+    EndTimings(OpenFile);
+    if (fd == -1) {
+        LogErrno("Failed to open region file: %s");
+        return;
+    }
+
+    struct stat regionStat;
+    if (fstat(fd, &regionStat)) {
+        LogErrno("Failed to get region file stat: %s");
+        close(fd);
+        return;
+    }
+
+    u8 header[2 * 4 * REGION_CHUNKS];
+    i64 headerSize = 0;
+    while (headerSize < (i64) sizeof header) {
+        ssize_t bytesRead = pread(fd, header + headerSize, sizeof header - headerSize, headerSize);
+        if (bytesRead == -1) {
+            LogErrno("Failed to read region file header: %s");
+            close(fd);
+            return;
+        }
+        if (bytesRead == 0) {
+            break;
+        }
+        headerSize += bytesRead;
+    }
+
+    // NOTE(traks): a region file with an incomplete header is treated as if it
+    // contains no chunks, but we keep it open anyway
+    if (headerSize == (i64) sizeof header) {
+        Cursor cursor = {.data = header, .size = sizeof header};
+        for (i32 index = 0; index < REGION_CHUNKS; index++) {
+            region->locations[index] = ReadU32(&cursor);
+        }
+        for (i32 index = 0; index < REGION_CHUNKS; index++) {
+            region->timestamps[index] = ReadU32(&cursor);
+        }
+    } else {
+        LogInfo("Region file header is incomplete");
+    }
+
+    // NOTE(traks): mapping costs nothing but address space, so always map the
+    // file in case the loader wants to decode straight out of the mapping
+    if (regionStat.st_size > 0) {
+        void * mapping = mmap(NULL, regionStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            LogErrno("Failed to map region file: %s");
+        } else {
+            // NOTE(traks): chunks are read sparsely, don't let the kernel read
+            // ahead. The loader hints which pages it needs
+            madvise(mapping, regionStat.st_size, MADV_RANDOM);
+            region->mapping = mapping;
+        }
+    }
+
+    region->fd = fd;
+    region->fileSize = regionStat.st_size;
+}
+
+RegionFile * AcquireRegionFile(i32 worldId, i32 regionX, i32 regionZ) {
+    BeginTimings(AcquireRegionFile);
+
+    RegionCache * cache = &regionCache;
+    pthread_mutex_lock(&cache->mutex);
+
+    i32 fileIndex;
+    for (;;) {
+        i32 foundIndex = -1;
+        i32 victimIndex = -1;
+        for (i32 index = 0; index < cache->fileLimit; index++) {
+            RegionFile * region = cache->files + index;
+            if (!region->inUse) {
+                if (victimIndex == -1 || cache->files[victimIndex].inUse) {
+                    victimIndex = index;
+                }
+            } else if (region->worldId == worldId && region->regionX == regionX && region->regionZ == regionZ) {
+                foundIndex = index;
+                break;
+            } else if (region->refCount == 0) {
+                if (victimIndex == -1 || (cache->files[victimIndex].inUse && region->lastUse < cache->files[victimIndex].lastUse)) {
+                    victimIndex = index;
+                }
+            }
+        }
+
+        if (foundIndex != -1) {
+            if (cache->loading[foundIndex]) {
+                // NOTE(traks): someone else is opening it
+                pthread_cond_wait(&cache->cond, &cache->mutex);
+                continue;
+            }
+            RegionFile * region = cache->files + foundIndex;
+            region->refCount++;
+            region->lastUse = ++cache->useCounter;
+            pthread_mutex_unlock(&cache->mutex);
+            EndTimings(AcquireRegionFile);
+            return region;
+        }
+
+        if (victimIndex == -1) {
+            // NOTE(traks): all region files are being read from, wait until
+            // one of them is released
+            pthread_cond_wait(&cache->cond, &cache->mutex);
+            continue;
+        }
+
+        fileIndex = victimIndex;
+        break;
+    }
+
+    // NOTE(traks): claim the slot, then do the file IO without holding the
+    // lock, so other threads can keep using the other region files
+    RegionFile * region = cache->files + fileIndex;
+    int oldFd = region->inUse ? region->fd : -1;
+    u8 * oldMapping = region->inUse ? region->mapping : NULL;
+    i64 oldFileSize = region->fileSize;
+    region->worldId = worldId;
+    region->regionX = regionX;
+    region->regionZ = regionZ;
+    region->fd = -1;
+    region->mapping = NULL;
+    region->inUse = 1;
+    region->refCount = 1;
+    cache->loading[fileIndex] = 1;
+    pthread_mutex_unlock(&cache->mutex);
+
+    CloseRegionFile(oldFd, oldMapping, oldFileSize);
+    OpenRegionFile(region);
+
+    pthread_mutex_lock(&cache->mutex);
+    cache->loading[fileIndex] = 0;
+    region->lastUse = ++cache->useCounter;
+    pthread_cond_broadcast(&cache->cond);
+    pthread_mutex_unlock(&cache->mutex);
+
+    EndTimings(AcquireRegionFile);
+    return region;
+}
+
+void ReleaseRegionFile(RegionFile * region) {
+    RegionCache * cache = &regionCache;
+    pthread_mutex_lock(&cache->mutex);
+    assert(region->refCount > 0);
+    region->refCount--;
+    if (region->refCount == 0) {
+        pthread_cond_broadcast(&cache->cond);
+    }
+    pthread_mutex_unlock(&cache->mutex);
+}
@@ -0,0 +1,45 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include <pthread.h>
+#include "base.h"
+
+// NOTE(traks): Thread-safe cache of open region files. Keeps the file
+// descriptor and the parsed header of the most recently used region files
+// around, so loading the chunks of a region doesn't open the file and read its
+// header over and over again. Chunk data should be read with pread or straight
+// from the file's mapping, so multiple threads can read from the same region
+// file at the same time.
+
+#define REGION_CHUNKS (32 * 32)
+
+typedef struct RegionFile {
+    i32 worldId;
+    i32 regionX;
+    i32 regionZ;
+    // NOTE(traks): -1 if the region file couldn't be opened. We remember this
+    // too, so we don't try to open missing region files for every chunk
+    int fd;
+    i64 fileSize;
+    // NOTE(traks): read-only mapping of the entire file, NULL if the file
+    // couldn't be mapped. Only valid while the region file is acquired. The
+    // world must not be modified while mapped, that could crash the server
+    u8 * mapping;
+    // NOTE(traks): sector offset << 8 | sector count, indexed by
+    // (z & 0x1f) << 5 | (x & 0x1f)
+    u32 locations[REGION_CHUNKS];
+    u32 timestamps[REGION_CHUNKS];
+
+    // NOTE(traks): owned by the cache
+    i32 refCount;
+    u64 lastUse;
+    u8 inUse;
+} RegionFile;
+
+void InitRegionCache(void);
+// NOTE(traks): never returns NULL, but the fd of the returned region file may
+// be -1. Must be released again
+RegionFile * AcquireRegionFile(i32 worldId, i32 regionX, i32 regionZ);
+void ReleaseRegionFile(RegionFile * region);
+
+#endif
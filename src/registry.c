@@ -370,6 +370,57 @@ static void InitFluidRegistry(void) {
     AddRegistryTag(registry, "minecraft:lava", "minecraft:lava", "minecraft:flowing_lava", NULL);
 }
 
+static void InitBlockEntityTypeRegistry(void) {
+    Registry * registry = &serv->blockEntityTypeRegistry;
+    SetRegistryName(registry, "minecraft:block_entity_type");
+
+    AddRegistryEntry(registry, "minecraft:furnace");
+    AddRegistryEntry(registry, "minecraft:chest");
+    AddRegistryEntry(registry, "minecraft:trapped_chest");
+    AddRegistryEntry(registry, "minecraft:ender_chest");
+    AddRegistryEntry(registry, "minecraft:jukebox");
+    AddRegistryEntry(registry, "minecraft:dispenser");
+    AddRegistryEntry(registry, "minecraft:dropper");
+    AddRegistryEntry(registry, "minecraft:sign");
+    AddRegistryEntry(registry, "minecraft:hanging_sign");
+    AddRegistryEntry(registry, "minecraft:mob_spawner");
+    AddRegistryEntry(registry, "minecraft:creaking_heart");
+    AddRegistryEntry(registry, "minecraft:piston");
+    AddRegistryEntry(registry, "minecraft:brewing_stand");
+    AddRegistryEntry(registry, "minecraft:enchanting_table");
+    AddRegistryEntry(registry, "minecraft:end_portal");
+    AddRegistryEntry(registry, "minecraft:beacon");
+    AddRegistryEntry(registry, "minecraft:skull");
+    AddRegistryEntry(registry, "minecraft:daylight_detector");
+    AddRegistryEntry(registry, "minecraft:hopper");
+    AddRegistryEntry(registry, "minecraft:comparator");
+    AddRegistryEntry(registry, "minecraft:banner");
+    AddRegistryEntry(registry, "minecraft:structure_block");
+    AddRegistryEntry(registry, "minecraft:end_gateway");
+    AddRegistryEntry(registry, "minecraft:command_block");
+    AddRegistryEntry(registry, "minecraft:shulker_box");
+    AddRegistryEntry(registry, "minecraft:bed");
+    AddRegistryEntry(registry, "minecraft:conduit");
+    AddRegistryEntry(registry, "minecraft:barrel");
+    AddRegistryEntry(registry, "minecraft:smoker");
+    AddRegistryEntry(registry, "minecraft:blast_furnace");
+    AddRegistryEntry(registry, "minecraft:lectern");
+    AddRegistryEntry(registry, "minecraft:bell");
+    AddRegistryEntry(registry, "minecraft:jigsaw");
+    AddRegistryEntry(registry, "minecraft:campfire");
+    AddRegistryEntry(registry, "minecraft:beehive");
+    AddRegistryEntry(registry, "minecraft:sculk_sensor");
+    AddRegistryEntry(registry, "minecraft:calibrated_sculk_sensor");
+    AddRegistryEntry(registry, "minecraft:sculk_catalyst");
+    AddRegistryEntry(registry, "minecraft:sculk_shrieker");
+    AddRegistryEntry(registry, "minecraft:chiseled_bookshelf");
+    AddRegistryEntry(registry, "minecraft:brushable_block");
+    AddRegistryEntry(registry, "minecraft:decorated_pot");
+    AddRegistryEntry(registry, "minecraft:crafter");
+    AddRegistryEntry(registry, "minecraft:trial_spawner");
+    AddRegistryEntry(registry, "minecraft:vault");
+}
+
 static void InitGameEventRegistry(void) {
     Registry * registry = &serv->gameEventRegistry;
     SetRegistryName(registry, "minecraft:game_event");
@@ -3833,6 +3884,7 @@ void InitRegistries(void) {
     // data initialisation code.
     InitEntityTypeRegistry();
     InitFluidRegistry();
+    InitBlockEntityTypeRegistry();
     InitGameEventRegistry();
     InitBiomeRegistry();
     InitChatTypeRegistry();
@@ -41,7 +41,14 @@ static_assert(BITS_PER_BLOCK_STATE <= MAX_BITS_PER_BLOCK_STATE, "Unsupported bit
 // Why? What is a good value? Should we base it on player network bandwidth?
 #define MAX_CHUNK_SENDS_PER_TICK (2)
 
-#define MAX_CHUNK_LOADS_PER_TICK (2)
+// NOTE(traks): how many chunks ahead of moving players we preload chunks, and
+// for how many ticks after they stop moving we keep those chunks around
+#define SPECULATIVE_CHUNK_LOAD_DISTANCE (4)
+#define SPECULATIVE_CHUNK_LOAD_TIMEOUT (5 * 20)
+
+// NOTE(traks): how much memory chunks no one is interested in may use, before
+// we start unloading them
+#define WARM_CHUNK_MEMORY_BUDGET ((i64) 128 << 20)
 
 // must be power of 2
 #define MAX_ENTITIES (1024)
@@ -2170,12 +2177,6 @@ typedef struct {
     i32 stringPoolCount;
 } Registry;
 
-typedef struct {
-    WorldBlockPos pos;
-    int from_direction;
-    i64 for_tick;
-} scheduled_block_update;
-
 typedef struct {
     WorldBlockPos pos;
     unsigned char from_direction;
@@ -2217,6 +2218,7 @@ typedef struct {
     Registry itemRegistry;
     Registry entityTypeRegistry;
     Registry fluidRegistry;
+    Registry blockEntityTypeRegistry;
     Registry gameEventRegistry;
     Registry biomeRegistry;
     Registry chatTypeRegistry;
@@ -2248,16 +2250,6 @@ typedef struct {
     // block state -> block type
     u16 block_type_by_state[MAX_BLOCK_STATES];
 
-    // @TODO(traks) this is the simplest but dumbest thing. Should really store
-    // this per chunk, since we need to save it when chunk is unloaded. Limit
-    // should also be way higher.
-
-    // @TODO(traks) remove scheduled block updates when a block changes or the
-    // chunk gets unloaded? Not sure if it really matters if a block gets
-    // updated 'unexpectedly'. What is the worst thing that could happen?
-    scheduled_block_update scheduled_block_updates[100];
-    int scheduled_block_update_count;
-
     MemoryArena * tickArena;
     MemoryArena * permanentArena;
 
@@ -0,0 +1,111 @@
+#include <sys/mman.h>
+#include "slab.h"
+
+#define SLAB_BATCH_SIZE (32)
+
+#define MAX_SLAB_ALLOCATORS (16)
+
+#define SLAB_REGION_SIZE (4 * (1 << 20))
+
+typedef struct {
+    void * objects[2 * SLAB_BATCH_SIZE];
+    i32 count;
+} SlabMagazine;
+
+static _Thread_local SlabMagazine magazines[MAX_SLAB_ALLOCATORS];
+static _Atomic i32 slabAllocatorCount;
+
+void InitSlabAllocator(SlabAllocator * slab, i32 objectSize) {
+    // NOTE(traks): need room to link free objects together
+    assert(objectSize >= (i32) sizeof (SlabFreeObject));
+
+    *slab = (SlabAllocator) {0};
+    slab->id = atomic_fetch_add_explicit(&slabAllocatorCount, 1, memory_order_relaxed);
+    assert(slab->id < MAX_SLAB_ALLOCATORS);
+    // NOTE(traks): keep objects aligned, so they don't share cache lines more
+    // than necessary
+    slab->objectSize = (objectSize + 63) / 64 * 64;
+    pthread_mutex_init(&slab->mutex, NULL);
+}
+
+static void RefillMagazine(SlabAllocator * slab, SlabMagazine * magazine) {
+    i32 batchBytes = SLAB_BATCH_SIZE * slab->objectSize;
+    u8 * carved = NULL;
+
+    pthread_mutex_lock(&slab->mutex);
+    SlabFreeObject * batch = slab->depot;
+    if (batch != NULL) {
+        slab->depot = batch->nextBatch;
+    } else {
+        if (slab->regionEnd - slab->regionNext < batchBytes) {
+            // TODO(traks): the tail of the previous region is wasted
+            i64 regionSize = MAX(SLAB_REGION_SIZE, batchBytes);
+            void * region = mmap(NULL, regionSize, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+            if (region == MAP_FAILED) {
+                pthread_mutex_unlock(&slab->mutex);
+                LogErrno("Failed to map slab region: %s");
+                return;
+            }
+            slab->regionNext = region;
+            slab->regionEnd = slab->regionNext + regionSize;
+            atomic_fetch_add_explicit(&slab->mappedBytes, regionSize, memory_order_relaxed);
+        }
+        carved = slab->regionNext;
+        slab->regionNext += batchBytes;
+    }
+    pthread_mutex_unlock(&slab->mutex);
+
+    if (batch != NULL) {
+        for (SlabFreeObject * object = batch; object != NULL; object = object->next) {
+            magazine->objects[magazine->count] = object;
+            magazine->count++;
+        }
+    } else {
+        for (i32 i = 0; i < SLAB_BATCH_SIZE; i++) {
+            magazine->objects[magazine->count] = carved + i * slab->objectSize;
+            magazine->count++;
+        }
+    }
+}
+
+static void FlushMagazine(SlabAllocator * slab, SlabMagazine * magazine) {
+    assert(magazine->count >= SLAB_BATCH_SIZE);
+
+    // NOTE(traks): link the batch together before taking the lock
+    i32 start = magazine->count - SLAB_BATCH_SIZE;
+    SlabFreeObject * batch = magazine->objects[start];
+    for (i32 i = start; i < magazine->count; i++) {
+        SlabFreeObject * object = magazine->objects[i];
+        object->next = (i + 1 < magazine->count ? magazine->objects[i + 1] : NULL);
+    }
+    magazine->count = start;
+
+    pthread_mutex_lock(&slab->mutex);
+    batch->nextBatch = slab->depot;
+    slab->depot = batch;
+    pthread_mutex_unlock(&slab->mutex);
+}
+
+void * SlabAlloc(SlabAllocator * slab) {
+    SlabMagazine * magazine = magazines + slab->id;
+    if (magazine->count == 0) {
+        RefillMagazine(slab, magazine);
+        if (magazine->count == 0) {
+            return NULL;
+        }
+    }
+    magazine->count--;
+    return magazine->objects[magazine->count];
+}
+
+void SlabFree(SlabAllocator * slab, void * object) {
+    if (object == NULL) {
+        return;
+    }
+    SlabMagazine * magazine = magazines + slab->id;
+    if (magazine->count == ARRAY_SIZE(magazine->objects)) {
+        FlushMagazine(slab, magazine);
+    }
+    magazine->objects[magazine->count] = object;
+    magazine->count++;
+}
@@ -0,0 +1,36 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include "base.h"
+
+// NOTE(traks): Thread-safe allocator for objects of a single fixed size. Memory
+// is carved out of large mmap'd regions and never returned to the OS. Each
+// thread keeps a magazine of free objects per allocator, so most allocations
+// and frees don't touch any shared state. Free objects are moved between
+// threads and the shared depot in batches.
+
+// NOTE(traks): all free objects in a batch are linked through next, and the
+// batches in the depot are linked through the first object of each batch
+typedef struct SlabFreeObject {
+    struct SlabFreeObject * next;
+    struct SlabFreeObject * nextBatch;
+} SlabFreeObject;
+
+typedef struct {
+    i32 id;
+    i32 objectSize;
+    pthread_mutex_t mutex;
+    SlabFreeObject * depot;
+    u8 * regionNext;
+    u8 * regionEnd;
+    _Atomic i64 mappedBytes;
+} SlabAllocator;
+
+void InitSlabAllocator(SlabAllocator * slab, i32 objectSize);
+// NOTE(traks): returns NULL if we ran out of memory
+void * SlabAlloc(SlabAllocator * slab);
+void SlabFree(SlabAllocator * slab, void * object);
+
+#endif
@@ -1,28 +1,298 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "task.h"
 
-static TaskQueueEntry PopOrAwaitTaskFromQueue(TaskQueue * queue) {
+// NOTE(traks): only address space, the OS backs the pages we touch
+#define SCRATCH_RESERVE_SIZE ((i32) 256 << 20)
+// NOTE(traks): touched pages up to this size stay around between tasks, past
+// this size we give them back to the OS at the end of the task
+#define SCRATCH_KEEP_SIZE ((i32) 4 << 20)
+#define MAX_SCRATCH_ARENAS (256)
+
+typedef struct {
+    MemoryArena arena;
+    // NOTE(traks): how far pages may have been touched since we last gave
+    // memory back to the OS
+    i32 touchedSize;
+    i32 inUse;
+    _Atomic i64 highWaterMark;
+} ScratchArena;
+
+static _Thread_local ScratchArena * threadScratch;
+static ScratchArena * _Atomic scratchArenas[MAX_SCRATCH_ARENAS];
+static _Atomic i32 scratchArenaCount;
+
+// NOTE(traks): rounds of looking for tasks before a worker goes to sleep
+#define TASK_SPIN_ROUNDS (64)
+
+// NOTE(traks): the worker running on this thread, if any
+static _Thread_local TaskWorker * currentWorker;
+
+static void CpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void WriteTaskSlot(TaskSlot * slot, TaskQueueEntry entry) {
+    atomic_store_explicit(&slot->callback, entry.callback, memory_order_relaxed);
+    atomic_store_explicit(&slot->data, entry.data, memory_order_relaxed);
+    atomic_store_explicit(&slot->deadlineTick, entry.deadlineTick, memory_order_relaxed);
+}
+
+static TaskQueueEntry ReadTaskSlot(TaskSlot * slot) {
+    TaskQueueEntry res = {
+        .callback = atomic_load_explicit(&slot->callback, memory_order_relaxed),
+        .data = atomic_load_explicit(&slot->data, memory_order_relaxed),
+        .deadlineTick = atomic_load_explicit(&slot->deadlineTick, memory_order_relaxed),
+    };
+    return res;
+}
+
+static i32 PushTaskToDeque(TaskDeque * deque, TaskQueueEntry entry) {
+    i64 bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+    i64 top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    if (bottom - top >= TASK_DEQUE_SIZE) {
+        return 0;
+    }
+    TaskSlot * slot = deque->slots + (bottom & (TASK_DEQUE_SIZE - 1));
+    WriteTaskSlot(slot, entry);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return 1;
+}
+
+static i32 PopTaskFromDeque(TaskDeque * deque, TaskQueueEntry * res) {
+    i64 bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    i64 top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+    if (top > bottom) {
+        // NOTE(traks): empty
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return 0;
+    }
+
+    TaskSlot * slot = deque->slots + (bottom & (TASK_DEQUE_SIZE - 1));
+    *res = ReadTaskSlot(slot);
+    if (top == bottom) {
+        // NOTE(traks): last task, race thieves for it
+        i32 won = atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+        return won;
+    }
+    return 1;
+}
+
+static i32 StealTaskFromDeque(TaskDeque * deque, TaskQueueEntry * res) {
+    i64 top = atomic_load_explicit(&deque->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    i64 bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+    if (top >= bottom) {
+        return 0;
+    }
+
+    TaskSlot * slot = deque->slots + (top & (TASK_DEQUE_SIZE - 1));
+    *res = ReadTaskSlot(slot);
+    // NOTE(traks): if this fails, someone else got the task first
+    return atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+static i32 PopTaskFromRing(TaskRing * ring, TaskQueueEntry * res) {
+    u32 size = ARRAY_SIZE(ring->entries);
     for (;;) {
-        TaskQueueEntry res = {0};
-        u32 size = ARRAY_SIZE(queue->entries);
-        u32 readIndex = atomic_load_explicit(&queue->readIndex, memory_order_acquire);
-        u32 writeIndex = atomic_load_explicit(&queue->writeIndex, memory_order_acquire);
+        u32 readIndex = atomic_load_explicit(&ring->readIndex, memory_order_acquire);
+        u32 writeIndex = atomic_load_explicit(&ring->writeIndex, memory_order_acquire);
         if (writeIndex == readIndex) {
-            pthread_mutex_lock(&queue->mutex);
-            u32 newWriteIndex = atomic_load_explicit(&queue->writeIndex, memory_order_acquire);
-            if (newWriteIndex != writeIndex) {
-                pthread_mutex_unlock(&queue->mutex);
-            } else {
-                pthread_cond_wait(&queue->cond, &queue->mutex);
-                pthread_mutex_unlock(&queue->mutex);
+            return 0;
+        }
+        TaskSlot * slot = ring->entries + readIndex % size;
+        *res = ReadTaskSlot(slot);
+        if (atomic_compare_exchange_strong_explicit(&ring->readIndex, &readIndex, readIndex + 1, memory_order_acq_rel, memory_order_relaxed)) {
+            return 1;
+        }
+    }
+}
+
+static i32 PushTaskToRing(TaskRing * ring, TaskQueueEntry entry) {
+    u32 size = ARRAY_SIZE(ring->entries);
+    for (;;) {
+        // NOTE(traks): read index first, so it can't be past the write commit
+        u32 readIndex = atomic_load_explicit(&ring->readIndex, memory_order_acquire);
+        u32 writeCommit = atomic_load_explicit(&ring->writeCommit, memory_order_acquire);
+
+        if (writeCommit - readIndex >= size) {
+            return 0;
+        }
+
+        if (atomic_compare_exchange_strong_explicit(&ring->writeCommit, &writeCommit, writeCommit + 1, memory_order_acq_rel, memory_order_relaxed)) {
+            // NOTE(traks): at this point no one can write to the index, other
+            // than us. Anyone else would have to write past the reader index,
+            // the but the reader index is waiting for us
+            TaskSlot * slot = ring->entries + writeCommit % size;
+            WriteTaskSlot(slot, entry);
+            // NOTE(traks): publish in the order of the commits
+            for (;;) {
+                u32 writeIndex = writeCommit;
+                if (atomic_compare_exchange_weak_explicit(&ring->writeIndex, &writeIndex, writeCommit + 1, memory_order_acq_rel, memory_order_relaxed)) {
+                    return 1;
+                }
+            }
+        }
+    }
+}
+
+static i32 FindTaskOfPriority(TaskWorker * worker, i32 priority, TaskQueueEntry * res) {
+    TaskQueue * queue = worker->queue;
+    if (PopTaskFromDeque(worker->deques + priority, res) || PopTaskFromRing(queue->rings + priority, res)) {
+        return 1;
+    }
+
+    // NOTE(traks): start at a random worker, so thieves spread out
+    u32 random = worker->randomState;
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    worker->randomState = random;
+
+    i32 workerCount = queue->workerCount;
+    i32 start = random % workerCount;
+    for (i32 i = 0; i < workerCount; i++) {
+        TaskWorker * victim = queue->workers + (start + i) % workerCount;
+        if (victim != worker && StealTaskFromDeque(victim->deques + priority, res)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static i32 IsTaskSlotDue(TaskSlot * slot, i64 currentTick) {
+    return atomic_load_explicit(&slot->deadlineTick, memory_order_relaxed) <= currentTick;
+}
+
+// NOTE(traks): only looks at the oldest tasks in the rings and our own deques,
+// looking through everyone's deques would take too long
+static i32 FindDueTask(TaskWorker * worker, TaskQueueEntry * res) {
+    TaskQueue * queue = worker->queue;
+    i64 currentTick = atomic_load_explicit(&queue->currentTick, memory_order_relaxed);
+    for (i32 priority = TASK_PRIORITY_CRITICAL + 1; priority < TASK_PRIORITY_COUNT; priority++) {
+        TaskRing * ring = queue->rings + priority;
+        u32 readIndex = atomic_load_explicit(&ring->readIndex, memory_order_acquire);
+        u32 writeIndex = atomic_load_explicit(&ring->writeIndex, memory_order_acquire);
+        if (readIndex != writeIndex && IsTaskSlotDue(ring->entries + readIndex % ARRAY_SIZE(ring->entries), currentTick)) {
+            if (PopTaskFromRing(ring, res)) {
+                return 1;
             }
-        } else {
-            u32 nextReadIndex = (readIndex + 1) % size;
-            res = queue->entries[readIndex];
-            if (atomic_compare_exchange_strong_explicit(&queue->readIndex, &readIndex, nextReadIndex, memory_order_acq_rel, memory_order_relaxed)) {
-                return res;
+        }
+
+        // NOTE(traks): the top of our deque holds our oldest task
+        TaskDeque * deque = worker->deques + priority;
+        i64 top = atomic_load_explicit(&deque->top, memory_order_acquire);
+        i64 bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+        if (top < bottom && IsTaskSlotDue(deque->slots + (top & (TASK_DEQUE_SIZE - 1)), currentTick)) {
+            if (StealTaskFromDeque(deque, res)) {
+                return 1;
             }
         }
     }
+    return 0;
+}
+
+static i32 FindTask(TaskWorker * worker, TaskQueueEntry * res) {
+    if (FindDueTask(worker, res)) {
+        return 1;
+    }
+
+    // NOTE(traks): Normally go by priority, but start with a lower priority
+    // every so often, so every priority gets a share of the picks. This way
+    // tasks of higher priority wait for at most one task of lower priority per
+    // worker
+    worker->pickCount++;
+    i32 first = TASK_PRIORITY_CRITICAL;
+    if (worker->pickCount % 16 == 0) {
+        first = TASK_PRIORITY_BACKGROUND;
+    } else if (worker->pickCount % 4 == 0) {
+        first = TASK_PRIORITY_NORMAL;
+    }
+    if (FindTaskOfPriority(worker, first, res)) {
+        return 1;
+    }
+    for (i32 priority = 0; priority < TASK_PRIORITY_COUNT; priority++) {
+        if (priority != first && FindTaskOfPriority(worker, priority, res)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static i32 HasTasks(TaskQueue * queue) {
+    for (i32 priority = 0; priority < TASK_PRIORITY_COUNT; priority++) {
+        TaskRing * ring = queue->rings + priority;
+        if (atomic_load_explicit(&ring->readIndex, memory_order_relaxed) != atomic_load_explicit(&ring->writeIndex, memory_order_relaxed)) {
+            return 1;
+        }
+        for (i32 workerIndex = 0; workerIndex < queue->workerCount; workerIndex++) {
+            TaskDeque * deque = queue->workers[workerIndex].deques + priority;
+            if (atomic_load_explicit(&deque->top, memory_order_relaxed) < atomic_load_explicit(&deque->bottom, memory_order_relaxed)) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static void WakeWorker(TaskQueue * queue) {
+    // NOTE(traks): pairs with the fence of workers going to sleep, so either
+    // they see the new task or we see them sleeping
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&queue->spinningWorkers, memory_order_relaxed) > 0) {
+        // NOTE(traks): they'll find the task before going to sleep
+        return;
+    }
+    if (atomic_load_explicit(&queue->sleepingWorkers, memory_order_relaxed) > 0) {
+        pthread_mutex_lock(&queue->mutex);
+        pthread_cond_signal(&queue->cond);
+        pthread_mutex_unlock(&queue->mutex);
+    }
+}
+
+static i32 AwaitTask(TaskWorker * worker, TaskQueueEntry * res) {
+    TaskQueue * queue = worker->queue;
+
+    // NOTE(traks): new tasks often come in quickly after each other, so spin
+    // for a bit before sleeping. Don't let every idle worker spin though, so
+    // idle cores don't all hammer the deques
+    if (atomic_fetch_add_explicit(&queue->spinningWorkers, 1, memory_order_seq_cst) < MAX(queue->workerCount / 2, 1)) {
+        for (i32 round = 0; round < TASK_SPIN_ROUNDS; round++) {
+            if (FindTask(worker, res)) {
+                // NOTE(traks): pushes don't wake anyone while we spin, so if
+                // we were the last one spinning, have someone else take over
+                // in case more tasks come in
+                if (atomic_fetch_sub_explicit(&queue->spinningWorkers, 1, memory_order_seq_cst) == 1) {
+                    WakeWorker(queue);
+                }
+                return 1;
+            }
+            for (i32 i = 0; i < 32; i++) {
+                CpuRelax();
+            }
+        }
+    }
+    atomic_fetch_sub_explicit(&queue->spinningWorkers, 1, memory_order_seq_cst);
+
+    pthread_mutex_lock(&queue->mutex);
+    atomic_fetch_add_explicit(&queue->sleepingWorkers, 1, memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!HasTasks(queue)) {
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+    atomic_fetch_sub_explicit(&queue->sleepingWorkers, 1, memory_order_seq_cst);
+    pthread_mutex_unlock(&queue->mutex);
+    return 0;
 }
 
 static void * RunThread(void * arg) {
@@ -30,11 +300,12 @@ static void * RunThread(void * arg) {
     TracyCSetThreadName("Worker");
 #endif
 
-    TaskQueue * queue = arg;
+    TaskWorker * worker = arg;
+    currentWorker = worker;
 
     for (;;) {
-        TaskQueueEntry found = PopOrAwaitTaskFromQueue(queue);
-        if (found.callback != NULL) {
+        TaskQueueEntry found;
+        if (FindTask(worker, &found) || AwaitTask(worker, &found)) {
             found.callback(found.data);
         }
     }
@@ -45,11 +316,25 @@ static void * RunThread(void * arg) {
 void CreateTaskQueue(TaskQueue * queue, i32 threadCount) {
     // TODO(traks): handle errors
 
+    if (threadCount <= 0) {
+        threadCount = MAX(sysconf(_SC_NPROCESSORS_ONLN) - 1, 1);
+    }
+
+    *queue = (TaskQueue) {0};
     pthread_mutex_init(&queue->mutex, NULL);
     pthread_cond_init(&queue->cond, NULL);
+    queue->workerCount = threadCount;
+    queue->workers = aligned_alloc(alignof (TaskWorker), threadCount * sizeof *queue->workers);
+    memset(queue->workers, 0, threadCount * sizeof *queue->workers);
+    for (i32 threadIndex = 0; threadIndex < threadCount; threadIndex++) {
+        TaskWorker * worker = queue->workers + threadIndex;
+        worker->queue = queue;
+        // NOTE(traks): xorshift state must not be 0
+        worker->randomState = 0x9e3779b9 * (threadIndex + 1);
+    }
 
-    // TODO(traks): should we have different policies/priorities for different
-    // queues? E.g. the background queue and a possible high priority queue
+    // NOTE(traks): tasks have priorities of their own, so all workers run at
+    // the same OS priority
     // TODO(traks): Should these settings be different when we profile, even for
     // background queues?
     pthread_attr_t attributes;
@@ -65,44 +350,92 @@ void CreateTaskQueue(TaskQueue * queue, i32 threadCount) {
 
     for (i32 threadIndex = 0; threadIndex < threadCount; threadIndex++) {
         pthread_t thread;
-        pthread_create(&thread, &attributes, RunThread, queue);
+        pthread_create(&thread, &attributes, RunThread, queue->workers + threadIndex);
     }
 }
 
-i32 PushTaskToQueue(TaskQueue * queue, TaskQueueCallback callback, void * data) {
-    u32 size = ARRAY_SIZE(queue->entries);
+i32 PushPrioritisedTask(TaskQueue * queue, i32 priority, i64 deadlineTick, TaskQueueCallback callback, void * data) {
+    assert(priority >= 0 && priority < TASK_PRIORITY_COUNT);
     TaskQueueEntry entry = {
         .callback = callback,
         .data = data,
+        .deadlineTick = deadlineTick,
     };
 
-    for (;;) {
-        u32 writeCommit = atomic_load_explicit(&queue->writeCommit, memory_order_acquire);
-        u32 readIndex = atomic_load_explicit(&queue->readIndex, memory_order_acquire);
-        u32 writeIndex = writeCommit % size;
-        u32 nextWriteIndex = (writeCommit + 1) % size;
+    TaskWorker * worker = currentWorker;
+    i32 pushed = 0;
+    if (worker != NULL && worker->queue == queue) {
+        pushed = PushTaskToDeque(worker->deques + priority, entry);
+    }
+    if (!pushed) {
+        pushed = PushTaskToRing(queue->rings + priority, entry);
+    }
+    if (pushed) {
+        WakeWorker(queue);
+    }
+    return pushed;
+}
 
-        if (nextWriteIndex == readIndex) {
-            return 0;
+i32 PushTaskToQueue(TaskQueue * queue, TaskQueueCallback callback, void * data) {
+    return PushPrioritisedTask(queue, TASK_PRIORITY_NORMAL, TASK_NO_DEADLINE, callback, data);
+}
+
+void SetTaskQueueTick(TaskQueue * queue, i64 tick) {
+    atomic_store_explicit(&queue->currentTick, tick, memory_order_relaxed);
+}
+
+MemoryArena * BeginThreadScratch(void) {
+    ScratchArena * scratch = threadScratch;
+    if (scratch == NULL) {
+        scratch = calloc(1, sizeof *scratch);
+        void * data = mmap(NULL, SCRATCH_RESERVE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+        if (scratch == NULL || data == MAP_FAILED) {
+            LogInfo("Failed to allocate scratch arena");
+            exit(1);
+        }
+        scratch->arena = (MemoryArena) {.data = data, .size = SCRATCH_RESERVE_SIZE};
+        i32 scratchIndex = atomic_fetch_add_explicit(&scratchArenaCount, 1, memory_order_relaxed);
+        if (scratchIndex < MAX_SCRATCH_ARENAS) {
+            atomic_store_explicit(&scratchArenas[scratchIndex], scratch, memory_order_release);
         }
+        threadScratch = scratch;
+    }
 
-        // @NOTE(traks) if a bunch of reads/writes happen here, the write commit
-        // theoretically be wrapped around back to our position, and then we can
-        // cause trouble. Therefore we don't mod the write commit by the size.
+    assert(!scratch->inUse);
+    scratch->inUse = 1;
+    ClearArena(&scratch->arena);
+    scratch->arena.peakIndex = 0;
+    return &scratch->arena;
+}
 
-        if (atomic_compare_exchange_strong_explicit(&queue->writeCommit, &writeCommit, writeCommit + 1, memory_order_acq_rel, memory_order_relaxed)) {
-            // NOTE(traks): at this point no one can write to the index, other
-            // than us. Anyone else would have to write past the reader index,
-            // the but the reader index is waiting for us
-            queue->entries[writeIndex] = entry;
-            for (;;) {
-                if (atomic_compare_exchange_weak_explicit(&queue->writeIndex, &writeIndex, nextWriteIndex, memory_order_acq_rel, memory_order_relaxed)) {
-                    pthread_mutex_lock(&queue->mutex);
-                    pthread_cond_signal(&queue->cond);
-                    pthread_mutex_unlock(&queue->mutex);
-                    return 1;
-                }
-            }
+void EndThreadScratch(MemoryArena * arena) {
+    ScratchArena * scratch = threadScratch;
+    assert(arena == &scratch->arena && scratch->inUse);
+    scratch->inUse = 0;
+
+    i32 used = MAX(arena->index, arena->peakIndex);
+    if (used > atomic_load_explicit(&scratch->highWaterMark, memory_order_relaxed)) {
+        atomic_store_explicit(&scratch->highWaterMark, used, memory_order_relaxed);
+    }
+
+    scratch->touchedSize = MAX(scratch->touchedSize, used);
+    if (scratch->touchedSize > SCRATCH_KEEP_SIZE) {
+        // NOTE(traks): the pages read as zero afterwards, and are backed by
+        // memory again once touched
+        madvise(arena->data + SCRATCH_KEEP_SIZE, scratch->touchedSize - SCRATCH_KEEP_SIZE, MADV_DONTNEED);
+        scratch->touchedSize = SCRATCH_KEEP_SIZE;
+    }
+}
+
+i32 GetThreadScratchHighWaterMarks(i64 * marks, i32 maxCount) {
+    i32 count = MIN(atomic_load_explicit(&scratchArenaCount, memory_order_relaxed), MIN(maxCount, MAX_SCRATCH_ARENAS));
+    i32 res = 0;
+    for (i32 scratchIndex = 0; scratchIndex < count; scratchIndex++) {
+        ScratchArena * scratch = atomic_load_explicit(&scratchArenas[scratchIndex], memory_order_acquire);
+        if (scratch != NULL) {
+            marks[res] = atomic_load_explicit(&scratch->highWaterMark, memory_order_relaxed);
+            res++;
         }
     }
+    return res;
 }
@@ -7,23 +7,105 @@
 
 typedef void (* TaskQueueCallback)(void * data);
 
+// NOTE(traks): Workers take tasks of higher priority first, but every so often
+// start with a lower priority instead, so no priority starves. Tasks of
+// different priorities are kept apart, so e.g. chunk loads near players never
+// wait behind a pile of background work.
+enum {
+    // NOTE(traks): players are waiting for these
+    TASK_PRIORITY_CRITICAL,
+    TASK_PRIORITY_NORMAL,
+    // NOTE(traks): bulk work no one is waiting for
+    TASK_PRIORITY_BACKGROUND,
+    TASK_PRIORITY_COUNT,
+};
+
+#define TASK_NO_DEADLINE (INT64_MAX)
+
 typedef struct {
     TaskQueueCallback callback;
     void * data;
+    i64 deadlineTick;
 } TaskQueueEntry;
 
+// NOTE(traks): atomic, because thieves may read a slot while its owner writes
+// to it. Thieves throw away what they read in that case
+typedef struct {
+    TaskQueueCallback _Atomic callback;
+    void * _Atomic data;
+    _Atomic i64 deadlineTick;
+} TaskSlot;
+
+#define TASK_DEQUE_SIZE (256)
+
+// NOTE(traks): Chase-Lev deque of fixed size. The owning worker pushes and
+// pops at the bottom, other workers steal from the top
+typedef struct {
+    alignas(64) _Atomic i64 top;
+    alignas(64) _Atomic i64 bottom;
+    TaskSlot slots[TASK_DEQUE_SIZE];
+} TaskDeque;
+
 typedef struct {
-    // NOTE(traks): not modded, but allowed to wrap around
+    struct TaskQueue * queue;
+    u32 randomState;
+    // NOTE(traks): number of times the worker went looking for a task
+    u32 pickCount;
+    TaskDeque deques[TASK_PRIORITY_COUNT];
+} TaskWorker;
+
+typedef struct {
+    // NOTE(traks): Not modded, but allowed to wrap around. Otherwise slow
+    // threads could mistake a position for one of many pushes/pops ago
     _Atomic u32 writeCommit;
-    // NOTE(traks): modded by size
     _Atomic u32 writeIndex;
     _Atomic u32 readIndex;
+    TaskSlot entries[256];
+} TaskRing;
+
+// NOTE(traks): Work-stealing thread pool. Tasks pushed by one of its workers
+// go to the worker's own deque, where idle workers can steal them from. Tasks
+// pushed by any other thread go to a shared ring buffer. There is a deque per
+// worker and a ring for every priority. Idle workers spin for a bit before
+// going to sleep, and pushing only wakes a worker if none are spinning.
+typedef struct TaskQueue {
+    TaskRing rings[TASK_PRIORITY_COUNT];
+
+    TaskWorker * workers;
+    i32 workerCount;
+    _Atomic i32 spinningWorkers;
+    _Atomic i32 sleepingWorkers;
+    // NOTE(traks): tasks whose deadline is at or before this tick go first
+    _Atomic i64 currentTick;
     pthread_mutex_t mutex;
     pthread_cond_t cond;
-    TaskQueueEntry entries[256];
 } TaskQueue;
 
+// NOTE(traks): a thread count of 0 or less uses all cores but one, leaving
+// one for the main thread
 void CreateTaskQueue(TaskQueue * queue, i32 threadCount);
+// NOTE(traks): Returns 0 if the queue is full, in which case the caller should
+// run the task itself or try again later. Pushes a task of normal priority
+// without deadline
 i32 PushTaskToQueue(TaskQueue * queue, TaskQueueCallback callback, void * data);
+// NOTE(traks): Once the deadline tick has come, the task is taken before tasks
+// of any priority. Deadlines are best effort: only the oldest queued tasks of
+// each priority are checked for them. Use TASK_NO_DEADLINE for none
+i32 PushPrioritisedTask(TaskQueue * queue, i32 priority, i64 deadlineTick, TaskQueueCallback callback, void * data);
+// NOTE(traks): call once every tick, for deadlines
+void SetTaskQueueTick(TaskQueue * queue, i64 tick);
+
+// NOTE(traks): Scratch memory for tasks, one arena per thread that is reused by
+// all tasks running on that thread. The arena reserves a large range of
+// address space and only the pages we touch take up memory, so it grows as
+// needed while allocations stay contiguous. Begin clears the arena. End
+// records how much the task used, and gives memory back to the OS if the task
+// used a lot. Tasks can't nest these
+MemoryArena * BeginThreadScratch(void);
+void EndThreadScratch(MemoryArena * arena);
+
+// NOTE(traks): Stores the most memory any task used on each thread with a
+// scratch arena. Returns the number of threads
+i32 GetThreadScratchHighWaterMarks(i64 * marks, i32 maxCount);
 
 #endif
@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "uring.h"
+
+#ifdef __linux__
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// NOTE(traks): chunk loads in flight are limited anyway, this is plenty
+#define URING_ENTRIES (256)
+
+#define ASYNC_READ_BUFFER_COUNT (32)
+
+typedef struct {
+    AsyncReadCallback callback;
+    void * data;
+    int fd;
+    i64 offset;
+    u8 * buffer;
+    i32 size;
+    i32 bytesRead;
+    // NOTE(traks): -1 if the buffer isn't registered
+    i32 bufferIndex;
+} AsyncRead;
+
+typedef struct {
+    int ringFd;
+
+    // NOTE(traks): submissions are serialised by the mutex
+    pthread_mutex_t submitMutex;
+    _Atomic u32 * sqHead;
+    _Atomic u32 * sqTail;
+    u32 sqMask;
+    u32 sqEntries;
+    u32 * sqArray;
+    struct io_uring_sqe * sqes;
+
+    // NOTE(traks): only the completion thread touches the completion queue
+    _Atomic u32 * cqHead;
+    _Atomic u32 * cqTail;
+    u32 cqMask;
+    struct io_uring_cqe * cqes;
+
+    i32 buffersRegistered;
+    pthread_mutex_t poolMutex;
+    i32 freeBuffers[ASYNC_READ_BUFFER_COUNT];
+    i32 freeBufferCount;
+} Uring;
+
+static Uring uring;
+// NOTE(traks): pooled read buffers. Read buffers outside of the pool were
+// allocated with malloc
+static u8 * bufferPool;
+
+static void CompleteAsyncRead(AsyncRead * read, i32 result);
+
+static void PushAsyncRead(AsyncRead * read) {
+    Uring * ring = &uring;
+    pthread_mutex_lock(&ring->submitMutex);
+
+    u32 tail = atomic_load_explicit(ring->sqTail, memory_order_relaxed);
+    // NOTE(traks): we submit every entry right away, so the kernel consumed
+    // all earlier entries and there's always room
+    assert(tail - atomic_load_explicit(ring->sqHead, memory_order_acquire) < ring->sqEntries);
+    u32 index = tail & ring->sqMask;
+    struct io_uring_sqe * sqe = ring->sqes + index;
+    *sqe = (struct io_uring_sqe) {
+        .fd = read->fd,
+        .off = read->offset + read->bytesRead,
+        .addr = (uintptr_t) (read->buffer + read->bytesRead),
+        .len = read->size - read->bytesRead,
+        .user_data = (uintptr_t) read,
+    };
+    if (read->bufferIndex != -1) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = read->bufferIndex;
+    } else {
+        sqe->opcode = IORING_OP_READ;
+    }
+    ring->sqArray[index] = index;
+    atomic_store_explicit(ring->sqTail, tail + 1, memory_order_release);
+
+    i32 submitFailed = 0;
+    for (;;) {
+        int submitted = syscall(__NR_io_uring_enter, ring->ringFd, 1, 0, 0, NULL, 0);
+        if (submitted >= 0) {
+            break;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            LogErrno("Failed to submit read: %s");
+            // NOTE(traks): if the kernel didn't take the entry, take it back
+            // out of the queue. Otherwise it completes as usual
+            if (atomic_load_explicit(ring->sqHead, memory_order_acquire) == tail) {
+                atomic_store_explicit(ring->sqTail, tail, memory_order_release);
+                submitFailed = 1;
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&ring->submitMutex);
+
+    if (submitFailed) {
+        // NOTE(traks): do a blocking read instead, so whoever waits for the
+        // read doesn't wait forever
+        ssize_t bytesRead = pread(read->fd, read->buffer + read->bytesRead, read->size - read->bytesRead, read->offset + read->bytesRead);
+        CompleteAsyncRead(read, bytesRead < 0 ? -errno : bytesRead);
+    }
+}
+
+static void CompleteAsyncRead(AsyncRead * read, i32 result) {
+    if (result > 0) {
+        read->bytesRead += result;
+        if (read->bytesRead < read->size) {
+            // NOTE(traks): short read, read the rest
+            PushAsyncRead(read);
+            return;
+        }
+    } else {
+        if (result < 0) {
+            errno = -result;
+            LogErrno("Failed to read region file: %s");
+        } else {
+            LogInfo("Wanted %d bytes from region file, but got %d", read->size, read->bytesRead);
+        }
+        FreeReadBuffer(read->buffer);
+        read->buffer = NULL;
+    }
+
+    read->callback(read->buffer, read->data);
+    free(read);
+}
+
+static void * RunCompletionThread(void * arg) {
+#ifdef PROFILE
+    TracyCSetThreadName("Uring");
+#endif
+    (void) arg;
+
+    Uring * ring = &uring;
+    for (;;) {
+        int res = syscall(__NR_io_uring_enter, ring->ringFd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (res < 0 && errno != EINTR) {
+            LogErrno("Failed to wait for reads: %s");
+        }
+
+        u32 head = atomic_load_explicit(ring->cqHead, memory_order_relaxed);
+        u32 tail = atomic_load_explicit(ring->cqTail, memory_order_acquire);
+        while (head != tail) {
+            struct io_uring_cqe cqe = ring->cqes[head & ring->cqMask];
+            head++;
+            atomic_store_explicit(ring->cqHead, head, memory_order_release);
+            CompleteAsyncRead((AsyncRead *) (uintptr_t) cqe.user_data, cqe.res);
+        }
+    }
+    return NULL;
+}
+
+i32 InitAsyncReads(void) {
+    Uring * ring = &uring;
+    struct io_uring_params params = {0};
+    ring->ringFd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring->ringFd < 0) {
+        LogErrno("io_uring not available, using blocking reads: %s");
+        return 0;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof (u32);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        sqSize = MAX(sqSize, cqSize);
+        cqSize = sqSize;
+    }
+    u8 * sqRing = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQ_RING);
+    u8 * cqRing = sqRing;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) && sqRing != MAP_FAILED) {
+        cqRing = mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_CQ_RING);
+    }
+    void * sqes = mmap(NULL, params.sq_entries * sizeof (struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ringFd, IORING_OFF_SQES);
+    if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+        // TODO(traks): unmap whatever did get mapped
+        LogErrno("Failed to map io_uring, using blocking reads: %s");
+        close(ring->ringFd);
+        return 0;
+    }
+
+    ring->sqHead = (_Atomic u32 *) (sqRing + params.sq_off.head);
+    ring->sqTail = (_Atomic u32 *) (sqRing + params.sq_off.tail);
+    ring->sqMask = *(u32 *) (sqRing + params.sq_off.ring_mask);
+    ring->sqEntries = *(u32 *) (sqRing + params.sq_off.ring_entries);
+    ring->sqArray = (u32 *) (sqRing + params.sq_off.array);
+    ring->sqes = sqes;
+    ring->cqHead = (_Atomic u32 *) (cqRing + params.cq_off.head);
+    ring->cqTail = (_Atomic u32 *) (cqRing + params.cq_off.tail);
+    ring->cqMask = *(u32 *) (cqRing + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cqRing + params.cq_off.cqes);
+
+    i64 poolSize = (i64) ASYNC_READ_BUFFER_COUNT * ASYNC_READ_BUFFER_SIZE;
+    void * pool = mmap(NULL, poolSize, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (pool == MAP_FAILED) {
+        LogErrno("Failed to map read buffers, using blocking reads: %s");
+        close(ring->ringFd);
+        return 0;
+    }
+    bufferPool = pool;
+
+    struct iovec iovecs[ASYNC_READ_BUFFER_COUNT];
+    for (i32 bufferIndex = 0; bufferIndex < ASYNC_READ_BUFFER_COUNT; bufferIndex++) {
+        iovecs[bufferIndex] = (struct iovec) {
+            .iov_base = bufferPool + (i64) bufferIndex * ASYNC_READ_BUFFER_SIZE,
+            .iov_len = ASYNC_READ_BUFFER_SIZE,
+        };
+        ring->freeBuffers[bufferIndex] = bufferIndex;
+    }
+    ring->freeBufferCount = ASYNC_READ_BUFFER_COUNT;
+
+    // NOTE(traks): registered buffers are pinned in memory and may exceed the
+    // memlock limit. The buffers work fine without registering them, the kernel
+    // then has to map them for every read
+    if (syscall(__NR_io_uring_register, ring->ringFd, IORING_REGISTER_BUFFERS, iovecs, ASYNC_READ_BUFFER_COUNT) == 0) {
+        ring->buffersRegistered = 1;
+    } else {
+        LogErrno("Failed to register read buffers: %s");
+    }
+
+    pthread_mutex_init(&ring->submitMutex, NULL);
+    pthread_mutex_init(&ring->poolMutex, NULL);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, RunCompletionThread, NULL)) {
+        LogErrno("Failed to create io_uring thread: %s");
+        exit(1);
+    }
+
+    LogInfo("Using io_uring for chunk reads (%s buffers)", ring->buffersRegistered ? "registered" : "unregistered");
+    return 1;
+}
+
+void SubmitAsyncRead(int fd, i64 offset, i32 size, AsyncReadCallback callback, void * data) {
+    Uring * ring = &uring;
+    AsyncRead * read = malloc(sizeof *read);
+    if (read == NULL) {
+        callback(NULL, data);
+        return;
+    }
+    *read = (AsyncRead) {
+        .callback = callback,
+        .data = data,
+        .fd = fd,
+        .offset = offset,
+        .size = size,
+        .bufferIndex = -1,
+    };
+
+    if (size <= ASYNC_READ_BUFFER_SIZE) {
+        pthread_mutex_lock(&ring->poolMutex);
+        if (ring->freeBufferCount > 0) {
+            ring->freeBufferCount--;
+            i32 bufferIndex = ring->freeBuffers[ring->freeBufferCount];
+            read->buffer = bufferPool + (i64) bufferIndex * ASYNC_READ_BUFFER_SIZE;
+            if (ring->buffersRegistered) {
+                read->bufferIndex = bufferIndex;
+            }
+        }
+        pthread_mutex_unlock(&ring->poolMutex);
+    }
+    if (read->buffer == NULL) {
+        // NOTE(traks): too large or pool exhausted
+        read->buffer = malloc(size);
+        if (read->buffer == NULL) {
+            free(read);
+            callback(NULL, data);
+            return;
+        }
+    }
+
+    PushAsyncRead(read);
+}
+
+void FreeReadBuffer(u8 * buffer) {
+    i64 poolSize = (i64) ASYNC_READ_BUFFER_COUNT * ASYNC_READ_BUFFER_SIZE;
+    if (bufferPool != NULL && buffer >= bufferPool && buffer < bufferPool + poolSize) {
+        Uring * ring = &uring;
+        pthread_mutex_lock(&ring->poolMutex);
+        ring->freeBuffers[ring->freeBufferCount] = (buffer - bufferPool) / ASYNC_READ_BUFFER_SIZE;
+        ring->freeBufferCount++;
+        pthread_mutex_unlock(&ring->poolMutex);
+    } else {
+        free(buffer);
+    }
+}
+
+#else
+
+i32 InitAsyncReads(void) {
+    return 0;
+}
+
+void SubmitAsyncRead(int fd, i64 offset, i32 size, AsyncReadCallback callback, void * data) {
+    assert(0);
+}
+
+void FreeReadBuffer(u8 * buffer) {
+    free(buffer);
+}
+
+#endif
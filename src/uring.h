@@ -0,0 +1,25 @@
+#ifndef URING_H
+#define URING_H
+
+#include "base.h"
+
+// NOTE(traks): Asynchronous file reads through io_uring on Linux. Reads are
+// submitted from any thread and a dedicated thread waits for completions, so
+// many reads can be in flight without tying up worker threads. Read buffers come
+// from a pool of buffers registered with the kernel where possible.
+
+// NOTE(traks): reads up to this size use pooled buffers
+#define ASYNC_READ_BUFFER_SIZE (256 * 1024)
+
+// NOTE(traks): called on the completion thread. The buffer is NULL if the read
+// failed, otherwise it must be freed with FreeReadBuffer
+typedef void (* AsyncReadCallback)(u8 * buffer, void * data);
+
+// NOTE(traks): returns 0 if asynchronous reads aren't available, in which case
+// the other functions here must not be used
+i32 InitAsyncReads(void);
+void SubmitAsyncRead(int fd, i64 offset, i32 size, AsyncReadCallback callback, void * data);
+// NOTE(traks): also accepts buffers allocated with malloc
+void FreeReadBuffer(u8 * buffer);
+
+#endif